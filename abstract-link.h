@@ -0,0 +1,366 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Abstract link layer for quick protocol sweeps, shared by adhoc_routing.cc
+ * and aodv.cc.
+ *
+ * Nodes get SimpleNetDevices on an AbstractLinkChannel instead of Wi-Fi
+ * devices.  There is no PHY state machine, no interference and no MAC
+ * contention: a frame reaches every device within range, and whether it
+ * arrives is drawn from a lookup table of per-bit success probabilities by
+ * distance.  Calibrate () fills that table with what a YansWifiPhy would
+ * compute for a lone frame: the same propagation loss model, transmit
+ * power, thermal noise and noise figure, and the NIST error rate model at
+ * the configured Wi-Fi mode.  Receivers below RxThreshold never get the
+ * frame, which also sets the range.  A grid with cells as wide as that
+ * range (mobility-grid.h) limits each frame to the devices near the
+ * sender; with UseIndex=false every device is looked at, with the same
+ * result.
+ *
+ * Unicast frames are retried up to MaxRetries times; each failed attempt
+ * delays the delivery by one more access, frame and ACK time.  The sending
+ * device serializes its queue at the Wi-Fi data rate.  Collisions, carrier
+ * sense and hidden terminals are not modelled, so the error grows with the
+ * offered load; RunPhyReport in adhoc_routing.cc measures it.
+ *
+ * The members are defined inline so that several translation units may
+ * include this header; the program registers the TypeId once with
+ * NS_OBJECT_ENSURE_REGISTERED in its .cc file.
+ */
+
+#ifndef ABSTRACT_LINK_H
+#define ABSTRACT_LINK_H
+
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ns3/boolean.h"
+#include "ns3/constant-position-mobility-model.h"
+#include "ns3/data-rate.h"
+#include "ns3/double.h"
+#include "ns3/mac48-address.h"
+#include "ns3/mobility-model.h"
+#include "ns3/nist-error-rate-model.h"
+#include "ns3/node.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/simple-channel.h"
+#include "ns3/simple-net-device.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+#include "ns3/wifi-mode.h"
+#include "ns3/wifi-tx-vector.h"
+#include "mobility-grid.h"
+
+namespace ns3 {
+
+class AbstractLinkChannel : public SimpleChannel
+{
+public:
+  static TypeId GetTypeId (void);
+  AbstractLinkChannel ();
+
+  /**
+   * Build the delivery table for frames sent at \p txPowerDbm in \p mode
+   * through \p loss, which must depend on distance only.
+   */
+  void Calibrate (Ptr<PropagationLossModel> loss, WifiMode mode, double txPowerDbm);
+
+  // inherited from SimpleChannel
+  virtual void Send (Ptr<Packet> p, uint16_t protocol, Mac48Address to, Mac48Address from,
+                     Ptr<SimpleNetDevice> sender);
+  virtual void Add (Ptr<SimpleNetDevice> device);
+
+  /// Data rate of the calibrated mode, for the devices' DataRate attribute
+  DataRate GetDataRate (void) const;
+  /// Distance beyond which no frame is received, m
+  double GetRange (void) const;
+  int64_t AssignStreams (int64_t stream);
+
+  /// Print the calibration and transmission, delivery and retry counters
+  void PrintStats (std::ostream &os) const;
+
+private:
+  virtual void DoDispose (void);
+  /// Probability that \p bits bits sent over \p distance all arrive
+  double SuccessRate (double distance, uint32_t bits) const;
+
+  std::vector<Ptr<SimpleNetDevice> > m_devices;
+  std::vector<Ptr<MobilityModel> > m_mobility;   ///< resolved on first use
+  Ptr<UniformRandomVariable> m_random;
+  MobilityGrid m_grid;
+  std::vector<uint32_t> m_candidates;
+  bool m_useIndex;
+
+  double m_binWidth;
+  double m_maxRange;
+  double m_rxThresholdDbm;
+  double m_noiseFigureDb;
+  uint32_t m_maxRetries;
+
+  // calibration
+  std::string m_modeName;
+  double m_txPowerDbm;
+  uint64_t m_bitRate;
+  double m_range;
+  std::vector<double> m_logSuccessPerBit;        ///< per distance bin
+  Time m_preamble;
+  Time m_access;       ///< DIFS and mean backoff before each attempt
+  Time m_ack;          ///< SIFS and ACK after each unicast attempt
+
+  uint64_t m_transmissions;
+  uint64_t m_examined;
+  uint64_t m_delivered;
+  uint64_t m_lost;
+  uint64_t m_retries;
+};
+
+inline TypeId
+AbstractLinkChannel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::AbstractLinkChannel")
+    .SetParent<SimpleChannel> ()
+    .AddConstructor<AbstractLinkChannel> ()
+    .AddAttribute ("BinWidth",
+                   "Width of the distance bins of the delivery table, m.",
+                   DoubleValue (1.0),
+                   MakeDoubleAccessor (&AbstractLinkChannel::m_binWidth),
+                   MakeDoubleChecker<double> (1e-3))
+    .AddAttribute ("MaxRange",
+                   "The table never extends beyond this distance, m.",
+                   DoubleValue (10000.0),
+                   MakeDoubleAccessor (&AbstractLinkChannel::m_maxRange),
+                   MakeDoubleChecker<double> (0))
+    .AddAttribute ("RxThreshold",
+                   "Frames received below this power (dBm) are not detected, as the Wi-Fi EnergyDetectionThreshold.",
+                   DoubleValue (-96.0),
+                   MakeDoubleAccessor (&AbstractLinkChannel::m_rxThresholdDbm),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("NoiseFigure",
+                   "Receiver noise figure, dB, as the Wi-Fi RxNoiseFigure.",
+                   DoubleValue (7.0),
+                   MakeDoubleAccessor (&AbstractLinkChannel::m_noiseFigureDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("MaxRetries",
+                   "Attempts after the first one for a unicast frame, as the station manager's MaxSlrc.",
+                   UintegerValue (7),
+                   MakeUintegerAccessor (&AbstractLinkChannel::m_maxRetries),
+                   MakeUintegerChecker<uint32_t> ())
+    .AddAttribute ("UseIndex",
+                   "Only look at the devices in the grid cells around the sender instead of at every device.",
+                   BooleanValue (true),
+                   MakeBooleanAccessor (&AbstractLinkChannel::m_useIndex),
+                   MakeBooleanChecker ())
+  ;
+  return tid;
+}
+
+inline
+AbstractLinkChannel::AbstractLinkChannel ()
+  : m_useIndex (true),
+    m_binWidth (1.0),
+    m_maxRange (10000.0),
+    m_rxThresholdDbm (-96.0),
+    m_noiseFigureDb (7.0),
+    m_maxRetries (7),
+    m_txPowerDbm (0),
+    m_bitRate (0),
+    m_range (0),
+    m_transmissions (0),
+    m_examined (0),
+    m_delivered (0),
+    m_lost (0),
+    m_retries (0)
+{
+  m_random = CreateObject<UniformRandomVariable> ();
+}
+
+inline void
+AbstractLinkChannel::DoDispose (void)
+{
+  m_devices.clear ();
+  m_mobility.clear ();
+  m_grid.Clear ();
+  m_random = 0;
+  SimpleChannel::DoDispose ();
+}
+
+inline void
+AbstractLinkChannel::Calibrate (Ptr<PropagationLossModel> loss, WifiMode mode, double txPowerDbm)
+{
+  bool dsss = mode.GetModulationClass () == WIFI_MOD_CLASS_DSSS
+    || mode.GetModulationClass () == WIFI_MOD_CLASS_HR_DSSS;
+  uint16_t channelWidth = dsss ? 22 : 20;
+  WifiTxVector txVector;
+  txVector.SetMode (mode);
+  txVector.SetChannelWidth (channelWidth);
+  txVector.SetGuardInterval (800);
+  txVector.SetNss (1);
+
+  m_modeName = mode.GetUniqueName ();
+  m_txPowerDbm = txPowerDbm;
+  m_bitRate = mode.GetDataRate (txVector);
+  // 802.11b long preamble and 802.11a timings; an ACK is 14 bytes at the
+  // lowest mandatory rate
+  m_preamble = dsss ? MicroSeconds (192) : MicroSeconds (20);
+  m_access = dsss ? MicroSeconds (50 + 31 * 20 / 2) : MicroSeconds (34 + 15 * 9 / 2);
+  m_ack = dsss ? MicroSeconds (10 + 192 + 112) : MicroSeconds (16 + 20 + 24);
+
+  // thermal noise over the channel width, as the Yans InterferenceHelper
+  double noiseW = 1.3803e-23 * 290.0 * channelWidth * 1e6 * std::pow (10.0, m_noiseFigureDb / 10.0);
+  Ptr<NistErrorRateModel> error = CreateObject<NistErrorRateModel> ();
+  Ptr<ConstantPositionMobilityModel> a = CreateObject<ConstantPositionMobilityModel> ();
+  Ptr<ConstantPositionMobilityModel> b = CreateObject<ConstantPositionMobilityModel> ();
+  a->SetPosition (Vector (0, 0, 0));
+
+  m_logSuccessPerBit.clear ();
+  m_range = 0;
+  m_grid.Invalidate ();
+  for (double d = m_binWidth / 2; d < m_maxRange; d += m_binWidth)
+    {
+      b->SetPosition (Vector (d, 0, 0));
+      double rxDbm = loss->CalcRxPower (txPowerDbm, a, b);
+      if (rxDbm < m_rxThresholdDbm)
+        {
+          break;
+        }
+      double snr = std::pow (10.0, (rxDbm - 30) / 10.0) / noiseW;
+      double success = error->GetChunkSuccessRate (mode, txVector, snr, 1);
+      if (success <= 0)
+        {
+          break;
+        }
+      m_logSuccessPerBit.push_back (std::log (std::min (success, 1.0)));
+      m_range = d + m_binWidth / 2;
+    }
+}
+
+inline DataRate
+AbstractLinkChannel::GetDataRate (void) const
+{
+  return DataRate (m_bitRate);
+}
+
+inline double
+AbstractLinkChannel::GetRange (void) const
+{
+  return m_range;
+}
+
+inline int64_t
+AbstractLinkChannel::AssignStreams (int64_t stream)
+{
+  m_random->SetStream (stream);
+  return 1;
+}
+
+inline void
+AbstractLinkChannel::Add (Ptr<SimpleNetDevice> device)
+{
+  m_devices.push_back (device);
+  m_mobility.push_back (0);
+  m_grid.Invalidate ();
+  SimpleChannel::Add (device);
+}
+
+inline double
+AbstractLinkChannel::SuccessRate (double distance, uint32_t bits) const
+{
+  size_t bin = distance / m_binWidth;
+  if (bin >= m_logSuccessPerBit.size ())
+    {
+      return 0;
+    }
+  return std::exp (m_logSuccessPerBit[bin] * bits);
+}
+
+inline void
+AbstractLinkChannel::Send (Ptr<Packet> p, uint16_t protocol, Mac48Address to, Mac48Address from,
+                           Ptr<SimpleNetDevice> sender)
+{
+  NS_ASSERT_MSG (m_bitRate > 0, "AbstractLinkChannel used before Calibrate ()");
+  m_transmissions++;
+  Ptr<MobilityModel> senderMobility = sender->GetNode ()->GetObject<MobilityModel> ();
+  // MAC header, LLC/SNAP and FCS of the Wi-Fi frame this stands for
+  uint32_t bits = (p->GetSize () + 36) * 8;
+  Time frame = m_preamble + Seconds (double (bits) / m_bitRate);
+  Time attempt = m_access + frame + m_ack;
+  bool unicast = !to.IsBroadcast () && !to.IsGroup ();
+
+  // mobility is installed after the devices, so it is looked up on the
+  // first transmission
+  if (!m_grid.IsBuilt ())
+    {
+      for (size_t i = 0; i < m_devices.size (); i++)
+        {
+          m_mobility[i] = m_devices[i]->GetNode ()->GetObject<MobilityModel> ();
+        }
+      // no range: nothing is received, any cell size will do
+      m_grid.Build (m_mobility, std::max (m_range, m_binWidth));
+    }
+  m_candidates.clear ();
+  if (m_useIndex)
+    {
+      m_grid.Candidates (senderMobility->GetPosition (), m_candidates);
+    }
+  else
+    {
+      for (uint32_t i = 0; i < m_devices.size (); i++)
+        {
+          m_candidates.push_back (i);
+        }
+    }
+
+  // in the order the devices were added, so the draws of m_random do not
+  // depend on UseIndex
+  for (std::vector<uint32_t>::const_iterator c = m_candidates.begin (); c != m_candidates.end (); ++c)
+    {
+      uint32_t i = *c;
+      Ptr<SimpleNetDevice> device = m_devices[i];
+      if (device == sender)
+        {
+          continue;
+        }
+      m_examined++;
+      double distance = senderMobility->GetDistanceFrom (m_mobility[i]);
+      double success = SuccessRate (distance, bits);
+      if (success <= 0)
+        {
+          continue;
+        }
+      // only the addressee retries; others overhear the first attempt
+      uint32_t attempts = unicast && device->GetAddress () == to ? m_maxRetries + 1 : 1;
+      uint32_t k = 0;
+      while (k < attempts && m_random->GetValue () >= success)
+        {
+          k++;
+        }
+      if (k == attempts)
+        {
+          m_lost++;
+          m_retries += attempts - 1;
+          continue;
+        }
+      m_retries += k;
+      m_delivered++;
+      Time delay = attempt * k + m_access + frame + Seconds (distance / 299792458.0);
+      Simulator::ScheduleWithContext (device->GetNode ()->GetId (), delay,
+                                      &SimpleNetDevice::Receive, device, p->Copy (), protocol, to, from);
+    }
+}
+
+inline void
+AbstractLinkChannel::PrintStats (std::ostream &os) const
+{
+  os << "Abstract links: " << m_modeName << " at " << m_txPowerDbm << " dBm, range "
+     << m_range << " m, " << m_transmissions << " transmissions, "
+     << m_examined << " receivers examined, "
+     << m_delivered << " delivered, "
+     << m_lost << " lost, "
+     << m_retries << " retries\n";
+}
+
+} // namespace ns3
+
+#endif /* ABSTRACT_LINK_H */
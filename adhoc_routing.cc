@@ -9,11 +9,26 @@ The goal of this project was to evaluate the performance of On-demand Distance V
 
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <functional>
+#include <sys/resource.h>
 #include "ns3/core-module.h"
 #include "ns3/network-module.h"
 #include "ns3/internet-module.h"
 #include "ns3/mobility-module.h"
 #include "ns3/wifi-module.h"
+#include "ns3/spectrum-module.h"
 #include "ns3/aodv-module.h"
 #include "ns3/olsr-module.h"
 #include "ns3/dsdv-module.h"
@@ -21,6 +36,21 @@ The goal of this project was to evaluate the performance of On-demand Distance V
 #include "ns3/applications-module.h"
 #include "ns3/flow-monitor-module.h"
 #include "ns3/netanim-module.h"
+#include "trace-level.h"
+#include "grid-spectrum-channel.h"
+#include "abstract-link.h"
+#include "propagation-cache.h"
+#include "traffic-generator.h"
+#include "radix-heap-scheduler.h"
+#include "progress-monitor.h"
+#include "memory-report.h"
+#include "anim-stream.h"
+#include "async-trace.h"
+#include "flow-stats.h"
+#include "trajectory-mobility.h"
+#include "regression-baseline.h"
+#include "route-snapshots.h"
+#include "routing-overhead.h"
 
 using namespace ns3;
 using namespace dsr;
@@ -28,68 +58,455 @@ using namespace std;
 
 NS_LOG_COMPONENT_DEFINE ("Adhoc-routing-compare");
 
-int nRuns;
+// The TypeIds of the objects defined in the headers above are registered
+// here, once per program
+NS_OBJECT_ENSURE_REGISTERED (AbstractLinkChannel);
+NS_OBJECT_ENSURE_REGISTERED (PropagationCache);
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationLossModel);
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationDelayModel);
+NS_OBJECT_ENSURE_REGISTERED (RadixHeapScheduler);
+NS_OBJECT_ENSURE_REGISTERED (GridSpectrumChannel);
+NS_OBJECT_ENSURE_REGISTERED (TrafficGenerator);
+NS_OBJECT_ENSURE_REGISTERED (InstrumentedScheduler);
+NS_OBJECT_ENSURE_REGISTERED (FlowTimestampTag);
+NS_OBJECT_ENSURE_REGISTERED (TrajectoryMobilityModel);
+
+int nRuns = 1;
+
+/// Flow statistics of one replication, averaged over its sources
+struct RunResult
+{
+  double txPackets;
+  double txBytes;
+  double rxPackets;
+  double rxBytes;
+  double delay;           ///< mean end-to-end delay of the received packets, s
+  LatencyHistogram latency;  ///< delays of all received packets
+  OnlineStats jitter;     ///< delay variation between consecutive packets of a flow, s
+  double throughputKbps;  ///< over each flow's own measurement window
+  double deliveryRatio;
+  // routing control traffic of all nodes
+  double controlPackets;
+  double controlBytes;
+  double controlAirtime;  ///< s
+  double routingLoad;     ///< control bytes per delivered data byte
+  // cost of the run
+  double setupSeconds;
+  double runSeconds;
+  uint64_t events;
+  long peakRssKb;
+};
+
+/**
+ * Preallocated in-memory store for the periodic receive-rate samples.
+ *
+ * Bytes and packets are counted per sink and per source as well as in
+ * aggregate.  Each Sample () only copies the current counters into a
+ * reserved buffer; the CSV file is written in one go by Flush () at the end
+ * of the run, or whenever maxBufferedSamples rows have piled up.
+ */
+class TimeSeriesCollector
+{
+public:
+  TimeSeriesCollector ();
+  void Setup (std::string fileName, std::string constantColumns, double interval,
+              uint32_t nSinks, uint32_t nSources, uint32_t expectedSamples, uint32_t maxBufferedSamples);
+  void Record (int sink, int source, uint32_t bytes);
+  void Sample (double now);
+  void Flush ();
+
+private:
+  /// Counter slot of the aggregate, of sink i and of source j (two values each)
+  uint32_t AggregateSlot () const { return 0; }
+  uint32_t SinkSlot (uint32_t i) const { return 2 * (1 + i); }
+  uint32_t SourceSlot (uint32_t j) const { return 2 * (1 + m_nSinks + j); }
+
+  std::string m_fileName;
+  std::string m_constantColumns;
+  double m_interval;
+  uint32_t m_nSinks;
+  uint32_t m_nSources;
+  uint32_t m_width;
+  uint32_t m_capacity;
+  bool m_headerWritten;
+  std::vector<uint64_t> m_current;
+  std::vector<double> m_times;
+  std::vector<uint64_t> m_values;
+};
+
+TimeSeriesCollector::TimeSeriesCollector ()
+  : m_interval (1.0),
+    m_nSinks (0),
+    m_nSources (0),
+    m_width (2),
+    m_capacity (1),
+    m_headerWritten (false)
+{
+}
+
+void
+TimeSeriesCollector::Setup (std::string fileName, std::string constantColumns, double interval,
+                            uint32_t nSinks, uint32_t nSources, uint32_t expectedSamples, uint32_t maxBufferedSamples)
+{
+  m_fileName = fileName;
+  m_constantColumns = constantColumns;
+  m_interval = interval;
+  m_nSinks = nSinks;
+  m_nSources = nSources;
+  m_width = 2 * (1 + nSinks + nSources);
+  m_capacity = std::max<uint32_t> (1, std::min (expectedSamples, maxBufferedSamples));
+  m_headerWritten = false;
+  m_current.assign (m_width, 0);
+  m_times.clear ();
+  m_values.clear ();
+  m_times.reserve (m_capacity);
+  m_values.reserve (static_cast<size_t> (m_capacity) * m_width);
+}
+
+void
+TimeSeriesCollector::Record (int sink, int source, uint32_t bytes)
+{
+  m_current[AggregateSlot ()] += bytes;
+  m_current[AggregateSlot () + 1]++;
+  if (sink >= 0)
+    {
+      m_current[SinkSlot (sink)] += bytes;
+      m_current[SinkSlot (sink) + 1]++;
+    }
+  if (source >= 0)
+    {
+      m_current[SourceSlot (source)] += bytes;
+      m_current[SourceSlot (source) + 1]++;
+    }
+}
+
+void
+TimeSeriesCollector::Sample (double now)
+{
+  m_times.push_back (now);
+  m_values.insert (m_values.end (), m_current.begin (), m_current.end ());
+  std::fill (m_current.begin (), m_current.end (), 0);
+  if (m_times.size () >= m_capacity)
+    {
+      Flush ();
+    }
+}
+
+void
+TimeSeriesCollector::Flush ()
+{
+  if (m_headerWritten && m_times.empty ())
+    {
+      return;
+    }
+  std::ofstream out (m_fileName.c_str (), m_headerWritten ? std::ios::app : std::ios::out);
+  if (!m_headerWritten)
+    {
+      out << "SimulationSecond,ReceiveRate,PacketsReceived,NumberOfSinks,NumberOfSources,RoutingProtocol,TransmissionPower";
+      for (uint32_t i = 0; i < m_nSinks; i++)
+        {
+          out << ",Sink" << i << "ReceiveRate,Sink" << i << "PacketsReceived";
+        }
+      for (uint32_t j = 0; j < m_nSources; j++)
+        {
+          out << ",Source" << j << "ReceiveRate,Source" << j << "PacketsReceived";
+        }
+      out << "\n";
+      m_headerWritten = true;
+    }
+  // rates are in kbps over the sample interval
+  double scale = 8.0 / 1000 / m_interval;
+  for (size_t row = 0; row < m_times.size (); row++)
+    {
+      const uint64_t *v = &m_values[row * m_width];
+      out << m_times[row] << "," << v[0] * scale << "," << v[1] << "," << m_constantColumns;
+      for (uint32_t k = 2; k < m_width; k += 2)
+        {
+          out << "," << v[k] * scale << "," << v[k + 1];
+        }
+      out << "\n";
+    }
+  out.close ();
+  m_times.clear ();
+  m_values.clear ();
+}
 
 class RoutingExperiment
 {
 public:
   RoutingExperiment ();
-  void Run (int nSinks, int nSources, double txp, std::string CSVfileName, int64_t streamIndex);
+  RunResult Run (int nSinks, int nSources, double txp, std::string CSVfileName, int64_t streamIndex, int runIndex);
+  /// Run all nRuns replications, forking up to m_nWorkers of them at a time;
+  /// with m_ciTarget set, stop as soon as the results have converged
+  void RunReplications (int nSinks, int nSources, double txp, std::string CSVfileName);
+  void ReportRun (const RunResult &result);
+  void ReportOverall ();
+  /// True once every tracked metric's relative CI half-width is below m_ciTarget
+  bool Converged () const;
+  /// Sweep node count, protocol, speed and rate and write a cost report
+  void RunBenchmark (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool Benchmark () const { return !m_benchmarkFile.empty (); }
+  /// Run the fixed regression scenarios against the baseline; true if none drifted
+  bool RunRegression (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool Regression () const { return !m_regressionFile.empty (); }
+  /// Run every point of the scenario file, skipping those already in the results store
+  void RunSweep (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool Sweep () const { return !m_scenarioFile.empty (); }
+  /// Warm the network up once, then run every traffic variant from that state
+  void RunVariants (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool Variants () const { return m_warmup > 0; }
+  /// Run every replication with the detailed and the abstract link model
+  /// and report how far the abstract results are off
+  void RunPhyReport (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool PhyReport () const { return m_phyReport; }
+  /// Run once with OnOff sources and once with the traffic generator and
+  /// check that every flow sends at the same times; true if they do
+  bool RunTrafficCheck (int nSinks, int nSources, double txp, std::string CSVfileName);
+  bool TrafficCheck () const { return m_validateTraffic; }
+  void SetTraceLevel (TraceLevel level) { m_traceLevel = level; }
+  bool TraceLevelReport () const { return m_traceLevelReport; }
+  int GetNSinks () const { return m_nSinks; }
   static void SetMACParam (ns3::NetDeviceContainer & devices, int slotDistance);
   std::string CommandSetup (int argc, char **argv);
 
 
 private:
-  Ptr<Socket> SetupPacketReceive (Ipv4Address addr, Ptr<Node> node);
+  void InstallWaypointMobility (NodeContainer nodes, int64_t streamIndex);
+  Ptr<TrajectoryFile> LoadTrajectories (int64_t streamIndex);
+  RunResult GenerateTrajectories (std::string fileName, int64_t streamIndex);
+  void RecordWaypoint (Ptr<const MobilityModel> model);
+  RunResult RunWorker (int runIndex, int nSinks, int nSources, double txp, std::string CSVfileName);
+  /// Refuse routeSnapshots for a protocol whose tables cannot be read as they are
+  void CheckRouteSnapshots (uint32_t protocol) const;
+  /// Every option outside the swept parameters that changes a sweep's results or cost
+  std::string SweepConfig (int nSinks) const;
+
+  /// Network of the current run, built once and shared by its traffic variants
+  struct RunContext
+  {
+    int nSinks;
+    int nWifis;
+    double totalTime;
+    int runIndex;
+    int64_t streamIndex;
+    double setupStart;
+    NodeContainer sinkNodes;
+    NodeContainer adhocNodes;
+    NetDeviceContainer sinkDevices;
+    NetDeviceContainer adhocDevices;
+    Ipv4InterfaceContainer sinkApInterfaces;
+    Ipv4InterfaceContainer adhocInterfaces;
+    WifiPhyHelper *wifiPhy;
+    Ptr<GridSpectrumChannel> gridChannel;
+    Ptr<AbstractLinkChannel> abstractChannel;
+    Ptr<PropagationCache> propagationCache;
+  };
+  struct TrafficVariant
+  {
+    std::string rate;
+    int nSources;
+    uint32_t packetSize;
+  };
+  /// Install the sources, run from now to the end and collect the results;
+  /// \p label prefixes the output file names
+  RunResult RunTraffic (RunContext &ctx, int nSources, std::string rate, uint32_t packetSize, std::string label);
+
+  /// Fill m_flowSource and m_flowSink from m_trafficMatrix, or one flow per source
+  void BuildTrafficMatrix (int nSources, int nSinks, int nWifis);
+  Ptr<Socket> SetupPacketReceive (Ipv4Address addr, Ptr<Node> node, int sinkIndex);
   void ReceivePacket (Ptr<Socket> socket);
   void CheckThroughput ();
 
   uint32_t port;
-  uint32_t bytesTotal;
   uint32_t TotalDataRcd;
-
-  uint32_t packetsReceived;
   uint32_t TotalPacketsRcd;
 
+  TimeSeriesCollector m_timeSeries;
+  double m_sampleInterval;
+  uint32_t m_maxBufferedSamples;
+  /// sink index by node id (-1: no sink), and source and sink of each flow
+  std::vector<int> m_sinkIndex;
+  std::vector<int> m_flowSource;
+  std::vector<int> m_flowSink;
+  /// "source:sink,..." pairs, one flow each; empty: source i sends to sink i % nSinks
+  std::string m_trafficMatrix;
+
   std::string m_CSVfileName;
   int m_nSinks;
   int m_nSources;
   std::string m_protocolName;
   double m_txp;
   bool m_traceMobility;
+  TraceLevel m_traceLevel;
+  std::string m_channel;
+  double m_rxRange;
+  double m_lossCutoffDb;
+  bool m_validateChannel;
+  bool m_propagationCache;
+  double m_cacheTolerance;
+  /// compare a channel with the reference channel; relative error still counted as a match
+  bool m_phyReport;
+  std::string m_phyReference;
+  double m_phyTolerance;
   uint32_t m_protocol;
+  uint32_t m_nWorkers;
+  /// sequential stopping: relative 95% CI half-width to reach (0 = always nRuns)
+  double m_ciTarget;
+  int m_minRuns;
+  int m_nWifis;
+  double m_totalTime;
+  std::string m_rate;
+  int m_nodeSpeed;
+  std::string m_benchmarkFile;
+  std::string m_benchNodes;
+  std::string m_benchProtocols;
+  std::string m_benchSpeeds;
+  std::string m_benchRates;
+  std::string m_benchSchedulers;
+  /// regression: baseline file, whether to write it, and the relative growth
+  /// of wall time and peak RSS that still passes
+  std::string m_regressionFile;
+  bool m_recordBaseline;
+  double m_timeTolerance;
+  double m_rssTolerance;
+  /// event queue: map, heap, list, calendar or radix
+  std::string m_scheduler;
+  /// live progress: wall-clock seconds between reports (0 = off) and CSV file (empty = stderr)
+  double m_progress;
+  std::string m_progressFile;
+  ProgressMonitor m_progressMonitor;
+  /// lean-memory mode: no packet metadata even at traceLevel=debug, no IPv6 stack
+  bool m_leanMemory;
+  bool m_memoryReport;
+  MemoryReport m_memory;
+  /// streaming animation: file name (empty = off, AnimationInterface at traceLevel=full) and sampling
+  std::string m_animFile;
+  int m_animCompression;
+  double m_animPoll;
+  double m_animInterval;
+  double m_animDistance;
+  uint32_t m_animPacketSampling;
+  std::string m_animFlows;
+  AnimStream m_anim;
+  /// pcap and mobility traces written by a background thread
+  bool m_asyncTraces;
+  uint32_t m_traceBufferMb;
+  std::string m_traceOverflow;
+  uint32_t m_snapLength;
+  std::string m_traceNodes;
+  AsyncTraceWriter m_traceWriter;
+  std::string m_phyMode;
+  int m_nodePause;
+  double m_posMax;
+  std::string m_scenarioFile;
+  std::string m_sweepResults;
+  std::string m_trajectories;
+  double m_routeSnapshots;
+  /// drive all sources from one TrafficGenerator instead of an OnOffApplication each
+  bool m_aggregateTraffic;
+  std::string m_trafficPattern;
+  double m_trafficTick;
+  /// validateTraffic: compare the send times of the generator with OnOff's
+  bool m_validateTraffic;
+  /// validateTraffic: send times of each flow, time steps
+  std::vector<std::vector<int64_t> > m_txTimes;
+  void LogTx (uint32_t flow, Ptr<const Packet> packet);
+  /// fork-after-warm-up mode: warm-up time (0 = off) and the variant lists
+  double m_warmup;
+  std::string m_variantRates;
+  std::string m_variantSources;
+  std::string m_variantPacketSizes;
+  std::vector<TrafficVariant> m_variants;
+  std::vector<RunResult> m_variantResults;
+  double m_warmupSetupSeconds;
+  double m_warmupSeconds;
+  /// trajectory generation: node index of each mobility model and the recorded paths
+  std::map<const MobilityModel *, uint32_t> m_waypointNode;
+  std::vector<std::vector<TrajectoryWaypoint> > m_waypoints;
+  bool m_traceLevelReport;
     
-    uint32_t RunTxPackets;
-    uint32_t RunTxBytes;
-    uint32_t RunRxPackets;
-    uint32_t RunRxBytes;
-    uint32_t RunDelay;
-    
-    uint32_t TotalTxPackets;
-    uint32_t TotalTxBytes;
-    uint32_t TotalRxPackets;
-    uint32_t TotalRxBytes;
-    uint32_t TotalDelay;
+  /// streaming per-flow statistics of the current run
+  FlowStatsEngine m_flowStats;
+  /// per-run results accumulated across replications
+  OnlineStats m_runTxPackets;
+  OnlineStats m_runTxBytes;
+  OnlineStats m_runRxPackets;
+  OnlineStats m_runRxBytes;
+  OnlineStats m_runDelay;
+  OnlineStats m_runThroughput;
+  OnlineStats m_runDeliveryRatio;
+  OnlineStats m_runControlBytes;
+  OnlineStats m_runRoutingLoad;
+  /// delays and jitter of every packet of every replication
+  LatencyHistogram m_runLatency;
+  OnlineStats m_runJitter;
+  /// routing control traffic of the current run
+  RoutingOverheadMonitor m_overhead;
 
 };
 
 RoutingExperiment::RoutingExperiment ()
   : port (9),
-    bytesTotal (0),
-    packetsReceived (0),
+    TotalDataRcd (0),
+    TotalPacketsRcd (0),
+    m_sampleInterval (1.0),
+    m_maxBufferedSamples (100000),
     m_CSVfileName ("Adhoc-routing.output.csv"),
+    m_nSinks (1),
     m_traceMobility (false),
+    m_traceLevel (TRACE_METRICS),
+    m_channel ("yans"),
+    m_rxRange (250.0),
+    m_lossCutoffDb (1.0e9),
+    m_validateChannel (false),
+    m_propagationCache (false),
+    m_cacheTolerance (0),
+    m_phyReport (false),
+    m_phyReference ("yans"),
+    m_phyTolerance (0.1),
     m_protocol (2), // 1=OLSR;2=AODV;3=DSDV;4=DSR
-    RunTxPackets(0),
-    RunTxBytes(0),
-    RunRxPackets(0),
-    RunRxBytes(0),
-    RunDelay(0),
-    TotalTxPackets(0),
-    TotalTxBytes(0),
-    TotalRxPackets(0),
-    TotalRxBytes(0),
-    TotalDelay(0)
+    m_nWorkers (1),
+    m_ciTarget (0),
+    m_minRuns (3),
+    m_nWifis (75),
+    m_totalTime (150.0),
+    m_rate ("160kbps"),
+    m_nodeSpeed (12),
+    m_benchNodes ("25,50,100,250,500,1000,2000"),
+    m_benchProtocols ("1,2,3,4"),
+    m_benchSpeeds ("12"),
+    m_benchRates ("160kbps"),
+    m_benchSchedulers ("map"),
+    m_recordBaseline (false),
+    m_timeTolerance (0.25),
+    m_rssTolerance (0.10),
+    m_scheduler ("map"),
+    m_progress (0),
+    m_leanMemory (false),
+    m_memoryReport (false),
+    m_animCompression (1),
+    m_animPoll (1.0),
+    m_animInterval (0),
+    m_animDistance (1.0),
+    m_animPacketSampling (1),
+    m_asyncTraces (false),
+    m_traceBufferMb (64),
+    m_traceOverflow ("block"),
+    m_snapLength (65535),
+    m_phyMode ("DsssRate11Mbps"),
+    m_nodePause (2), // the RandomWaypointMobilityModel default
+    m_posMax (100.0),
+    m_sweepResults ("sweep-results.csv"),
+    m_routeSnapshots (0),
+    m_aggregateTraffic (false),
+    m_trafficPattern ("cbr"),
+    m_trafficTick (0),
+    m_validateTraffic (false),
+    m_warmup (0),
+    m_variantPacketSizes ("72"),
+    m_warmupSetupSeconds (0),
+    m_warmupSeconds (0),
+    m_traceLevelReport (false)
 {
 }
 
@@ -122,12 +539,13 @@ RoutingExperiment::ReceivePacket (Ptr<Socket> socket)
 {
   Ptr<Packet> packet;
   Address senderAddress;
+  int sinkIndex = m_sinkIndex[socket->GetNode ()->GetId ()];
   while ((packet = socket->RecvFrom (senderAddress)))
     {
-      bytesTotal += packet->GetSize ();
+      // the flow comes with the packet's tag, so both lookups are array reads
+      int flow = m_flowStats.Rx (packet);
+      m_timeSeries.Record (sinkIndex, flow >= 0 ? m_flowSource[flow] : -1, packet->GetSize ());
       TotalDataRcd += packet->GetSize ();
-
-      packetsReceived += 1;
       TotalPacketsRcd += 1;
         
 // Uncomment the following section to turn on packet notification
@@ -139,33 +557,74 @@ RoutingExperiment::ReceivePacket (Ptr<Socket> socket)
 void
 RoutingExperiment::CheckThroughput ()
 {
-  double kbs = (bytesTotal * 8.0) / 1000;
-  bytesTotal = 0;
-    std::stringstream ss4;
-    ss4 << nRuns;
-    std::string sRate = ss4.str ();  std::ofstream out (sRate+m_CSVfileName.c_str (), std::ios::app);
-  out << (Simulator::Now ()).GetSeconds () << ","
-      << kbs << ","
-      << packetsReceived << ","
-      << m_nSinks << ","
-      << m_nSources << ","
-      << m_protocolName << ","
-      << m_txp << ""
-      << std::endl;
+  m_timeSeries.Sample (Simulator::Now ().GetSeconds ());
+  Simulator::Schedule (Seconds (m_sampleInterval), &RoutingExperiment::CheckThroughput, this);
+}
 
-  out.close ();
-  packetsReceived = 0;
-  Simulator::Schedule (Seconds (1.0), &RoutingExperiment::CheckThroughput, this);
+void
+RoutingExperiment::BuildTrafficMatrix (int nSources, int nSinks, int nWifis)
+{
+  m_flowSource.clear ();
+  m_flowSink.clear ();
+  if (m_trafficMatrix.empty ())
+    {
+      for (int i = 0; i < nSources; i++)
+        {
+          m_flowSource.push_back (i);
+          m_flowSink.push_back (i % nSinks);
+        }
+      return;
+    }
+  std::stringstream ss (m_trafficMatrix);
+  std::string pair;
+  while (std::getline (ss, pair, ','))
+    {
+      size_t colon = pair.find (':');
+      int source = -1;
+      int sink = -1;
+      std::size_t usedSource = 0;
+      std::size_t usedSink = 0;
+      try
+        {
+          source = std::stoi (pair.substr (0, colon), &usedSource);
+          sink = std::stoi (pair.substr (colon + 1), &usedSink);
+        }
+      catch (const std::exception &)
+        {
+          usedSource = usedSink = 0;
+        }
+      if (colon == std::string::npos || usedSource == 0 || usedSource != colon
+          || usedSink != pair.size () - colon - 1)
+        {
+          NS_FATAL_ERROR ("Traffic matrix entry \"" << pair << "\" is not source:sink");
+        }
+      if (source < 0 || source >= nWifis || sink < 0 || sink >= nSinks)
+        {
+          NS_FATAL_ERROR ("Traffic matrix entry \"" << pair << "\" needs sources below " << nWifis
+                          << " and sinks below " << nSinks);
+        }
+      m_flowSource.push_back (source);
+      m_flowSink.push_back (sink);
+    }
+  if (m_flowSource.empty ())
+    {
+      NS_FATAL_ERROR ("Empty traffic matrix");
+    }
 }
 
 Ptr<Socket>
-RoutingExperiment::SetupPacketReceive (Ipv4Address addr, Ptr<Node> node)
+RoutingExperiment::SetupPacketReceive (Ipv4Address addr, Ptr<Node> node, int sinkIndex)
 {
   TypeId tid = TypeId::LookupByName ("ns3::UdpSocketFactory");
   Ptr<Socket> sink = Socket::CreateSocket (node, tid);
   InetSocketAddress local = InetSocketAddress (addr, port);
   sink->Bind (local);
   sink->SetRecvCallback (MakeCallback (&RoutingExperiment::ReceivePacket, this));
+  if (m_sinkIndex.size () <= node->GetId ())
+    {
+      m_sinkIndex.resize (node->GetId () + 1, -1);
+    }
+  m_sinkIndex[node->GetId ()] = sinkIndex;
 
   return sink;
 }
@@ -175,83 +634,1433 @@ RoutingExperiment::CommandSetup (int argc, char **argv)
 {
   CommandLine cmd;
   cmd.AddValue ("CSVfileName", "The name of the CSV output file name", m_CSVfileName);
+  cmd.AddValue ("sampleInterval", "Receive-rate sampling interval, s", m_sampleInterval);
+  cmd.AddValue ("maxBufferedSamples", "Samples kept in memory before the CSV file is flushed", m_maxBufferedSamples);
   cmd.AddValue ("traceMobility", "Enable mobility tracing", m_traceMobility);
   cmd.AddValue ("protocol", "1=OLSR;2=AODV;3=DSDV;4=DSR", m_protocol);
+  std::string traceLevel = TraceLevelName (m_traceLevel);
+  cmd.AddValue ("traceLevel", "Trace output: none|metrics|debug|full", traceLevel);
+  cmd.AddValue ("traceLevelReport", "Run once per trace level and report the wall-clock and RSS saved", m_traceLevelReport);
+  cmd.AddValue ("channel", "Wireless channel: yans (YansWifiPhy, every PHY gets every frame), spectrum (SpectrumWifiPhy, every PHY gets every frame), grid (SpectrumWifiPhy, spatially indexed) or abstract (lookup-table links, no Wi-Fi PHY)", m_channel);
+  cmd.AddValue ("rxRange", "grid channel: receivers beyond this distance (m) are skipped, so their signal is neither received nor counted as interference", m_rxRange);
+  cmd.AddValue ("lossCutoffDb", "grid channel: receivers with a path loss above this (dB) are skipped, so their signal is neither received nor counted as interference", m_lossCutoffDb);
+  cmd.AddValue ("validateChannel", "grid channel: check every lookup against a full scan of all receivers", m_validateChannel);
+  cmd.AddValue ("propagationCache", "yans and grid channels: cache path loss and delay per node pair between course changes", m_propagationCache);
+  cmd.AddValue ("cacheTolerance", "propagationCache: drop a pair's entry once the nodes may have moved this far, m; non-zero changes the results", m_cacheTolerance);
+  cmd.AddValue ("phyReport", "Run each replication on --channel (abstract if that is the reference) and on the reference channel and compare the results", m_phyReport);
+  cmd.AddValue ("phyReference", "phyReport: channel to compare with: yans, or spectrum to keep the PHY of the grid channel", m_phyReference);
+  cmd.AddValue ("phyTolerance", "phyReport: relative error up to which the abstract model counts as accurate", m_phyTolerance);
+  cmd.AddValue ("nWifis", "Number of mobile nodes", m_nWifis);
+  cmd.AddValue ("totalTime", "Simulation time, s", m_totalTime);
+  cmd.AddValue ("rate", "Data rate of each source", m_rate);
+  cmd.AddValue ("nodeSpeed", "Maximum node speed, m/s", m_nodeSpeed);
+  cmd.AddValue ("phyMode", "Wifi data and control mode", m_phyMode);
+  cmd.AddValue ("nodePause", "Waypoint pause time, s", m_nodePause);
+  cmd.AddValue ("posMax", "Side of the square the nodes move in, m", m_posMax);
+  cmd.AddValue ("trajectories", "Replay node motion from <prefix>-<seed>-<streamIndex>.traj, generating it if missing", m_trajectories);
+  cmd.AddValue ("routeSnapshots", "Snapshot all routing tables every this many s, 0 disables (deltas go to <trace name>.routes; OLSR, and AODV and DSDV with ns-3-routing-table-access.sh, not DSR)", m_routeSnapshots);
+  cmd.AddValue ("aggregateTraffic", "Send all flows from one generator with a single pending timer instead of an OnOffApplication per source", m_aggregateTraffic);
+  cmd.AddValue ("trafficPattern", "aggregateTraffic: cbr, poisson or onoff", m_trafficPattern);
+  cmd.AddValue ("trafficTick", "aggregateTraffic: round send times up to multiples of this, s, so flows share timer events (0=exact)", m_trafficTick);
+  cmd.AddValue ("validateTraffic", "Run with OnOff sources and with aggregateTraffic and check that every flow sends at the same times", m_validateTraffic);
+  cmd.AddValue ("warmup", "Run without traffic up to this time (s), then fork one process per traffic variant (0=off)", m_warmup);
+  cmd.AddValue ("variantRates", "warmup: comma-separated source data rates (default: rate)", m_variantRates);
+  cmd.AddValue ("variantSources", "warmup: comma-separated numbers of sources (default: 5)", m_variantSources);
+  cmd.AddValue ("variantPacketSizes", "warmup: comma-separated packet sizes, bytes", m_variantPacketSizes);
+  cmd.AddValue ("scenario", "Run the parameter sweep described in this scenario file", m_scenarioFile);
+  cmd.AddValue ("sweepResults", "scenario: results store, also used to resume an interrupted sweep", m_sweepResults);
+  cmd.AddValue ("benchmark", "Run the scaling benchmark and write its CSV report to this file", m_benchmarkFile);
+  cmd.AddValue ("benchNodes", "benchmark: comma-separated node counts", m_benchNodes);
+  cmd.AddValue ("benchProtocols", "benchmark: comma-separated protocols (1=OLSR;2=AODV;3=DSDV;4=DSR)", m_benchProtocols);
+  cmd.AddValue ("benchSpeeds", "benchmark: comma-separated maximum node speeds, m/s", m_benchSpeeds);
+  cmd.AddValue ("benchRates", "benchmark: comma-separated source data rates", m_benchRates);
+  cmd.AddValue ("benchSchedulers", "benchmark: comma-separated event schedulers", m_benchSchedulers);
+  cmd.AddValue ("regression", "Run the regression scenarios and compare them with this baseline file", m_regressionFile);
+  cmd.AddValue ("recordBaseline", "regression: write the baseline file instead of checking against it", m_recordBaseline);
+  cmd.AddValue ("timeTolerance", "regression: relative growth of the wall-clock time that still passes", m_timeTolerance);
+  cmd.AddValue ("rssTolerance", "regression: relative growth of the peak RSS that still passes", m_rssTolerance);
+  cmd.AddValue ("scheduler", "Event scheduler: map, heap, list, calendar or radix", m_scheduler);
+  cmd.AddValue ("progress", "Report simulated time, event rate, queue size, RSS and events per module every this many wall-clock s (0=off)", m_progress);
+  cmd.AddValue ("leanMemory", "Save memory per node: no packet metadata (even at traceLevel=debug) and no IPv6 stack", m_leanMemory);
+  cmd.AddValue ("memoryReport", "Print the memory taken by nodes, devices, routing, applications, trace sinks and the run", m_memoryReport);
+  cmd.AddValue ("anim", "Stream a NetAnim animation to <runIndex><anim>, replacing adhoc_routing.xml at traceLevel=full", m_animFile);
+  cmd.AddValue ("animCompression", "anim: gzip level, 0 writes plain XML", m_animCompression);
+  cmd.AddValue ("animPoll", "anim: also sample all positions every this many s (0=course changes only)", m_animPoll);
+  cmd.AddValue ("animInterval", "anim: write a node again only after this many s", m_animInterval);
+  cmd.AddValue ("animDistance", "anim: ... and only once it moved this many m", m_animDistance);
+  cmd.AddValue ("animPacketSampling", "anim: keep one packet in this many", m_animPacketSampling);
+  cmd.AddValue ("animFlows", "anim: comma-separated source indices; only their packets are kept", m_animFlows);
+  cmd.AddValue ("asyncTraces", "Write pcap and mobility traces from a background thread", m_asyncTraces);
+  cmd.AddValue ("traceBuffer", "asyncTraces: buffer between the simulation and the writer thread, MB", m_traceBufferMb);
+  cmd.AddValue ("traceOverflow", "asyncTraces: when the buffer is full, block the simulation or drop the record", m_traceOverflow);
+  cmd.AddValue ("snapLength", "asyncTraces: bytes of each frame kept in the pcap files", m_snapLength);
+  cmd.AddValue ("traceNodes", "asyncTraces: comma-separated ids of the nodes to trace (default: sinks for pcap, all for mobility)", m_traceNodes);
+  cmd.AddValue ("progressFile", "progress: write the reports as CSV to <runIndex><progressFile> instead of stderr", m_progressFile);
+  cmd.AddValue ("nSinks", "Number of sink nodes", m_nSinks);
+  cmd.AddValue ("trafficMatrix", "Comma-separated source:sink pairs, one flow each (default: source i sends to sink i % nSinks)", m_trafficMatrix);
+  cmd.AddValue ("nRuns", "Number of replications (the maximum with ciTarget)", nRuns);
+  cmd.AddValue ("ciTarget", "Stop replicating once throughput, delivery ratio and delay have a 95% CI half-width below this fraction of their mean (0=run all nRuns)", m_ciTarget);
+  cmd.AddValue ("minRuns", "ciTarget: replications before convergence is checked", m_minRuns);
+  cmd.AddValue ("nWorkers", "Replications run in parallel, one process each (0=one per core)", m_nWorkers);
   cmd.Parse (argc, argv);
+  m_traceLevel = ParseTraceLevel (traceLevel);
+  if (!(m_sampleInterval > 0))
+    {
+      // CheckThroughput would reschedule itself at +0 forever
+      NS_FATAL_ERROR ("sampleInterval must be positive, got " << m_sampleInterval);
+    }
+  if (m_scenarioFile.empty () && m_benchmarkFile.empty () && m_regressionFile.empty ())
+    {
+      // the sweeps check the protocols they run
+      CheckRouteSnapshots (m_protocol);
+    }
+  if (m_nWorkers == 0)
+    {
+      long cores = sysconf (_SC_NPROCESSORS_ONLN);
+      m_nWorkers = cores > 0 ? cores : 1;
+    }
   return m_CSVfileName;
 }
 
+void
+RoutingExperiment::CheckRouteSnapshots (uint32_t protocol) const
+{
+  static const char *names[] = { "", "OLSR", "AODV", "DSDV", "DSR" };
+  if (m_routeSnapshots > 0 && protocol >= 1 && protocol <= 4
+      && !RouteSnapshotter::CanSnapshot (names[protocol]))
+    {
+      NS_FATAL_ERROR ("routeSnapshots cannot read the " << names[protocol] << " routing tables without changing them"
+                      << (protocol == 4 ? "" : "; add the accessors of ns-3-routing-table-access.sh to ns-3"));
+    }
+}
+
+// Each replication gets its own block of RNG streams so that a run produces
+// the same numbers whether it is executed serially or in a worker process.
+// The block must hold every stream the mobility takes: 2 for the position
+// allocator and 4 per random waypoint model (speed, pause and its own 2
+// position streams), else replication r + 1 replays part of r's motion.
+// At least 50, the fixed size used before, so small networks keep their
+// streams.
+static int64_t
+StreamsPerRun (int nWifis)
+{
+  return std::max<int64_t> (50, 2 + 4 * static_cast<int64_t> (nWifis));
+}
+// The other random models of a run draw from a separate range:
+// modelStreams + streamIndex + 0 abstract channel, + 1..3 traffic
+// generator, + 4 source start times
+static const int64_t modelStreams = 1000000000;
+
+RunResult
+RoutingExperiment::RunWorker (int runIndex, int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  return Run (nSinks, nSources, txp, CSVfileName, runIndex * StreamsPerRun (m_nWifis), runIndex);
+}
+
+/**
+ * Run job (i) for every i in [0, nJobs) in a forked child, at most nWorkers
+ * at a time, and hand each RunResult to done (i, result) as children finish.
+ *
+ * The ns-3 Simulator is a singleton, so this is how several simulations run
+ * side by side.  It is also used with a single worker: random variables that
+ * are not given an explicit stream draw from a process-wide stream counter,
+ * so a run only gives the same numbers serially and in parallel if each one
+ * starts from the same untouched parent process.
+ *
+ * Once \p stop returns true no further jobs are started; the ones already
+ * running still finish and are passed to \p done.
+ */
+static void
+ForkPool (int nJobs, uint32_t nWorkers, std::function<RunResult (int)> job,
+          std::function<void (int, const RunResult &)> done,
+          std::function<bool ()> stop = std::function<bool ()> ())
+{
+  std::map<pid_t, std::pair<int, int> > workers; // pid -> (job index, read fd)
+  int nextJob = 0;
+  while ((nextJob < nJobs && !(stop && stop ())) || !workers.empty ())
+    {
+      while (nextJob < nJobs && !(stop && stop ()) && workers.size () < std::max<uint32_t> (nWorkers, 1))
+        {
+          int fds[2];
+          if (pipe (fds) != 0)
+            {
+              NS_FATAL_ERROR ("pipe() failed: " << strerror (errno));
+            }
+          std::cout.flush ();
+          pid_t pid = fork ();
+          if (pid < 0)
+            {
+              NS_FATAL_ERROR ("fork() failed: " << strerror (errno));
+            }
+          if (pid == 0)
+            {
+              close (fds[0]);
+              RunResult result = job (nextJob);
+              const char *buf = reinterpret_cast<const char *> (&result);
+              size_t left = sizeof (result);
+              while (left > 0)
+                {
+                  ssize_t n = write (fds[1], buf, left);
+                  if (n < 0 && errno == EINTR)
+                    {
+                      continue;
+                    }
+                  if (n <= 0)
+                    {
+                      _exit (1);
+                    }
+                  buf += n;
+                  left -= n;
+                }
+              close (fds[1]);
+              std::cout.flush ();
+              _exit (0);
+            }
+          close (fds[1]);
+          workers[pid] = std::make_pair (nextJob, fds[0]);
+          nextJob++;
+        }
+
+      int status;
+      pid_t pid = waitpid (-1, &status, 0);
+      if (pid < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          NS_FATAL_ERROR ("waitpid() failed: " << strerror (errno));
+        }
+      std::map<pid_t, std::pair<int, int> >::iterator w = workers.find (pid);
+      if (w == workers.end ())
+        {
+          continue;
+        }
+      int jobIndex = w->second.first;
+      int fd = w->second.second;
+      workers.erase (w);
+
+      RunResult result;
+      char *buf = reinterpret_cast<char *> (&result);
+      size_t got = 0;
+      while (got < sizeof (result))
+        {
+          ssize_t n = read (fd, buf + got, sizeof (result) - got);
+          if (n < 0 && errno == EINTR)
+            {
+              continue;
+            }
+          if (n <= 0)
+            {
+              break;
+            }
+          got += n;
+        }
+      close (fd);
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0 || got != sizeof (result))
+        {
+          NS_FATAL_ERROR ("Job " << jobIndex << " failed in worker " << pid);
+        }
+      done (jobIndex, result);
+    }
+}
+
+void
+RoutingExperiment::RunReplications (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  if (nRuns <= 1)
+    {
+      ReportRun (RunWorker (0, nSinks, nSources, txp, CSVfileName));
+      ReportOverall ();
+      return;
+    }
+
+  std::vector<RunResult> results (nRuns);
+  std::vector<bool> finished (nRuns, false);
+  int nextReport = 0;
+  // Convergence is only checked on the runs reported so far, which are
+  // always runs 0 .. nextReport-1, so the stopping point does not depend on
+  // the number of workers.  Runs still in flight when it is reached are
+  // discarded.
+  int stopAfter = nRuns;
+  bool converged = false;
+  ForkPool (nRuns, m_nWorkers,
+            [&] (int runIndex)
+              {
+                return RunWorker (runIndex, nSinks, nSources, txp, CSVfileName);
+              },
+            [&] (int runIndex, const RunResult &result)
+              {
+                results[runIndex] = result;
+                finished[runIndex] = true;
+                // Report in run order so the output matches a serial sweep
+                while (nextReport < stopAfter && finished[nextReport])
+                  {
+                    ReportRun (results[nextReport++]);
+                    if (m_ciTarget > 0 && !converged && nextReport >= std::max (m_minRuns, 2) && Converged ())
+                      {
+                        converged = true;
+                        stopAfter = nextReport;
+                      }
+                  }
+              },
+            [&] ()
+              {
+                return stopAfter < nRuns;
+              });
+  if (m_ciTarget > 0)
+    {
+      std::cout << "\n  " << (converged ? "Converged" : "Not converged") << " after " << nextReport
+                << " runs (95% CI half-width target " << m_ciTarget * 100 << "% of the mean)\n";
+    }
+  ReportOverall ();
+}
+
+/// Half-width of the 95% CI relative to the mean; 0 if both are 0
+static double
+RelativeHalfWidth (const OnlineStats &stats)
+{
+  double halfWidth = stats.GetConfidenceHalfWidth ();
+  if (stats.GetMean () == 0)
+    {
+      return halfWidth == 0 ? 0 : std::numeric_limits<double>::infinity ();
+    }
+  return halfWidth / std::fabs (stats.GetMean ());
+}
+
+bool
+RoutingExperiment::Converged () const
+{
+  return RelativeHalfWidth (m_runThroughput) < m_ciTarget
+         && RelativeHalfWidth (m_runDeliveryRatio) < m_ciTarget
+         && RelativeHalfWidth (m_runDelay) < m_ciTarget;
+}
+
+static std::vector<std::string>
+SplitList (const std::string &list)
+{
+  std::vector<std::string> items;
+  std::stringstream ss (list);
+  std::string item;
+  while (std::getline (ss, item, ','))
+    {
+      if (!item.empty ())
+        {
+          items.push_back (item);
+        }
+    }
+  return items;
+}
+
+/// \p item of the list option \p option as an integer in [\p min, \p max]
+static long
+ParseListInteger (const std::string &option, const std::string &item, long min, long max)
+{
+  long value = 0;
+  std::size_t used = 0;
+  try
+    {
+      value = std::stol (item, &used);
+    }
+  catch (const std::exception &)
+    {
+      used = 0;
+    }
+  if (used == 0 || used != item.size ())
+    {
+      NS_FATAL_ERROR (option << " entry \"" << item << "\" is not an integer");
+    }
+  if (value < min || value > max)
+    {
+      NS_FATAL_ERROR (option << " entry " << value << " is outside " << min << ".." << max);
+    }
+  return value;
+}
+
+void
+RoutingExperiment::RunBenchmark (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  struct BenchmarkPoint
+  {
+    int nodes;
+    uint32_t protocol;
+    int speed;
+    std::string rate;
+    std::string scheduler;
+  };
+  std::vector<BenchmarkPoint> points;
+  std::vector<std::string> nodes = SplitList (m_benchNodes);
+  std::vector<std::string> protocols = SplitList (m_benchProtocols);
+  std::vector<std::string> speeds = SplitList (m_benchSpeeds);
+  std::vector<std::string> rates = SplitList (m_benchRates);
+  std::vector<std::string> schedulers = SplitList (m_benchSchedulers);
+  // reject bad entries before any run is forked
+  std::vector<int> nodeCounts;
+  std::vector<uint32_t> protocolIds;
+  std::vector<int> maxSpeeds;
+  for (size_t n = 0; n < nodes.size (); n++)
+    {
+      nodeCounts.push_back (ParseListInteger ("benchNodes", nodes[n], 1, std::numeric_limits<int>::max ()));
+    }
+  for (size_t p = 0; p < protocols.size (); p++)
+    {
+      protocolIds.push_back (ParseListInteger ("benchProtocols", protocols[p], 1, 4));
+      CheckRouteSnapshots (protocolIds.back ());
+    }
+  for (size_t v = 0; v < speeds.size (); v++)
+    {
+      maxSpeeds.push_back (ParseListInteger ("benchSpeeds", speeds[v], 1, std::numeric_limits<int>::max ()));
+    }
+  for (size_t q = 0; q < schedulers.size (); q++)
+    {
+      SchedulerTypeName (schedulers[q]);
+    }
+  for (size_t n = 0; n < nodes.size (); n++)
+    {
+      for (size_t p = 0; p < protocols.size (); p++)
+        {
+          for (size_t v = 0; v < speeds.size (); v++)
+            {
+              for (size_t r = 0; r < rates.size (); r++)
+                {
+                  for (size_t q = 0; q < schedulers.size (); q++)
+                    {
+                      BenchmarkPoint point;
+                      point.nodes = nodeCounts[n];
+                      point.protocol = protocolIds[p];
+                      point.speed = maxSpeeds[v];
+                      point.rate = rates[r];
+                      point.scheduler = schedulers[q];
+                      points.push_back (point);
+                    }
+                }
+            }
+        }
+    }
+
+  // Each point runs in its own process, so the peak RSS it reports is its
+  // own.  Keep nWorkers at 1 for clean wall-clock numbers.
+  std::vector<RunResult> results (points.size ());
+  ForkPool (points.size (), m_nWorkers,
+            [&] (int i)
+              {
+                m_nWifis = points[i].nodes;
+                m_protocol = points[i].protocol;
+                m_nodeSpeed = points[i].speed;
+                m_rate = points[i].rate;
+                m_scheduler = points[i].scheduler;
+                return Run (nSinks, std::min (nSources, m_nWifis), txp, CSVfileName, 0, i);
+              },
+            [&] (int i, const RunResult &result)
+              {
+                results[i] = result;
+                std::cout << "benchmark point " << i + 1 << "/" << points.size () << ": "
+                          << points[i].nodes << " nodes, protocol " << points[i].protocol
+                          << ", " << points[i].speed << " m/s, " << points[i].rate
+                          << ", " << points[i].scheduler << " scheduler: " << result.setupSeconds + result.runSeconds << " s, "
+                          << result.peakRssKb << " kB\n";
+              });
+
+  // Points differing only in the scheduler run the same workload, so the
+  // difference to the leanest of them is what the event queue costs extra
+  std::vector<long> leanestRssKb (points.size ());
+  for (size_t i = 0; i < points.size (); i += schedulers.size ())
+    {
+      long leanest = results[i].peakRssKb;
+      for (size_t q = 1; q < schedulers.size (); q++)
+        {
+          leanest = std::min (leanest, results[i + q].peakRssKb);
+        }
+      std::fill (leanestRssKb.begin () + i, leanestRssKb.begin () + i + schedulers.size (), leanest);
+    }
+
+  std::ofstream out (m_benchmarkFile.c_str ());
+  out << "Nodes,Protocol,NodeSpeed,Rate,Scheduler,SimulatedSeconds,SetupSeconds,RunSeconds,WallSeconds,"
+      << "Events,EventsPerSecond,PeakRssKb,QueueExtraRssKb,TxPackets,RxPackets\n";
+  for (size_t i = 0; i < points.size (); i++)
+    {
+      const RunResult &r = results[i];
+      double wall = r.setupSeconds + r.runSeconds;
+      out << points[i].nodes << "," << points[i].protocol << "," << points[i].speed << ","
+          << points[i].rate << "," << points[i].scheduler << "," << m_totalTime << ","
+          << r.setupSeconds << "," << r.runSeconds << ","
+          << wall << "," << r.events << "," << (r.runSeconds > 0 ? r.events / r.runSeconds : 0) << ","
+          << r.peakRssKb << "," << r.peakRssKb - leanestRssKb[i] << "," << r.txPackets << "," << r.rxPackets << "\n";
+    }
+  out.close ();
+  std::cout << "Benchmark report written to " << m_benchmarkFile << "\n";
+}
+
+bool
+RoutingExperiment::RunRegression (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  // Only the network size, protocol, speed and duration are fixed; every
+  // other option applies as given, so e.g. --channel=grid, --scheduler=radix
+  // or --traceLevel=none checked against a baseline recorded without it
+  // shows whether that option changes the results
+  struct Scenario
+  {
+    const char *name;
+    int nodes;
+    uint32_t protocol;
+    int speed;
+    double totalTime;
+  };
+  static const Scenario scenarios[] = {
+    { "olsr-25", 25, 1, 12, 60 },
+    { "aodv-25", 25, 2, 12, 60 },
+    { "dsdv-25", 25, 3, 12, 60 },
+    { "dsr-25", 25, 4, 12, 60 },
+    { "aodv-100-slow", 100, 2, 2, 60 },
+    { "aodv-100-fast", 100, 2, 20, 60 },
+  };
+  int nScenarios = sizeof (scenarios) / sizeof (scenarios[0]);
+  for (int i = 0; i < nScenarios; i++)
+    {
+      CheckRouteSnapshots (scenarios[i].protocol);
+    }
+  RegressionBaseline baseline;
+  baseline.Open (m_regressionFile, m_recordBaseline, m_timeTolerance, m_rssTolerance);
+
+  // one scenario at a time, so wall-clock times are not skewed by each other
+  ForkPool (nScenarios, 1,
+            [&] (int i)
+              {
+                m_nWifis = scenarios[i].nodes;
+                m_protocol = scenarios[i].protocol;
+                m_nodeSpeed = scenarios[i].speed;
+                m_totalTime = scenarios[i].totalTime;
+                return Run (nSinks, std::min (nSources, m_nWifis), txp, CSVfileName, 0, i);
+              },
+            [&] (int i, const RunResult &result)
+              {
+                RegressionSample sample;
+                sample.Add ("txPackets", result.txPackets);
+                sample.Add ("txBytes", result.txBytes);
+                sample.Add ("rxPackets", result.rxPackets);
+                sample.Add ("rxBytes", result.rxBytes);
+                sample.Add ("throughputKbps", result.throughputKbps);
+                sample.Add ("deliveryRatio", result.deliveryRatio);
+                sample.Add ("delay", result.delay);
+                sample.Add ("delayP50", result.latency.GetPercentile (0.5));
+                sample.Add ("delayP99", result.latency.GetPercentile (0.99));
+                sample.Add ("jitter", result.jitter.GetMean ());
+                sample.Add ("controlPackets", result.controlPackets);
+                sample.Add ("controlBytes", result.controlBytes);
+                sample.Add ("controlAirtime", result.controlAirtime);
+                sample.Add ("events", result.events);
+                sample.wallSeconds = result.setupSeconds + result.runSeconds;
+                sample.peakRssKb = result.peakRssKb;
+                std::cout << "regression scenario " << i + 1 << "/" << nScenarios << ": " << scenarios[i].name
+                          << ", " << sample.wallSeconds << " s, " << result.peakRssKb << " kB\n";
+                baseline.Check (scenarios[i].name, sample);
+              });
+  return baseline.Finish (std::cout);
+}
+
+void
+RoutingExperiment::RunVariants (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  // a bad list must fail here, not after the warm-up
+  m_variants.clear ();
+  std::vector<std::string> rates = SplitList (m_variantRates.empty () ? m_rate : m_variantRates);
+  std::vector<std::string> sources = SplitList (m_variantSources.empty () ? std::to_string (nSources) : m_variantSources);
+  std::vector<std::string> sizes = SplitList (m_variantPacketSizes);
+  std::vector<int> sourceCounts;
+  std::vector<uint32_t> packetSizes;
+  for (size_t n = 0; n < sources.size (); n++)
+    {
+      sourceCounts.push_back (std::min<long> (ParseListInteger ("variantSources", sources[n], 1, std::numeric_limits<int>::max ()),
+                                              m_nWifis));
+    }
+  for (size_t z = 0; z < sizes.size (); z++)
+    {
+      packetSizes.push_back (ParseListInteger ("variantPacketSizes", sizes[z], 1, 65507));
+    }
+  for (size_t r = 0; r < rates.size (); r++)
+    {
+      for (size_t n = 0; n < sourceCounts.size (); n++)
+        {
+          for (size_t z = 0; z < packetSizes.size (); z++)
+            {
+              TrafficVariant v;
+              v.rate = rates[r];
+              v.nSources = sourceCounts[n];
+              v.packetSize = packetSizes[z];
+              m_variants.push_back (v);
+            }
+        }
+    }
+
+  // the warm-up itself runs here; Run forks the variants off it
+  Run (nSinks, nSources, txp, CSVfileName, 0, 0);
+
+  std::cout << "\nVariant,Rate,Sources,PacketSize,ThroughputKbps,DeliveryRatio,DelayMs,P99Ms,RoutingLoad,SetupSeconds,RunSeconds\n";
+  double variantSeconds = 0;
+  for (size_t i = 0; i < m_variants.size (); i++)
+    {
+      const TrafficVariant &v = m_variants[i];
+      const RunResult &r = m_variantResults[i];
+      std::cout << i << "," << v.rate << "," << v.nSources << "," << v.packetSize << ","
+                << r.throughputKbps << "," << r.deliveryRatio << "," << r.delay * 1000 << ","
+                << r.latency.GetPercentile (0.99) * 1000 << "," << r.routingLoad << ","
+                << r.setupSeconds << "," << r.runSeconds << "\n";
+      variantSeconds += r.setupSeconds + r.runSeconds;
+    }
+  double shared = m_warmupSetupSeconds + m_warmupSeconds;
+  std::cout << "\nShared setup and warm-up: " << shared << " s, variants: " << variantSeconds << " s; "
+            << "building and warming up each variant separately would have cost another "
+            << shared * (m_variants.size () ? m_variants.size () - 1 : 0) << " s\n";
+}
+
+/// "p50 / p90 / p99 / p99.9" of a delay histogram, in ms
+static std::string
+Percentiles (const LatencyHistogram &latency)
+{
+  std::ostringstream oss;
+  oss << "p50 " << latency.GetPercentile (0.5) * 1000 << " / p90 " << latency.GetPercentile (0.9) * 1000
+      << " / p99 " << latency.GetPercentile (0.99) * 1000 << " / p99.9 " << latency.GetPercentile (0.999) * 1000 << " ms";
+  return oss.str ();
+}
+
+void
+RoutingExperiment::ReportRun (const RunResult &result)
+{
+    std::cout << "\n  Avg Tx Packets this run: " << result.txPackets << "\n";
+    std::cout << "  Avg Tx Bytes this run:   " << result.txBytes << "\n";
+    std::cout << "  Avg Rx Packets this run: " << result.rxPackets << "\n";
+    std::cout << "  Avg Rx Bytes this run:   " << result.rxBytes << "\n";
+    std::cout << "  Avg Delay this run:  " << result.delay * 1000 << " ms\n";
+    std::cout << "  Delay percentiles this run: " << Percentiles (result.latency) << "\n";
+    std::cout << "  Avg Jitter this run: " << result.jitter.GetMean () * 1000 << " ms\n";
+    std::cout << "  Avg Delivery Ratio this run: " << result.deliveryRatio << "\n";
+    std::cout << "  Avg Throughput this run: " << result.throughputKbps << " kbps\n";
+    std::cout << "  Control Packets this run: " << result.controlPackets << "\n";
+    std::cout << "  Control Bytes this run:   " << result.controlBytes << "\n";
+    std::cout << "  Control Airtime this run: " << result.controlAirtime << " s\n";
+    std::cout << "  Normalized Routing Load this run: " << result.routingLoad << "\n";
+
+    m_runTxPackets.Add (result.txPackets);
+    m_runTxBytes.Add (result.txBytes);
+    m_runRxPackets.Add (result.rxPackets);
+    m_runRxBytes.Add (result.rxBytes);
+    m_runDelay.Add (result.delay * 1000);
+    m_runThroughput.Add (result.throughputKbps);
+    m_runDeliveryRatio.Add (result.deliveryRatio);
+    m_runControlBytes.Add (result.controlBytes);
+    m_runLatency.Merge (result.latency);
+    m_runJitter.Merge (result.jitter);
+    m_runRoutingLoad.Add (result.routingLoad);
+}
+
+/// "mean +/- 95% CI half-width" across replications
+static std::string
+MeanCi (const OnlineStats &stats)
+{
+  std::ostringstream oss;
+  oss << stats.GetMean () << " +/- " << stats.GetConfidenceHalfWidth ();
+  return oss.str ();
+}
+
+void
+RoutingExperiment::ReportOverall ()
+{
+    std::cout << "\n\n  Overall over " << m_runThroughput.GetCount () << " runs (mean +/- 95% CI):\n";
+    std::cout << "  Avg Tx Packets overall: " << MeanCi (m_runTxPackets) << "\n";
+    std::cout << "  Avg Tx Bytes overall:   " << MeanCi (m_runTxBytes) << "\n";
+    std::cout << "  Avg Rx Packets overall: " << MeanCi (m_runRxPackets) << "\n";
+    std::cout << "  Avg Rx Bytes overall:   " << MeanCi (m_runRxBytes) << "\n";
+    std::cout << "  Avg Delay overall:  " << MeanCi (m_runDelay) << " ms\n";
+    std::cout << "  Delay percentiles overall (all packets): " << Percentiles (m_runLatency) << "\n";
+    std::cout << "  Avg Jitter overall (all packets): " << m_runJitter.GetMean () * 1000 << " ms\n";
+    std::cout << "  Avg Delivery Ratio overall: " << MeanCi (m_runDeliveryRatio) << "\n";
+    std::cout << "  Avg Throughput overall: " << MeanCi (m_runThroughput) << " kbps\n";
+    std::cout << "  Control Bytes overall:  " << MeanCi (m_runControlBytes) << "\n";
+    std::cout << "  Normalized Routing Load overall: " << MeanCi (m_runRoutingLoad) << "\n\n";
+}
+
+void
+RoutingExperiment::LogTx (uint32_t flow, Ptr<const Packet>)
+{
+  m_txTimes[flow].push_back (Simulator::Now ().GetTimeStep ());
+}
+
+static void
+LogOnOffTx (std::vector<int64_t> *times, Ptr<const Packet>)
+{
+  times->push_back (Simulator::Now ().GetTimeStep ());
+}
+
+/// Send times of run \p runIndex; \p label is the RunTraffic label
+static std::string
+TxTimesFileName (int runIndex, const std::string &label)
+{
+  return std::to_string (runIndex) + label + "traffic-times.txt";
+}
+
+/// One "<flow> <time step>" line per packet sent
+static void
+WriteTxTimes (const std::string &fileName, const std::vector<std::vector<int64_t> > &times)
+{
+  std::ofstream out (fileName.c_str ());
+  for (size_t f = 0; f < times.size (); f++)
+    {
+      for (size_t k = 0; k < times[f].size (); k++)
+        {
+          out << f << " " << times[f][k] << "\n";
+        }
+    }
+}
+
+static std::vector<std::vector<int64_t> >
+ReadTxTimes (const std::string &fileName)
+{
+  std::vector<std::vector<int64_t> > times;
+  std::ifstream in (fileName.c_str ());
+  size_t flow;
+  int64_t t;
+  while (in >> flow >> t)
+    {
+      if (flow >= times.size ())
+        {
+          times.resize (flow + 1);
+        }
+      times[flow].push_back (t);
+    }
+  return times;
+}
+
+bool
+RoutingExperiment::RunTrafficCheck (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  if (m_trafficPattern != "cbr")
+    {
+      NS_FATAL_ERROR ("validateTraffic compares cbr flows with OnOffApplication, not " << m_trafficPattern);
+    }
+  const char *modes[2] = { "onoff", "generator" };
+  ForkPool (2, m_nWorkers,
+            [&] (int i)
+              {
+                m_aggregateTraffic = i == 1;
+                m_warmup = 0;
+                return Run (nSinks, nSources, txp, std::string (modes[i]) + "-" + CSVfileName, 0, i);
+              },
+            [&] (int, const RunResult &) {});
+
+  // without warmup, Run sends its traffic with an empty RunTraffic label
+  std::vector<std::vector<int64_t> > onoff = ReadTxTimes (TxTimesFileName (0, ""));
+  std::vector<std::vector<int64_t> > generator = ReadTxTimes (TxTimesFileName (1, ""));
+  // OnOffApplication restarts every OnTime (1 s) and rounds the bits of
+  // the packet it was sending down to whole bits, which delays its next
+  // packet by less than a bit time; the generator sends exact CBR, so the
+  // streams may drift apart by one bit time per second.  A tick rounds the
+  // generator's times up by less than a tick.
+  double bitSeconds = 1.0 / DataRate (m_rate).GetBitRate ();
+  int64_t tick = Seconds (m_trafficTick).GetTimeStep ();
+  uint32_t failed = 0;
+  for (size_t f = 0; f < std::max (onoff.size (), generator.size ()); f++)
+    {
+      size_t nOnOff = f < onoff.size () ? onoff[f].size () : 0;
+      size_t nGenerator = f < generator.size () ? generator[f].size () : 0;
+      if (nOnOff != nGenerator)
+        {
+          std::cout << "Flow " << f << ": OnOff sent " << nOnOff << " packets, the generator " << nGenerator << "\n";
+          failed++;
+          continue;
+        }
+      int64_t worst = 0;
+      size_t worstPacket = 0;
+      bool ok = true;
+      for (size_t k = 0; k < nOnOff; k++)
+        {
+          int64_t elapsed = onoff[f][k] - onoff[f][0];
+          int64_t tolerance = Seconds ((TimeStep (elapsed).GetSeconds () + 1) * bitSeconds).GetTimeStep () + tick + 1;
+          int64_t deviation = std::abs (generator[f][k] - onoff[f][k]);
+          if (deviation > worst)
+            {
+              worst = deviation;
+              worstPacket = k;
+            }
+          if (deviation > tolerance)
+            {
+              ok = false;
+            }
+        }
+      if (!ok)
+        {
+          std::cout << "Flow " << f << ": packet " << worstPacket << " sent at " << TimeStep (generator[f][worstPacket]).GetSeconds ()
+                    << " s by the generator and at " << TimeStep (onoff[f][worstPacket]).GetSeconds () << " s by OnOff\n";
+          failed++;
+        }
+    }
+  std::cout << "Traffic check: " << std::max (onoff.size (), generator.size ()) << " flows, " << failed
+            << (failed ? " differ from OnOffApplication\n" : " differ; the generator sends as OnOffApplication\n");
+  return failed == 0;
+}
+
+/// Delivered packets, throughput, delivery ratio, mean and 99th percentile delay (ms) of \p r
+static void
+PhyReportMetrics (const RunResult &r, double values[5])
+{
+  values[0] = r.rxPackets;
+  values[1] = r.throughputKbps;
+  values[2] = r.deliveryRatio;
+  values[3] = r.delay * 1000;
+  values[4] = r.latency.GetPercentile (0.99) * 1000;
+}
+
+void
+RoutingExperiment::RunPhyReport (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  // the model under test is the channel asked for, the abstract links if
+  // that is the reference itself.  grid against yans also changes the PHY
+  // (SpectrumWifiPhy for YansWifiPhy); against spectrum only the indexing
+  // and the cutoffs differ
+  std::string models[2] = { m_phyReference, m_channel == m_phyReference ? "abstract" : m_channel };
+  // job 2r runs replication r on the reference channel and job 2r+1 on the
+  // tested one, with the same mobility and traffic
+  std::vector<RunResult> results (2 * nRuns);
+  ForkPool (2 * nRuns, m_nWorkers,
+            [&] (int i)
+              {
+                m_channel = models[i % 2];
+                return RunWorker (i / 2, nSinks, nSources, txp, models[i % 2] + "-" + CSVfileName);
+              },
+            [&] (int i, const RunResult &result)
+              {
+                results[i] = result;
+              });
+
+  const char *names[5] = { "RxPackets", "ThroughputKbps", "DeliveryRatio", "DelayMs", "P99DelayMs" };
+  OnlineStats values[2][5];
+  // error of the tested model relative to the reference, per replication
+  OnlineStats errors[5];
+  LatencyHistogram latency[2];
+  double wallSeconds[2] = { 0, 0 };
+  for (int r = 0; r < nRuns; r++)
+    {
+      double v[2][5];
+      for (int m = 0; m < 2; m++)
+        {
+          const RunResult &result = results[2 * r + m];
+          PhyReportMetrics (result, v[m]);
+          for (int k = 0; k < 5; k++)
+            {
+              values[m][k].Add (v[m][k]);
+            }
+          latency[m].Merge (result.latency);
+          wallSeconds[m] += result.setupSeconds + result.runSeconds;
+        }
+      for (int k = 0; k < 5; k++)
+        {
+          if (v[0][k] != 0)
+            {
+              errors[k].Add ((v[1][k] - v[0][k]) / v[0][k]);
+            }
+        }
+    }
+
+  std::cout << "\n" << models[1] << " against " << models[0] << " over " << nRuns << " runs (mean +/- 95% CI)\n";
+  std::cout << "Metric," << models[0] << "," << models[1] << ",RelativeError,Accurate\n";
+  bool accurate = true;
+  for (int k = 0; k < 5; k++)
+    {
+      bool ok = errors[k].GetCount () > 0 && std::fabs (errors[k].GetMean ()) <= m_phyTolerance;
+      accurate = accurate && ok;
+      std::cout << names[k] << "," << MeanCi (values[0][k]) << "," << MeanCi (values[1][k]) << ","
+                << MeanCi (errors[k]) << "," << (ok ? "yes" : "no") << "\n";
+    }
+  for (int m = 0; m < 2; m++)
+    {
+      std::cout << "Delay percentiles (all packets), " << models[m] << ": " << Percentiles (latency[m]) << "\n";
+    }
+  std::cout << "Wall-clock time: " << wallSeconds[0] << " s " << models[0] << ", " << wallSeconds[1] << " s " << models[1] << " ("
+            << (wallSeconds[1] > 0 ? wallSeconds[0] / wallSeconds[1] : 0) << "x faster)\n";
+  std::cout << "The " << models[1] << " model is " << (accurate ? "" : "NOT ") << "within " << m_phyTolerance * 100
+            << "% of " << models[0] << " on every metric for this scenario\n";
+}
+
+/// Parameters a scenario file can sweep, in the order they appear in the store key
+static const char *sweepParameters[] = {
+  "protocol", "nWifis", "nSources", "totalTime", "rate", "phyMode",
+  "nodeSpeed", "nodePause", "posMax", "txp", "run"
+};
+static const size_t nSweepParameters = sizeof (sweepParameters) / sizeof (sweepParameters[0]);
+
+static std::string
+Trim (const std::string &s)
+{
+  size_t begin = s.find_first_not_of (" \t\r");
+  if (begin == std::string::npos)
+    {
+      return "";
+    }
+  size_t end = s.find_last_not_of (" \t\r");
+  return s.substr (begin, end - begin + 1);
+}
+
+/// Numbers are normalized so "75", "75.0" and "7.5e1" are the same point;
+/// \p where ("file:line") prefixes the error for a value that is not a number
+static std::string
+CanonicalValue (const std::string &where, const std::string &name, const std::string &value)
+{
+  if (name == "rate" || name == "phyMode")
+    {
+      return value;
+    }
+  std::size_t used = 0;
+  double number = 0;
+  try
+    {
+      number = std::stod (value, &used);
+    }
+  catch (const std::exception &)
+    {
+      used = 0;
+    }
+  if (used != value.size ())
+    {
+      NS_FATAL_ERROR (where << ": " << name << " needs a number, got \"" << value << "\"");
+    }
+  std::ostringstream oss;
+  oss.precision (12);
+  oss << number;
+  return oss.str ();
+}
+
+/// Expand "a,b,c" lists and inclusive "start:stop:step" ranges
+static std::vector<std::string>
+ExpandValues (const std::string &where, const std::string &name, const std::string &spec)
+{
+  std::vector<std::string> values;
+  std::vector<std::string> items = SplitList (spec);
+  for (size_t i = 0; i < items.size (); i++)
+    {
+      std::string item = Trim (items[i]);
+      if (std::count (item.begin (), item.end (), ':') == 2)
+        {
+          size_t first = item.find (':');
+          size_t second = item.find (':', first + 1);
+          double start = 0;
+          double stop = 0;
+          double step = 0;
+          try
+            {
+              start = std::stod (CanonicalValue (where, name, Trim (item.substr (0, first))));
+              stop = std::stod (CanonicalValue (where, name, Trim (item.substr (first + 1, second - first - 1))));
+              step = std::stod (CanonicalValue (where, name, Trim (item.substr (second + 1))));
+            }
+          catch (const std::exception &)
+            {
+              NS_FATAL_ERROR (where << ": " << name << " range \"" << item << "\" is not start:stop:step");
+            }
+          if (step <= 0)
+            {
+              NS_FATAL_ERROR (where << ": range step of " << name << " must be positive");
+            }
+          for (int k = 0; start + k * step <= stop + step * 1e-9; k++)
+            {
+              std::ostringstream oss;
+              oss << start + k * step;
+              values.push_back (CanonicalValue (where, name, oss.str ()));
+            }
+        }
+      else if (!item.empty ())
+        {
+          values.push_back (CanonicalValue (where, name, item));
+        }
+    }
+  return values;
+}
+
+std::string
+RoutingExperiment::SweepConfig (int nSinks) const
+{
+  std::ostringstream oss;
+  oss.precision (12);
+  oss << "seed=" << RngSeedManager::GetSeed () << ";runNumber=" << RngSeedManager::GetRun ()
+      << ";nSinks=" << nSinks << ";trafficMatrix=" << m_trafficMatrix
+      << ";channel=" << m_channel << ";rxRange=" << m_rxRange << ";lossCutoffDb=" << m_lossCutoffDb
+      << ";propagationCache=" << m_propagationCache << ";cacheTolerance=" << m_cacheTolerance
+      << ";trajectories=" << m_trajectories << ";routeSnapshots=" << m_routeSnapshots
+      << ";aggregateTraffic=" << m_aggregateTraffic << ";trafficPattern=" << m_trafficPattern
+      << ";trafficTick=" << m_trafficTick << ";scheduler=" << m_scheduler
+      << ";traceLevel=" << TraceLevelName (m_traceLevel) << ";traceMobility=" << m_traceMobility
+      << ";leanMemory=" << m_leanMemory << ";asyncTraces=" << m_asyncTraces
+      << ";anim=" << m_animFile << ";progress=" << m_progress;
+  // Commas would split the header line of the CSV store
+  std::string config = oss.str ();
+  std::replace (config.begin (), config.end (), ',', ' ');
+  return config;
+}
+
+void
+RoutingExperiment::RunSweep (int nSinks, int nSources, double txp, std::string CSVfileName)
+{
+  // Values not given in the scenario file come from the command line
+  std::map<std::string, std::vector<std::string> > ranges;
+  std::ostringstream defaults[nSweepParameters];
+  defaults[0] << m_protocol;
+  defaults[1] << m_nWifis;
+  defaults[2] << nSources;
+  defaults[3] << m_totalTime;
+  defaults[4] << m_rate;
+  defaults[5] << m_phyMode;
+  defaults[6] << m_nodeSpeed;
+  defaults[7] << m_nodePause;
+  defaults[8] << m_posMax;
+  defaults[9] << txp;
+  defaults[10] << 0;
+  for (size_t p = 0; p < nSweepParameters; p++)
+    {
+      ranges[sweepParameters[p]].push_back (CanonicalValue ("command line", sweepParameters[p], defaults[p].str ()));
+    }
+
+  // Scenario file: one "name = values" line per parameter, # starts a
+  // comment, values are lists and/or inclusive start:stop:step ranges, e.g.
+  //   protocol = 1,2,3,4
+  //   nWifis = 25:100:25
+  //   rate = 160kbps, 320kbps
+  //   run = 0:4:1
+  std::ifstream in (m_scenarioFile.c_str ());
+  if (!in)
+    {
+      NS_FATAL_ERROR ("Cannot open scenario file " << m_scenarioFile);
+    }
+  std::string line;
+  int lineNo = 0;
+  while (std::getline (in, line))
+    {
+      lineNo++;
+      line = Trim (line.substr (0, line.find ('#')));
+      if (line.empty ())
+        {
+          continue;
+        }
+      size_t eq = line.find ('=');
+      std::string name = Trim (line.substr (0, eq));
+      if (eq == std::string::npos || ranges.find (name) == ranges.end ())
+        {
+          NS_FATAL_ERROR (m_scenarioFile << ":" << lineNo << ": expected one of protocol, nWifis, nSources, totalTime, "
+                          "rate, phyMode, nodeSpeed, nodePause, posMax, txp or run = values");
+        }
+      std::ostringstream where;
+      where << m_scenarioFile << ":" << lineNo;
+      ranges[name] = ExpandValues (where.str (), name, line.substr (eq + 1));
+      if (ranges[name].empty ())
+        {
+          NS_FATAL_ERROR (m_scenarioFile << ":" << lineNo << ": no values for " << name);
+        }
+    }
+
+  for (size_t i = 0; i < ranges["protocol"].size (); i++)
+    {
+      CheckRouteSnapshots (std::stoul (ranges["protocol"][i]));
+    }
+
+  // Cartesian product, deduplicated on the normalized parameter key
+  std::vector<std::vector<std::string> > jobs;
+  std::vector<std::string> keys;
+  std::set<std::string> seen;
+  std::vector<size_t> digit (nSweepParameters, 0);
+  bool more = true;
+  while (more)
+    {
+      std::vector<std::string> job;
+      std::string key;
+      for (size_t p = 0; p < nSweepParameters; p++)
+        {
+          job.push_back (ranges[sweepParameters[p]][digit[p]]);
+          key += (p ? ";" : "") + std::string (sweepParameters[p]) + "=" + job.back ();
+        }
+      if (seen.insert (key).second)
+        {
+          jobs.push_back (job);
+          keys.push_back (key);
+        }
+      more = false;
+      for (size_t p = nSweepParameters; p-- > 0; )
+        {
+          if (++digit[p] < ranges[sweepParameters[p]].size ())
+            {
+              more = true;
+              break;
+            }
+          digit[p] = 0;
+        }
+    }
+
+  // The results store doubles as the checkpoint: every finished point is
+  // appended and flushed as soon as its worker reports back.  Its first line
+  // records the options the key does not cover, and a store written with
+  // other options is never resumed, so one file never mixes configurations.
+  std::string config = "# config: " + SweepConfig (nSinks);
+  std::set<std::string> done;
+  {
+    std::ifstream store (m_sweepResults.c_str ());
+    std::string row;
+    if (std::getline (store, row) && row != config)
+      {
+        NS_FATAL_ERROR (m_sweepResults << " was written with other options, so it cannot be resumed:\n  "
+                        << row << "\nnow\n  " << config << "\nUse another sweepResults file");
+      }
+    std::getline (store, row); // column header
+    while (std::getline (store, row))
+      {
+        done.insert (row.substr (0, row.find (',')));
+      }
+  }
+  bool newStore = done.empty ();
+  std::vector<size_t> pending;
+  for (size_t j = 0; j < jobs.size (); j++)
+    {
+      if (done.find (keys[j]) == done.end ())
+        {
+          pending.push_back (j);
+        }
+    }
+  std::cout << "Scenario " << m_scenarioFile << ": " << jobs.size () << " points, "
+            << jobs.size () - pending.size () << " already in " << m_sweepResults << "\n";
+
+  std::ofstream store (m_sweepResults.c_str (), newStore ? std::ios::out : std::ios::app);
+  if (newStore)
+    {
+      store << config << "\n";
+      store << "Key";
+      for (size_t p = 0; p < nSweepParameters; p++)
+        {
+          store << "," << sweepParameters[p];
+        }
+      store << ",TxPackets,RxPackets,ThroughputKbps,DeliveryRatio,DelayMs,SetupSeconds,RunSeconds,Events,PeakRssKb"
+            << std::endl;
+    }
+
+  ForkPool (pending.size (), m_nWorkers,
+            [&] (int i)
+              {
+                const std::vector<std::string> &job = jobs[pending[i]];
+                m_protocol = std::stoul (job[0]);
+                m_nWifis = std::stoi (job[1]);
+                m_totalTime = std::stod (job[3]);
+                m_rate = job[4];
+                m_phyMode = job[5];
+                m_nodeSpeed = std::stoi (job[6]);
+                m_nodePause = std::stoi (job[7]);
+                m_posMax = std::stod (job[8]);
+                int run = std::stoi (job[10]);
+                return Run (nSinks, std::stoi (job[2]), std::stod (job[9]), CSVfileName,
+                            run * StreamsPerRun (m_nWifis), pending[i]);
+              },
+            [&] (int i, const RunResult &r)
+              {
+                const std::vector<std::string> &job = jobs[pending[i]];
+                store << keys[pending[i]];
+                for (size_t p = 0; p < nSweepParameters; p++)
+                  {
+                    store << "," << job[p];
+                  }
+                store << "," << r.txPackets << "," << r.rxPackets << "," << r.throughputKbps
+                      << "," << r.deliveryRatio << "," << r.delay * 1000 << "," << r.setupSeconds
+                      << "," << r.runSeconds << "," << r.events << "," << r.peakRssKb << std::endl;
+                std::cout << "point " << keys[pending[i]] << ": " << r.throughputKbps << " kbps\n";
+              });
+  std::cout << "Sweep results in " << m_sweepResults << "\n";
+}
+
+void
+RoutingExperiment::InstallWaypointMobility (NodeContainer nodes, int64_t streamIndex)
+{
+  MobilityHelper mobilityAdhoc;
+
+  // make posMax command line
+  ObjectFactory pos;
+  std::stringstream ssPos;
+  ssPos << "ns3::UniformRandomVariable[Min=0.0|Max=" << m_posMax << "]";
+  pos.SetTypeId ("ns3::RandomRectanglePositionAllocator");
+  pos.Set ("X", StringValue (ssPos.str ()));
+  pos.Set ("Y", StringValue (ssPos.str ()));
+
+  Ptr<PositionAllocator> taPositionAlloc = pos.Create ()->GetObject<PositionAllocator> ();
+  streamIndex += taPositionAlloc->AssignStreams (streamIndex);
+
+  std::stringstream ssSpeed;
+  ssSpeed << "ns3::UniformRandomVariable[Min=1|Max=" << m_nodeSpeed << "]";
+   // Configure mobility pause behaviour here
+  std::stringstream ssPause;
+  ssPause << "ns3::ConstantRandomVariable[Constant=" << m_nodePause << "]";
+  mobilityAdhoc.SetMobilityModel ("ns3::RandomWaypointMobilityModel",
+                                  "Speed", StringValue (ssSpeed.str ()),
+                                  "Pause", StringValue (ssPause.str ()),
+                                  "PositionAllocator", PointerValue (taPositionAlloc));
+  mobilityAdhoc.SetPositionAllocator (taPositionAlloc);
+
+  mobilityAdhoc.Install (nodes);
+  streamIndex += mobilityAdhoc.AssignStreams (nodes, streamIndex);
+}
+
+Ptr<TrajectoryFile>
+RoutingExperiment::LoadTrajectories (int64_t streamIndex)
+{
+  std::ostringstream oss;
+  oss << m_trajectories << "-" << RngSeedManager::GetSeed () << "-" << streamIndex << ".traj";
+  std::string fileName = oss.str ();
+
+  Ptr<TrajectoryFile> file = TrajectoryFile::Open (fileName);
+  if (!file)
+    {
+      // The simulator is a singleton, so the waypoint model runs on its own
+      // in a child process
+      ForkPool (1, 1,
+                [&] (int)
+                  {
+                    return GenerateTrajectories (fileName, streamIndex);
+                  },
+                [] (int, const RunResult &)
+                  {
+                  });
+      file = TrajectoryFile::Open (fileName);
+      if (!file)
+        {
+          NS_FATAL_ERROR ("Cannot map trajectory file " << fileName);
+        }
+    }
+
+  const TrajectoryFileHeader &header = file->GetHeader ();
+  if (header.nNodes != static_cast<uint32_t> (m_nWifis) || header.duration < m_totalTime
+      || header.posMax != m_posMax || header.maxSpeed != m_nodeSpeed || header.pause != m_nodePause)
+    {
+      NS_FATAL_ERROR (fileName << " holds " << header.nNodes << " nodes over " << header.duration
+                      << " s (posMax " << header.posMax << ", speed " << header.maxSpeed << ", pause "
+                      << header.pause << "); delete it to regenerate it for this scenario");
+    }
+  return file;
+}
+
+void
+RoutingExperiment::RecordWaypoint (Ptr<const MobilityModel> model)
+{
+  std::map<const MobilityModel *, uint32_t>::const_iterator it = m_waypointNode.find (PeekPointer (model));
+  if (it == m_waypointNode.end ())
+    {
+      return;
+    }
+  Vector p = model->GetPosition ();
+  Vector v = model->GetVelocity ();
+  TrajectoryWaypoint w;
+  w.time = Simulator::Now ().GetSeconds ();
+  w.x = p.x;
+  w.y = p.y;
+  w.z = p.z;
+  w.vx = v.x;
+  w.vy = v.y;
+  w.vz = v.z;
+  m_waypoints[it->second].push_back (w);
+}
+
+RunResult
+RoutingExperiment::GenerateTrajectories (std::string fileName, int64_t streamIndex)
+{
+  NodeContainer nodes;
+  nodes.Create (m_nWifis);
+  InstallWaypointMobility (nodes, streamIndex);
+
+  m_waypointNode.clear ();
+  m_waypoints.assign (m_nWifis, std::vector<TrajectoryWaypoint> ());
+  for (int i = 0; i < m_nWifis; i++)
+    {
+      Ptr<MobilityModel> model = nodes.Get (i)->GetObject<MobilityModel> ();
+      m_waypointNode[PeekPointer (model)] = i;
+      RecordWaypoint (model);
+      model->TraceConnectWithoutContext ("CourseChange", MakeCallback (&RoutingExperiment::RecordWaypoint, this));
+    }
+
+  Simulator::Stop (Seconds (m_totalTime));
+  Simulator::Run ();
+  Simulator::Destroy ();
+
+  TrajectoryFileHeader header;
+  header.duration = m_totalTime;
+  header.posMax = m_posMax;
+  header.maxSpeed = m_nodeSpeed;
+  header.pause = m_nodePause;
+  header.streamIndex = streamIndex;
+  TrajectoryFile::Write (fileName, header, m_waypoints);
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < m_waypoints.size (); i++)
+    {
+      total += m_waypoints[i].size ();
+    }
+  std::cout << "Wrote " << total << " waypoints of " << m_nWifis << " nodes to " << fileName << "\n";
+  return RunResult ();
+}
+
 int
 main (int argc, char *argv[])
 {
   RoutingExperiment experiment;
   std::string CSVfileName = experiment.CommandSetup (argc,argv);
 
-  //blank out the last output file and write the column headers
-  std::ofstream out (CSVfileName.c_str ());
-  out << "SimulationSecond," <<
-  "ReceiveRate," <<
-  "PacketsReceived," <<
-  "NumberOfSinks," <<
-  "RoutingProtocol," <<
-  "TransmissionPower" <<
-  std::endl;
-  out.close ();
-
-  int nSinks = 1;
+  int nSinks = experiment.GetNSinks ();
   
   int nSources = 5; // Configure number of source here
   double txp = -5 ; //2.5 * 2.5 of the -5db = 2.6
 
-  int64_t streamIndex = 0; // used to get consistent mobility across scenarios
-  nRuns = 1;
-
-    for (int iruns = 0; iruns<nRuns; iruns++)
+  // streamIndex is derived from the run index so mobility stays consistent
+  // across scenarios and between serial and parallel sweeps
+  if (experiment.TraceLevelReport ())
+    {
+      ReportTraceLevelCost (std::cout, [&] (TraceLevel level)
+        {
+          nRuns = 1;
+          experiment.SetTraceLevel (level);
+          experiment.RunReplications (nSinks, nSources, txp, CSVfileName);
+        });
+      return 0;
+    }
+  if (experiment.TrafficCheck ())
+    {
+      return experiment.RunTrafficCheck (nSinks, nSources, txp, CSVfileName) ? 0 : 1;
+    }
+  if (experiment.PhyReport ())
+    {
+      experiment.RunPhyReport (nSinks, nSources, txp, CSVfileName);
+      return 0;
+    }
+  if (experiment.Sweep ())
+    {
+      experiment.RunSweep (nSinks, nSources, txp, CSVfileName);
+      return 0;
+    }
+  if (experiment.Variants ())
     {
-        experiment.Run (nSinks, nSources, txp, CSVfileName, streamIndex);
-        streamIndex = streamIndex+50;
+      experiment.RunVariants (nSinks, nSources, txp, CSVfileName);
+      return 0;
     }
+  if (experiment.Regression ())
+    {
+      return experiment.RunRegression (nSinks, nSources, txp, CSVfileName) ? 0 : 1;
+    }
+  if (experiment.Benchmark ())
+    {
+      experiment.RunBenchmark (nSinks, nSources, txp, CSVfileName);
+      return 0;
+    }
+  experiment.RunReplications (nSinks, nSources, txp, CSVfileName);
 }
 
-void
-RoutingExperiment::Run (int nSinks, int nSources, double txp, std::string CSVfileName,  int64_t streamIndex)
+RunResult
+RoutingExperiment::Run (int nSinks, int nSources, double txp, std::string CSVfileName,  int64_t streamIndex, int runIndex)
 {
-  Packet::EnablePrinting ();
+  double setupStart = WallClockSeconds ();
+  // generated in a separate process before anything is built here
+  Ptr<TrajectoryFile> trajectories;
+  if (!m_trajectories.empty ())
+    {
+      trajectories = LoadTrajectories (streamIndex);
+    }
+  if (m_traceLevel >= TRACE_DEBUG && !m_leanMemory)
+    {
+      Packet::EnablePrinting ();
+    }
+  if (m_progress > 0)
+    {
+      m_progressMonitor.Start (SchedulerTypeName (m_scheduler), m_progress, m_totalTime,
+                               m_progressFile.empty () ? "" : std::to_string (runIndex) + m_progressFile);
+    }
+  else
+    {
+      SelectScheduler (m_scheduler);
+    }
   m_nSinks = nSinks;
   m_nSources = nSources;
   m_txp = txp;
   m_CSVfileName = CSVfileName;
 
-  int nWifis = 75;
+  int nWifis = m_nWifis;
 
-  double TotalTime = 150.0;
-  std::string rate ("160kbps");
-  std::string phyMode ("DsssRate11Mbps");
-  std::string tr_name ("adhoc-rt-cmpr");
-  int nodeSpeed = 12; //in m/s
-  int nodePause = 0; //in s
-  double posMax = 100.0;
+  double TotalTime = m_totalTime;
+  std::string rate (m_rate);
+  std::string phyMode (m_phyMode);
+  double posMax = m_posMax;
   m_protocolName = "protocol";
 
   //Set Non-unicastMode rate to unicast mode
   Config::SetDefault ("ns3::WifiRemoteStationManager::NonUnicastMode",StringValue (phyMode));
 
+  if (m_memoryReport)
+    {
+      m_memory.Reset ();
+    }
   NodeContainer sinkNodes;
   NodeContainer adhocNodes;
   sinkNodes.Create (nSinks);
   adhocNodes.Create (nWifis);
+  m_memory.Mark ("nodes");
 
   // setting up wifi phy and channel using helpers
   WifiHelper wifi;
   wifi.SetStandard (WIFI_PHY_STANDARD_80211b);
 
   // Configure Constant speed prop delay and log distance prop loss
-  YansWifiPhyHelper wifiPhy =  YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel ;
-  wifiChannel.SetPropagationDelay ("ns3::ConstantSpeedPropagationDelayModel");
-  wifiChannel.AddPropagationLoss ("ns3::LogDistancePropagationLossModel");
-
-  wifiPhy.SetChannel (wifiChannel.Create ());
+  YansWifiPhyHelper yansPhy =  YansWifiPhyHelper::Default ();
+  SpectrumWifiPhyHelper spectrumPhy = SpectrumWifiPhyHelper::Default ();
+  Ptr<GridSpectrumChannel> gridChannel;
+  Ptr<AbstractLinkChannel> abstractChannel;
+  Ptr<PropagationCache> propagationCache;
+  Ptr<PropagationLossModel> loss = CreateObject<LogDistancePropagationLossModel> ();
+  Ptr<PropagationDelayModel> delay = CreateObject<ConstantSpeedPropagationDelayModel> ();
+  if (m_propagationCache && m_channel != "abstract")
+    {
+      propagationCache = CreateObject<PropagationCache> ();
+      propagationCache->SetAttribute ("Tolerance", DoubleValue (m_cacheTolerance));
+      loss = propagationCache->CacheLoss (loss);
+      delay = propagationCache->CacheDelay (delay);
+    }
+  if (m_channel == "yans")
+    {
+      // what YansWifiChannelHelper builds, with the models above
+      Ptr<YansWifiChannel> yansChannel = CreateObject<YansWifiChannel> ();
+      yansChannel->SetPropagationLossModel (loss);
+      yansChannel->SetPropagationDelayModel (delay);
+      yansPhy.SetChannel (yansChannel);
+    }
+  else if (m_channel == "spectrum")
+    {
+      // the PHY of the grid channel without its index or cutoffs: the
+      // reference that shows what the grid channel itself changes
+      Ptr<MultiModelSpectrumChannel> spectrumChannel = CreateObject<MultiModelSpectrumChannel> ();
+      spectrumChannel->SetPropagationDelayModel (delay);
+      spectrumChannel->AddPropagationLossModel (loss);
+      spectrumPhy.SetChannel (spectrumChannel);
+    }
+  else if (m_channel == "grid")
+    {
+      // same propagation models, but only receivers near the sender are
+      // visited.  This is a SpectrumWifiPhy, not the YansWifiPhy of the
+      // yans channel, and the skipped receivers get no interference either
+      gridChannel = CreateObject<GridSpectrumChannel> ();
+      gridChannel->SetAttribute ("ReceptionRange", DoubleValue (m_rxRange));
+      gridChannel->SetAttribute ("LossCutoffDb", DoubleValue (m_lossCutoffDb));
+      gridChannel->SetAttribute ("Validate", BooleanValue (m_validateChannel));
+      gridChannel->SetPropagationDelayModel (delay);
+      gridChannel->AddPropagationLossModel (loss);
+      spectrumPhy.SetChannel (gridChannel);
+    }
+  else if (m_channel == "abstract")
+    {
+      // no Wi-Fi devices; the links behave like a lone Yans PHY at this
+      // power, mode and loss model would
+      abstractChannel = CreateObject<AbstractLinkChannel> ();
+      abstractChannel->Calibrate (loss, WifiMode (phyMode), txp);
+      abstractChannel->AssignStreams (modelStreams + streamIndex);
+    }
+  else
+    {
+      NS_FATAL_ERROR ("No such channel:" << m_channel);
+    }
+  bool spectrum = gridChannel || m_channel == "spectrum";
+  WifiPhyHelper &wifiPhy = spectrum ? static_cast<WifiPhyHelper &> (spectrumPhy) : static_cast<WifiPhyHelper &> (yansPhy);
 
   // Add a mac and disable rate control
   WifiMacHelper wifiMac;
@@ -269,46 +2078,62 @@ RoutingExperiment::Run (int nSinks, int nSources, double txp, std::string CSVfil
     ssidString += sss.str ();
     Ssid ssid = Ssid (ssidString);
     
+    NetDeviceContainer sinkDevices;
+    NetDeviceContainer adhocDevices;
+  if (abstractChannel)
+    {
+      SimpleNetDeviceHelper simple;
+      simple.SetDeviceAttribute ("DataRate", DataRateValue (abstractChannel->GetDataRate ()));
+      sinkDevices = simple.Install (sinkNodes, abstractChannel);
+      adhocDevices = simple.Install (adhocNodes, abstractChannel);
+    }
+  else
+    {
     wifiMac.SetType ("ns3::AdhocWifiMac");
-    NetDeviceContainer sinkDevices = wifi.Install (wifiPhy, wifiMac, sinkNodes);
+    sinkDevices = wifi.Install (wifiPhy, wifiMac, sinkNodes);
 
     wifiMac.SetType ("ns3::AdhocWifiMac");
-    NetDeviceContainer adhocDevices = wifi.Install (wifiPhy, wifiMac, adhocNodes);
+    adhocDevices = wifi.Install (wifiPhy, wifiMac, adhocNodes);
+    }
+  m_memory.Mark ("devices");
+
+  m_overhead.Reset ();
+  if (m_traceLevel >= TRACE_METRICS)
+    {
+      m_overhead.Install (sinkDevices);
+      m_overhead.Install (adhocDevices);
+    }
+  m_memory.Mark ("trace sinks");
     
-    MobilityHelper mobilityAdhoc;
     MobilityHelper sinkmobilityAdhoc;
 
-  // make posMax command line
-  ObjectFactory pos;
-  std::stringstream ssPos;
-  ssPos << "ns3::UniformRandomVariable[Min=0.0|Max=" << posMax << "]";
-  pos.SetTypeId ("ns3::RandomRectanglePositionAllocator");
-  pos.Set ("X", StringValue (ssPos.str ()));
-  pos.Set ("Y", StringValue (ssPos.str ()));
-
-  Ptr<PositionAllocator> taPositionAlloc = pos.Create ()->GetObject<PositionAllocator> ();
-  streamIndex += taPositionAlloc->AssignStreams (streamIndex);
-
-  std::stringstream ssSpeed;
-  ssSpeed << "ns3::UniformRandomVariable[Min=1|Max=" << nodeSpeed << "]";
-   // Configure mobility pause behaviour here
-  //std::stringstream ssPause;
-  //ssPause << "ns3::ConstantRandomVariable[Constant=" << nodePause << "]";
-  mobilityAdhoc.SetMobilityModel ("ns3::RandomWaypointMobilityModel",
-                                  "Speed", StringValue (ssSpeed.str ()),
-                                  "PositionAllocator", PointerValue (taPositionAlloc));
-  mobilityAdhoc.SetPositionAllocator (taPositionAlloc);
-
-  mobilityAdhoc.Install (adhocNodes);
+  if (trajectories)
+    {
+      for (int i = 0; i < nWifis; i++)
+        {
+          Ptr<TrajectoryMobilityModel> model = CreateObject<TrajectoryMobilityModel> ();
+          model->SetTrajectory (trajectories, i);
+          adhocNodes.Get (i)->AggregateObject (model);
+        }
+    }
+  else
+    {
+      InstallWaypointMobility (adhocNodes, streamIndex);
+    }
     
     Ptr<ListPositionAllocator> positionAllocS = CreateObject<ListPositionAllocator> ();
     positionAllocS->Add(Vector(posMax/2, posMax/2, 0.0));// node 0
+    // further sinks on a circle around the first one
+    for (int k = 1; k < nSinks; k++)
+      {
+        double angle = 2 * M_PI * (k - 1) / (nSinks - 1);
+        positionAllocS->Add (Vector (posMax / 2 + posMax / 4 * std::cos (angle), posMax / 2 + posMax / 4 * std::sin (angle), 0.0));
+      }
     sinkmobilityAdhoc.SetPositionAllocator(positionAllocS);
     sinkmobilityAdhoc.SetMobilityModel("ns3::ConstantPositionMobilityModel");
     
     sinkmobilityAdhoc.Install(sinkNodes);
-    
-    streamIndex += mobilityAdhoc.AssignStreams (adhocNodes, streamIndex);
+  m_memory.Mark ("nodes");
   
   AodvHelper aodv;
   OlsrHelper olsr;
@@ -317,6 +2142,8 @@ RoutingExperiment::Run (int nSinks, int nSources, double txp, std::string CSVfil
   DsrMainHelper dsrMain;
   Ipv4ListRoutingHelper list;
   InternetStackHelper internet;
+  // the scripts only use IPv4
+  internet.SetIpv6StackInstall (!m_leanMemory);
 
   switch (m_protocol)
     {
@@ -360,11 +2187,102 @@ RoutingExperiment::Run (int nSinks, int nSources, double txp, std::string CSVfil
   sinkApInterfaces = addressAdhoc.Assign (sinkDevices); 
   Ipv4InterfaceContainer adhocInterfaces;
   adhocInterfaces = addressAdhoc.Assign (adhocDevices);
+  m_memory.Mark ("routing");
+
+  m_sinkIndex.clear ();
+  for (int k = 0; k < nSinks; k++)
+    {
+      SetupPacketReceive (sinkApInterfaces.GetAddress (k), sinkNodes.Get (k), k);
+
+      PacketSinkHelper sinkk ("ns3::UdpSocketFactory",
+                              InetSocketAddress (sinkApInterfaces.GetAddress (k), port));
+      ApplicationContainer temp = sinkk.Install (sinkNodes.Get (k));
+      temp.Start (Seconds (0));
+    }
+  m_memory.Mark ("applications");
+
+  RunContext ctx;
+  ctx.nSinks = nSinks;
+  ctx.nWifis = nWifis;
+  ctx.totalTime = TotalTime;
+  ctx.runIndex = runIndex;
+  ctx.streamIndex = streamIndex;
+  ctx.setupStart = setupStart;
+  ctx.sinkNodes = sinkNodes;
+  ctx.adhocNodes = adhocNodes;
+  ctx.sinkDevices = sinkDevices;
+  ctx.adhocDevices = adhocDevices;
+  ctx.sinkApInterfaces = sinkApInterfaces;
+  ctx.adhocInterfaces = adhocInterfaces;
+  ctx.wifiPhy = &wifiPhy;
+  ctx.gridChannel = gridChannel;
+  ctx.abstractChannel = abstractChannel;
+  ctx.propagationCache = propagationCache;
+
+  if (m_warmup <= 0)
+    {
+      return RunTraffic (ctx, nSources, rate, 72, "");
+    }
+
+  // Warm-up: routing converges without traffic, then every variant
+  // continues from this state in its own process
+  Simulator::Stop (Seconds (m_warmup));
+  double warmupStart = WallClockSeconds ();
+  Simulator::Run ();
+  m_warmupSeconds = WallClockSeconds () - warmupStart;
+  m_warmupSetupSeconds = warmupStart - setupStart;
+  std::cout << "Warm-up to " << m_warmup << " s took " << m_warmupSetupSeconds << " s setup + "
+            << m_warmupSeconds << " s simulation\n";
+
+  // m_variants was filled and checked by RunVariants before the warm-up
+  m_variantResults.assign (m_variants.size (), RunResult ());
+  ForkPool (m_variants.size (), m_nWorkers,
+            [&] (int i)
+              {
+                ctx.setupStart = WallClockSeconds ();
+                const TrafficVariant &v = m_variants[i];
+                return RunTraffic (ctx, v.nSources, v.rate, v.packetSize, "v" + std::to_string (i) + "-");
+              },
+            [&] (int i, const RunResult &result)
+              {
+                m_variantResults[i] = result;
+              });
+  Simulator::Destroy ();
+  return RunResult ();
+}
+
+RunResult
+RoutingExperiment::RunTraffic (RunContext &ctx, int nSources, std::string rate, uint32_t packetSize, std::string label)
+{
+  int nSinks = ctx.nSinks;
+  int nWifis = ctx.nWifis;
+  double TotalTime = ctx.totalTime;
+  int runIndex = ctx.runIndex;
+  Ipv4InterfaceContainer &adhocInterfaces = ctx.adhocInterfaces;
+  Ipv4InterfaceContainer &sinkApInterfaces = ctx.sinkApInterfaces;
+  NodeContainer &adhocNodes = ctx.adhocNodes;
+  NodeContainer &sinkNodes = ctx.sinkNodes;
+  WifiPhyHelper &wifiPhy = *ctx.wifiPhy;
+  Ptr<GridSpectrumChannel> gridChannel = ctx.gridChannel;
+  // 0, unless traffic starts after a warm-up
+  Time start = Simulator::Now ();
+  BuildTrafficMatrix (nSources, nSinks, nWifis);
+  uint32_t nFlows = m_flowSource.size ();
+  // sources with a column in the time series
+  int nSourceColumns = *std::max_element (m_flowSource.begin (), m_flowSource.end ()) + 1;
+  m_nSources = nFlows;
+  if (start > Seconds (0))
+    {
+      m_overhead.ClearCounts ();
+    }
+  std::string tr_name ("adhoc-rt-cmpr");
+
+  m_flowStats.Setup (nFlows);
 
     AddressValue remoteAddress (InetSocketAddress (adhocInterfaces.GetAddress (0), port));
-Config::SetDefault ("ns3::OnOffApplication::PacketSize", StringValue ("72")); //100-28 (UDP overhead) = 72
+Config::SetDefault ("ns3::OnOffApplication::PacketSize", UintegerValue (packetSize)); //100-28 (UDP overhead) = 72
   Config::SetDefault ("ns3::OnOffApplication::DataRate", StringValue(rate));
-  unsigned int maxBytes = 20000*72; // 20,000 x packetsize
+  unsigned int maxBytes = 20000*packetSize; // 20,000 x packetsize
   std::stringstream ssmaxBytes;
   ssmaxBytes << maxBytes;
   Config::SetDefault ("ns3::OnOffApplication::MaxBytes", StringValue (ssmaxBytes.str()));
@@ -374,23 +2292,77 @@ Config::SetDefault ("ns3::OnOffApplication::PacketSize", StringValue ("72")); //
   onoff1.SetAttribute ("OnTime", StringValue ("ns3::ConstantRandomVariable[Constant=1]"));
   onoff1.SetAttribute ("OffTime", StringValue ("ns3::ConstantRandomVariable[Constant=0]"));
     
-    Ptr<Socket> sink = SetupPacketReceive (sinkApInterfaces.GetAddress (0), sinkNodes.Get (0));
     
     
     
-  for (int i = 0; i < nSources; i++)
+  // set up before the sources, which report their packets to the flow filter
+  if (!m_animFile.empty ())
     {
-      
-      Ptr<UniformRandomVariable> var = CreateObject<UniformRandomVariable> ();
-      ApplicationContainer temp = onoff1.Install (adhocNodes.Get (i));
-      temp.Start (Seconds (var->GetValue (0,1)));
-      temp.Stop (Seconds (TotalTime-0.01));
+      m_anim.Open (std::to_string (runIndex) + label + m_animFile, m_animCompression);
+      m_anim.SetPositionSampling (m_animInterval, m_animDistance, m_animPoll);
+      m_anim.SetPacketSampling (m_animPacketSampling);
+      std::vector<std::string> flows = SplitList (m_animFlows);
+      for (size_t i = 0; i < flows.size (); i++)
+        {
+          m_anim.SelectFlow (ParseListInteger ("animFlows", flows[i], 0, static_cast<long> (nFlows) - 1));
+        }
+      m_anim.Attach (NodeContainer (sinkNodes, adhocNodes));
     }
 
- PacketSinkHelper sinkk ("ns3::UdpSocketFactory",
-                         InetSocketAddress (sinkApInterfaces.GetAddress (0), port));
-  ApplicationContainer temp = sinkk.Install (sinkNodes.Get(0));
-  temp.Start (Seconds (0));
+  Ptr<TrafficGenerator> generator;
+  if (m_aggregateTraffic)
+    {
+      // same start times, rate, packet size and byte limit as the OnOff
+      // sources, but one timer for all of them
+      generator = CreateObject<TrafficGenerator> ();
+      generator->SetAttribute ("Tick", TimeValue (Seconds (m_trafficTick)));
+      generator->SetAttribute ("OffTime", StringValue ("ns3::ConstantRandomVariable[Constant=0]"));
+      generator->AssignStreams (modelStreams + ctx.streamIndex + 1);
+      generator->TraceConnectWithoutContext ("Tx", MakeCallback (&FlowStatsEngine::Tx, &m_flowStats));
+      if (m_validateTraffic)
+        {
+          generator->TraceConnectWithoutContext ("Tx", MakeCallback (&RoutingExperiment::LogTx, this));
+        }
+      if (!m_animFlows.empty ())
+        {
+          generator->TraceConnectWithoutContext ("Tx", MakeCallback (&AnimStream::Tx, &m_anim));
+        }
+    }
+  // Start times draw from a stream of their own: the automatic stream
+  // counter depends on how many random variables the channel and the Wi-Fi
+  // models created, so the two runs of --phyReport, or
+  // OnOff and aggregate traffic, would otherwise start the flows at
+  // different times.  The OnOff on and off times are constants and draw
+  // nothing.
+  Ptr<UniformRandomVariable> var = CreateObject<UniformRandomVariable> ();
+  var->SetStream (modelStreams + ctx.streamIndex + 4);
+  m_txTimes.assign (m_validateTraffic ? nFlows : 0, std::vector<int64_t> ());
+  for (uint32_t i = 0; i < nFlows; i++)
+    {
+      Ptr<Node> source = adhocNodes.Get (m_flowSource[i]);
+      InetSocketAddress sinkAddress (sinkApInterfaces.GetAddress (m_flowSink[i]), port);
+      if (generator)
+        {
+          generator->AddFlow (source, sinkAddress,
+                              TrafficGenerator::ParsePattern (m_trafficPattern), DataRate (rate), packetSize,
+                              maxBytes, Seconds (var->GetValue (0,1)), Seconds (TotalTime-0.01) - start);
+          continue;
+        }
+      onoff1.SetAttribute ("Remote", AddressValue (sinkAddress));
+      ApplicationContainer temp = onoff1.Install (source);
+      temp.Get (0)->TraceConnectWithoutContext ("Tx", m_flowStats.MakeTxCallback (i));
+      if (m_validateTraffic)
+        {
+          temp.Get (0)->TraceConnectWithoutContext ("Tx", MakeBoundCallback (&LogOnOffTx, &m_txTimes[i]));
+        }
+      if (!m_animFlows.empty ())
+        {
+          temp.Get (0)->TraceConnectWithoutContext ("Tx", m_anim.MakeTxCallback (i));
+        }
+      temp.Start (Seconds (var->GetValue (0,1)));
+      temp.Stop (Seconds (TotalTime-0.01) - start);
+    }
+  m_memory.Mark ("applications");
 
     
   std::stringstream ss;
@@ -398,118 +2370,216 @@ Config::SetDefault ("ns3::OnOffApplication::PacketSize", StringValue ("72")); //
   std::string nodes = ss.str ();
 
   std::stringstream ss2;
-  ss2 << nodeSpeed;
+  ss2 << m_nodeSpeed;
   std::string sNodeSpeed = ss2.str ();
 
   std::stringstream ss3;
-  ss3 << nodePause;
+  ss3 << m_nodePause;
   std::string sNodePause = ss3.str ();
 
   std::stringstream ss4;
   ss4 << rate;
   std::string sRate = ss4.str ();
     
-   static int iteration=0;
-    
     std::stringstream ss5;
-    ss5 << iteration;
+    ss5 << runIndex;
     std::string siteration = ss5.str ();
     
     std::stringstream ss6;
-    ss6 << posMax;
+    ss6 << m_posMax;
     std::string ssposMax = ss6.str ();
     
     NS_LOG_INFO ("Configure Tracing.");
     
-  tr_name = tr_name + "_" + m_protocolName +"_" + nodes + "nodes_" + siteration + "iteration_" + sNodePause + "pause_" + sRate + "rate_"+ssposMax+"grid";
+  tr_name = label + tr_name + "_" + m_protocolName +"_" + nodes + "nodes_" + siteration + "iteration_" + sNodePause + "pause_" + sRate + "rate_"+ssposMax+"grid";
 
     
+  if (m_asyncTraces)
+    {
+      m_traceWriter.Start (uint64_t (m_traceBufferMb) << 20, AsyncTraceWriter::ParsePolicy (m_traceOverflow));
+    }
   AsciiTraceHelper ascii;
-  MobilityHelper::EnableAsciiAll (ascii.CreateFileStream (tr_name + ".mob"));
+  if (m_traceMobility || m_traceLevel >= TRACE_DEBUG)
+    {
+      if (m_asyncTraces)
+        {
+          m_traceWriter.EnableMobilityAscii (tr_name + ".mob", TracedNodes (m_traceNodes, NodeContainer (sinkNodes, adhocNodes)));
+        }
+      else
+        {
+          MobilityHelper::EnableAsciiAll (ascii.CreateFileStream (tr_name + ".mob"));
+        }
+    }
 
+  // Flow statistics are collected by m_flowStats while the simulation runs;
+  // FlowMonitor is only installed for its XML dump
   Ptr<FlowMonitor> flowmon;
   FlowMonitorHelper flowmonHelper;
-  flowmon = flowmonHelper.InstallAll ();
+  if (m_traceLevel >= TRACE_DEBUG)
+    {
+      flowmon = flowmonHelper.InstallAll ();
+    }
 
 
   NS_LOG_INFO ("Run Simulation.");
 
-  CheckThroughput ();
+  std::ostringstream constantColumns;
+  constantColumns << m_nSinks << "," << m_nSources << "," << m_protocolName << "," << m_txp;
+  m_timeSeries.Setup (std::to_string (runIndex) + label + m_CSVfileName, constantColumns.str (), m_sampleInterval,
+                      nSinks, nSourceColumns, (TotalTime - start.GetSeconds ()) / m_sampleInterval + 1, m_maxBufferedSamples);
+  if (m_traceLevel >= TRACE_METRICS)
+    {
+      CheckThroughput ();
+    }
 
-  Simulator::Stop (Seconds (TotalTime));
-    
-  AnimationInterface anim ("adhoc_routing.xml");
-  anim.SetMaxPktsPerTraceFile(500000);  //Get rid of the error
+  Simulator::Stop (Seconds (TotalTime) - start);
 
- 
-    std::string it = std::to_string(iteration);
-    wifiPhy.EnablePcap (it, sinkDevices);
-    iteration++;
+  RouteSnapshotter routeSnapshots;
+  if (m_routeSnapshots > 0)
+    {
+      NodeContainer allNodes (sinkNodes, adhocNodes);
+      routeSnapshots.Start (allNodes, Seconds (m_routeSnapshots),
+                            m_traceLevel >= TRACE_METRICS ? tr_name + ".routes" : std::string ());
+    }
     
-  Simulator::Run ();
-
-  flowmon->SerializeToXmlFile ((tr_name + ".flowmon").c_str(), false, false);
-
-   flowmon->CheckForLostPackets ();
-  Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmonHelper.GetClassifier ());
-  FlowMonitor::FlowStatsContainer stats = flowmon->GetFlowStats ();
-  for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
+  AnimationInterface *anim = 0;
+  if (m_traceLevel >= TRACE_FULL)
     {
-      // Duration for throughput measurement is 100.0 seconds, so..
-        
-      //  Uncomment the following section to display flow statistics for each node pair
-        
-      //  Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
-              if ((int)i->first <= nSources)
-       // if (t.destinationAddress == "10.1.1.1")
-      {
-          /*
-          std::cout << "Flow " << i->first << " (" << t.sourceAddress << " -> " << t.destinationAddress << ")\n";
-          std::cout << "  Tx Packets: " << i->second.txPackets << "\n";
-          std::cout << "  Tx Bytes:   " << i->second.txBytes << "\n";
-          std::cout << "  TxOffered:  " << i->second.txBytes * 8.0 / 100 / 1000   << " kbps\n";
-          std::cout << "  Rx Packets: " << i->second.rxPackets << "\n";
-          std::cout << "  Rx Bytes:   " << i->second.rxBytes << "\n";
-          if(i->second.rxPackets)
-          std::cout << "  Avg Delay:  " << (i->second.delaySum)/(i->second.rxPackets) << "\n";
-          std::cout << "  Throughput: " << i->second.rxBytes * 8.0 / 100 / 1000   << " kbps\n";
-          */
-           
-          RunTxPackets += i->second.txPackets ;
-          RunTxBytes += i->second.txBytes;
-          RunRxPackets += i->second.rxPackets;
-          RunRxBytes += i->second.rxBytes;
-          if(i->second.rxPackets)
-          {
-              RunDelay += (i->second.delaySum.GetMilliSeconds())/(i->second.rxPackets) ;
-          }
+      if (m_animFile.empty ())
+        {
+          anim = new AnimationInterface ("adhoc_routing.xml");
+          anim->SetMaxPktsPerTraceFile(500000);  //Get rid of the error
+        }
+
+      std::string it = std::to_string(runIndex);
+      if (m_asyncTraces)
+        {
+          m_traceWriter.EnablePcap (label + it, TracedNodes (m_traceNodes, sinkNodes), m_snapLength);
+        }
+      else
+        {
+          wifiPhy.EnablePcap (label + it, ctx.sinkDevices);
         }
- 
     }
-    std::cout << "\n  Avg Tx Packets this run: " << RunTxPackets/nSources << "\n";
-    std::cout << "  Avg Tx Bytes this run:   " << RunTxBytes/nSources << "\n";
-    std::cout << "  Avg Rx Packets this run: " << RunRxPackets/nSources << "\n";
-    std::cout << "  Avg Rx Bytes this run:   " << RunRxBytes/nSources << "\n";
-    std::cout << "  Avg Delay this run:  " << RunDelay/nSources << "\n";
-    std::cout << "  Avg Throughput this run: " << RunRxBytes/nSources * 8.0 / 100 / 1000   << " kbps\n";
+  m_memory.Mark ("trace sinks");
     
-    TotalTxPackets += RunTxPackets/nSources; RunTxPackets = 0;
-    TotalTxBytes += RunTxBytes/nSources; RunTxBytes = 0;
-    TotalRxPackets += RunRxPackets/nSources; RunRxPackets = 0;
-    TotalRxBytes += RunRxBytes/nSources; RunRxBytes = 0;
-    TotalDelay+= RunDelay/nSources; RunDelay = 0;
-    static int checker =1;
-    if(checker == nRuns)
+  double runStart = WallClockSeconds ();
+  Simulator::Run ();
+  double runEnd = WallClockSeconds ();
+  if (m_validateTraffic)
+    {
+      WriteTxTimes (TxTimesFileName (runIndex, label), m_txTimes);
+    }
+  if (m_asyncTraces)
+    {
+      m_traceWriter.Stop ();
+      m_traceWriter.PrintStats (std::cout);
+    }
+  if (m_memoryReport)
+    {
+      m_memory.CountQueues (ctx.sinkDevices);
+      m_memory.CountQueues (ctx.adhocDevices);
+      m_memory.Mark ("run");
+      m_memory.PrintStats (std::cout, nSinks + nWifis);
+    }
+  if (m_progress > 0)
+    {
+      m_progressMonitor.Stop ();
+    }
+  if (gridChannel)
+    {
+      gridChannel->PrintStats (std::cout);
+    }
+  if (ctx.abstractChannel)
     {
-    std::cout << "\n\n  Avg Tx Packets overall: " << TotalTxPackets/nRuns << "\n";
-    std::cout << "  Avg Tx Bytes overall:   " << TotalTxBytes/nRuns << "\n";
-    std::cout << "  Avg Rx Packets overall: " << TotalRxPackets/nRuns << "\n";
-    std::cout << "  Avg Rx Bytes this overall:   " << TotalRxBytes/nRuns << "\n";
-    std::cout << "  Avg Delay overall:  " << TotalDelay/nRuns << "\n";
-    std::cout << "  Avg Throughput overall: " << TotalRxBytes/nRuns * 8.0 / 100 / 1000   << " kbps\n\n";
+      ctx.abstractChannel->PrintStats (std::cout);
+    }
+  if (ctx.propagationCache)
+    {
+      ctx.propagationCache->PrintStats (std::cout);
+    }
+  if (generator)
+    {
+      generator->PrintStats (std::cout);
+    }
+  if (m_routeSnapshots > 0)
+    {
+      routeSnapshots.Stop ();
+      routeSnapshots.PrintStats (std::cout);
+    }
+  if (m_traceLevel >= TRACE_METRICS)
+    {
+      m_timeSeries.Flush ();
     }
-    checker++;
 
+  if (m_traceLevel >= TRACE_DEBUG)
+    {
+      flowmon->SerializeToXmlFile ((tr_name + ".flowmon").c_str(), false, false);
+    }
 
+  OnlineStats txPackets;
+  OnlineStats txBytes;
+  OnlineStats rxPackets;
+  OnlineStats rxBytes;
+  OnlineStats throughput;
+  OnlineStats deliveryRatio;
+  OnlineStats delay;
+  LatencyHistogram latency;
+  OnlineStats jitter;
+  double deliveredBytes = 0;
+  for (uint32_t i = 0; i < m_flowStats.GetNFlows (); i++)
+    {
+      const FlowRecord &flow = m_flowStats.GetFlow (i);
+      NS_LOG_INFO ("Flow " << i << " (" << adhocInterfaces.GetAddress (m_flowSource[i]) << " -> "
+                   << sinkApInterfaces.GetAddress (m_flowSink[i]) << ")"
+                   << " tx " << flow.txPackets << " pkts, rx " << flow.rxPackets << " pkts, "
+                   << flow.GetThroughputKbps () << " kbps over " << flow.GetWindow ().GetSeconds () << " s, "
+                   << "delay " << flow.delay.GetMean () * 1000 << " ms, " << Percentiles (flow.latency)
+                   << ", jitter " << flow.jitter.GetMean () * 1000 << " ms");
+      txPackets.Add (flow.txPackets);
+      txBytes.Add (flow.txBytes);
+      rxPackets.Add (flow.rxPackets);
+      rxBytes.Add (flow.rxBytes);
+      throughput.Add (flow.GetThroughputKbps ());
+      deliveryRatio.Add (flow.GetDeliveryRatio ());
+      delay.Merge (flow.delay);
+      latency.Merge (flow.latency);
+      jitter.Merge (flow.jitter);
+      deliveredBytes += flow.rxBytes;
+    }
+    RunResult result;
+    result.txPackets = txPackets.GetMean ();
+    result.txBytes = txBytes.GetMean ();
+    result.rxPackets = rxPackets.GetMean ();
+    result.rxBytes = rxBytes.GetMean ();
+    result.delay = delay.GetMean ();
+    result.latency = latency;
+    result.jitter = jitter;
+    result.throughputKbps = throughput.GetMean ();
+    result.deliveryRatio = deliveryRatio.GetMean ();
+    RoutingOverheadMonitor::Counter control = m_overhead.GetTotal ();
+    result.controlPackets = control.packets;
+    result.controlBytes = control.bytes;
+    result.controlAirtime = control.airtime;
+    result.routingLoad = deliveredBytes ? control.bytes / deliveredBytes : 0;
+    if (m_traceLevel >= TRACE_METRICS)
+      {
+        m_overhead.PrintSummary (std::cout, deliveredBytes, nSinks + nWifis, TotalTime - start.GetSeconds ());
+        m_overhead.WriteCsv (tr_name + ".overhead");
+      }
+    result.setupSeconds = runStart - ctx.setupStart;
+    result.runSeconds = runEnd - runStart;
+    result.events = Simulator::GetEventCount ();
+    struct rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+
+  if (!m_animFile.empty ())
+    {
+      m_anim.Close ();
+      m_anim.PrintStats (std::cout);
+    }
   Simulator::Destroy ();
+  delete anim;
+  return result;
 }
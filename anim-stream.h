@@ -0,0 +1,376 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Streaming NetAnim writer for long mobile runs.
+ *
+ * AnimationInterface keeps a record of every packet and writes every
+ * position it polls, so a long run produces gigabytes of XML.  AnimStream
+ * writes the same animation format as the run goes, one element per line,
+ * and keeps only what was asked for:
+ *
+ *  - positions: on every course change and every PollInterval s, but a node
+ *    is only written again once MinInterval s passed or it moved MinDistance
+ *    metres since the last time it was written;
+ *  - packets: Wi-Fi frames as seen by the PHY monitor traces, either one
+ *    packet in PacketSampling (chosen by packet uid, so a frame is kept or
+ *    dropped at the sender and at every receiver alike) or only the packets
+ *    of the flows passed to SelectFlow (), forgotten once they are older
+ *    than the 30 s the ns-3 routing protocols queue a packet at most.
+ *
+ * With a compression level the output is piped through gzip, which runs in
+ * its own process and so compresses while the simulation goes on; gunzip
+ * the file before opening it in NetAnim.
+ */
+
+#ifndef ANIM_STREAM_H
+#define ANIM_STREAM_H
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <deque>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "ns3/fatal-error.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/packet.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+
+namespace ns3 {
+
+class AnimStream
+{
+public:
+  AnimStream ()
+    : m_file (0),
+      m_pipe (false),
+      m_minInterval (0),
+      m_minDistance (0),
+      m_pollInterval (0),
+      m_packetSampling (1),
+      m_packetLifetime (30),
+      m_positions (0),
+      m_skippedPositions (0),
+      m_packets (0),
+      m_receptions (0),
+      m_skippedFrames (0)
+  {
+  }
+
+  ~AnimStream ()
+  {
+    Close ();
+  }
+
+  /**
+   * Start writing to \p fileName, through gzip at \p compression (1-9)
+   * unless it is 0; ".gz" is then appended to the name.
+   */
+  void Open (const std::string &fileName, int compression)
+  {
+    Close ();
+    m_fileName = fileName;
+    if (compression > 0)
+      {
+        if (fileName.find ('\'') != std::string::npos)
+          {
+            NS_FATAL_ERROR ("Animation file name " << fileName << " must not contain quotes");
+          }
+        if (m_fileName.size () < 3 || m_fileName.compare (m_fileName.size () - 3, 3, ".gz") != 0)
+          {
+            m_fileName += ".gz";
+          }
+        std::string command = "gzip -" + std::to_string (std::min (compression, 9)) + " > '" + m_fileName + "'";
+        m_file = popen (command.c_str (), "w");
+        m_pipe = true;
+      }
+    else
+      {
+        m_file = std::fopen (fileName.c_str (), "w");
+        m_pipe = false;
+      }
+    if (!m_file)
+      {
+        NS_FATAL_ERROR ("Cannot open animation file " << m_fileName);
+      }
+    m_buffer.resize (1 << 20);
+    setvbuf (m_file, &m_buffer[0], _IOFBF, m_buffer.size ());
+    std::fprintf (m_file, "<anim ver=\"netanim-3.108\" filetype=\"animation\" >\n");
+    m_last.clear ();
+    m_probes.clear ();
+    m_flows.clear ();
+    m_flowProbes.clear ();
+    m_uids.clear ();
+    m_uidTimes.clear ();
+    m_positions = 0;
+    m_skippedPositions = 0;
+    m_packets = 0;
+    m_receptions = 0;
+    m_skippedFrames = 0;
+  }
+
+  /// Write a node again only after \p minInterval s or \p minDistance m (0 disables)
+  void SetPositionSampling (double minInterval, double minDistance, double pollInterval)
+  {
+    m_minInterval = minInterval;
+    m_minDistance = minDistance;
+    m_pollInterval = pollInterval;
+  }
+
+  /// Keep one packet in \p oneIn (1: all)
+  void SetPacketSampling (uint32_t oneIn)
+  {
+    m_packetSampling = oneIn > 0 ? oneIn : 1;
+  }
+
+  /// Keep only the packets of the selected flows; they must report their
+  /// packets to Tx () or a MakeTxCallback ()
+  void SelectFlow (uint32_t flow)
+  {
+    m_flows.insert (flow);
+  }
+
+  Callback<void, Ptr<const Packet> > MakeTxCallback (uint32_t flow)
+  {
+    Ptr<FlowProbe> probe = Create<FlowProbe> (this, flow);
+    m_flowProbes.push_back (probe);
+    return MakeCallback (&FlowProbe::Tx, PeekPointer (probe));
+  }
+
+  /// An application of \p flow sent \p packet
+  void Tx (uint32_t flow, Ptr<const Packet> packet)
+  {
+    if (!m_flows.count (flow))
+      {
+        return;
+      }
+    // a packet this old was delivered or dropped by now
+    double now = Simulator::Now ().GetSeconds ();
+    while (!m_uidTimes.empty () && m_uidTimes.front ().first < now - m_packetLifetime)
+      {
+        m_uids.erase (m_uidTimes.front ().second);
+        m_uidTimes.pop_front ();
+      }
+    m_uids.insert (packet->GetUid ());
+    m_uidTimes.push_back (std::make_pair (now, packet->GetUid ()));
+  }
+
+  /// Write the nodes and follow their positions and Wi-Fi frames
+  void Attach (NodeContainer nodes)
+  {
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        Ptr<Node> node = *i;
+        Ptr<MobilityModel> model = node->GetObject<MobilityModel> ();
+        Ptr<NodeProbe> probe = Create<NodeProbe> (this, node->GetId ());
+        m_probes.push_back (probe);
+        Vector position = model ? model->GetPosition () : Vector ();
+        std::fprintf (m_file, "<node id=\"%u\" sysId=\"0\" locX=\"%.2f\" locY=\"%.2f\" />\n",
+                      node->GetId (), position.x, position.y);
+        if (model)
+          {
+            Remember (node->GetId (), position);
+            m_models.push_back (std::make_pair (node->GetId (), model));
+            model->TraceConnectWithoutContext ("CourseChange", MakeCallback (&NodeProbe::CourseChange, PeekPointer (probe)));
+          }
+        for (uint32_t d = 0; d < node->GetNDevices (); d++)
+          {
+            Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice> (node->GetDevice (d));
+            if (!device)
+              {
+                continue;
+              }
+            probe->phy = device->GetPhy ();
+            probe->phy->TraceConnectWithoutContext ("MonitorSnifferTx", MakeCallback (&NodeProbe::Tx, PeekPointer (probe)));
+            probe->phy->TraceConnectWithoutContext ("MonitorSnifferRx", MakeCallback (&NodeProbe::Rx, PeekPointer (probe)));
+          }
+      }
+    if (m_pollInterval > 0 && !m_poll.IsRunning ())
+      {
+        m_poll = Simulator::Schedule (Seconds (m_pollInterval), &AnimStream::Poll, this);
+      }
+  }
+
+  /// Finish the document and close the file; later events are ignored
+  void Close ()
+  {
+    m_poll.Cancel ();
+    if (!m_file)
+      {
+        return;
+      }
+    std::fprintf (m_file, "</anim>\n");
+    if (m_pipe)
+      {
+        pclose (m_file);
+      }
+    else
+      {
+        std::fclose (m_file);
+      }
+    m_file = 0;
+    m_models.clear ();
+  }
+
+  /// Print what was written and what sampling left out
+  void PrintStats (std::ostream &os) const
+  {
+    os << "Animation " << m_fileName << ": " << m_positions << " positions (" << m_skippedPositions
+       << " sampled out), " << m_packets << " frames with " << m_receptions << " receptions ("
+       << m_skippedFrames << " frames sampled out)\n";
+  }
+
+private:
+  class NodeProbe : public SimpleRefCount<NodeProbe>
+  {
+  public:
+    NodeProbe (AnimStream *stream, uint32_t node) : m_stream (stream), m_node (node) {}
+    void CourseChange (Ptr<const MobilityModel> model) { m_stream->Position (m_node, model->GetPosition ()); }
+    void Tx (Ptr<const Packet> packet, uint16_t channelFreqMhz, WifiTxVector txVector, MpduInfo)
+    {
+      m_stream->FrameTx (m_node, packet, phy->CalculateTxDuration (packet->GetSize (), txVector, channelFreqMhz));
+    }
+    void Rx (Ptr<const Packet> packet, uint16_t channelFreqMhz, WifiTxVector txVector, MpduInfo,
+             SignalNoiseDbm)
+    {
+      m_stream->FrameRx (m_node, packet, phy->CalculateTxDuration (packet->GetSize (), txVector, channelFreqMhz));
+    }
+    Ptr<WifiPhy> phy;
+  private:
+    AnimStream *m_stream;
+    uint32_t m_node;
+  };
+
+  class FlowProbe : public SimpleRefCount<FlowProbe>
+  {
+  public:
+    FlowProbe (AnimStream *stream, uint32_t flow) : m_stream (stream), m_flow (flow) {}
+    void Tx (Ptr<const Packet> packet) { m_stream->Tx (m_flow, packet); }
+  private:
+    AnimStream *m_stream;
+    uint32_t m_flow;
+  };
+
+  struct LastPosition
+  {
+    LastPosition () : valid (false), time (0) {}
+    bool valid;
+    double time;
+    Vector position;
+  };
+
+  void Remember (uint32_t node, const Vector &position)
+  {
+    if (node >= m_last.size ())
+      {
+        m_last.resize (node + 1);
+      }
+    m_last[node].valid = true;
+    m_last[node].time = Simulator::Now ().GetSeconds ();
+    m_last[node].position = position;
+  }
+
+  void Position (uint32_t node, const Vector &position)
+  {
+    if (!m_file)
+      {
+        return;
+      }
+    double now = Simulator::Now ().GetSeconds ();
+    if (node < m_last.size () && m_last[node].valid)
+      {
+        const LastPosition &last = m_last[node];
+        double moved = CalculateDistance (position, last.position);
+        bool due = m_minInterval <= 0 || now - last.time >= m_minInterval;
+        bool far = m_minDistance <= 0 ? moved > 0 : moved >= m_minDistance;
+        if (!due || !far)
+          {
+            m_skippedPositions++;
+            return;
+          }
+      }
+    Remember (node, position);
+    std::fprintf (m_file, "<nu p=\"p\" t=\"%.6f\" id=\"%u\" x=\"%.2f\" y=\"%.2f\" />\n", now, node, position.x, position.y);
+    m_positions++;
+  }
+
+  void Poll ()
+  {
+    for (size_t i = 0; i < m_models.size (); i++)
+      {
+        Position (m_models[i].first, m_models[i].second->GetPosition ());
+      }
+    m_poll = Simulator::Schedule (Seconds (m_pollInterval), &AnimStream::Poll, this);
+  }
+
+  bool Wanted (Ptr<const Packet> packet) const
+  {
+    if (!m_flows.empty ())
+      {
+        return m_uids.count (packet->GetUid ()) > 0;
+      }
+    return packet->GetUid () % m_packetSampling == 0;
+  }
+
+  void FrameTx (uint32_t node, Ptr<const Packet> packet, Time duration)
+  {
+    if (!m_file)
+      {
+        return;
+      }
+    if (!Wanted (packet))
+      {
+        m_skippedFrames++;
+        return;
+      }
+    double now = Simulator::Now ().GetSeconds ();
+    std::fprintf (m_file, "<pr uId=\"%" PRIu64 "\" fId=\"%u\" fbTx=\"%.9f\" lbTx=\"%.9f\" />\n",
+                  packet->GetUid (), node, now, now + duration.GetSeconds ());
+    m_packets++;
+  }
+
+  void FrameRx (uint32_t node, Ptr<const Packet> packet, Time duration)
+  {
+    if (!m_file || !Wanted (packet))
+      {
+        return;
+      }
+    double now = Simulator::Now ().GetSeconds ();
+    std::fprintf (m_file, "<wpr uId=\"%" PRIu64 "\" tId=\"%u\" fbRx=\"%.9f\" lbRx=\"%.9f\" />\n",
+                  packet->GetUid (), node, now - duration.GetSeconds (), now);
+    m_receptions++;
+  }
+
+  std::FILE *m_file;
+  bool m_pipe;
+  std::string m_fileName;
+  std::vector<char> m_buffer;
+  double m_minInterval;
+  double m_minDistance;
+  double m_pollInterval;
+  uint32_t m_packetSampling;
+  double m_packetLifetime;
+  std::vector<LastPosition> m_last;
+  std::vector<std::pair<uint32_t, Ptr<MobilityModel> > > m_models;
+  std::vector<Ptr<NodeProbe> > m_probes;
+  std::vector<Ptr<FlowProbe> > m_flowProbes;
+  std::unordered_set<uint32_t> m_flows;
+  std::unordered_set<uint64_t> m_uids;
+  std::deque<std::pair<double, uint64_t> > m_uidTimes;
+  EventId m_poll;
+  uint64_t m_positions;
+  uint64_t m_skippedPositions;
+  uint64_t m_packets;
+  uint64_t m_receptions;
+  uint64_t m_skippedFrames;
+};
+
+} // namespace ns3
+
+#endif /* ANIM_STREAM_H */
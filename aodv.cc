@@ -13,15 +13,38 @@
 #include "ns3/internet-module.h"
 #include "ns3/mobility-module.h"
 #include "ns3/point-to-point-module.h"
-#include "ns3/wifi-module.h" 
+#include "ns3/wifi-module.h"
+#include "ns3/spectrum-module.h"
 #include "ns3/v4ping-helper.h"
 #include <iostream>
 #include <cmath>
 #include "ns3/applications-module.h"
-//#include "ns3/flow-monitor-module.h"
+#include "trace-level.h"
+#include "grid-spectrum-channel.h"
+#include "abstract-link.h"
+#include "propagation-cache.h"
+#include "radix-heap-scheduler.h"
+#include "progress-monitor.h"
+#include "memory-report.h"
+#include "async-trace.h"
+#include "position-logger.h"
+#include "flow-stats.h"
+#include "route-snapshots.h"
+#include "regression-baseline.h"
 
 using namespace ns3;
 
+// The TypeIds of the objects defined in the headers above are registered
+// here, once per program
+NS_OBJECT_ENSURE_REGISTERED (AbstractLinkChannel);
+NS_OBJECT_ENSURE_REGISTERED (PropagationCache);
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationLossModel);
+NS_OBJECT_ENSURE_REGISTERED (CachedPropagationDelayModel);
+NS_OBJECT_ENSURE_REGISTERED (RadixHeapScheduler);
+NS_OBJECT_ENSURE_REGISTERED (GridSpectrumChannel);
+NS_OBJECT_ENSURE_REGISTERED (InstrumentedScheduler);
+NS_OBJECT_ENSURE_REGISTERED (FlowTimestampTag);
+
 /**
  * \brief Test script.
  * 
@@ -41,6 +64,14 @@ public:
   void Run ();
   /// Report results
   void Report (std::ostream & os);
+  /// Set how much trace output Run () produces
+  void SetTraceLevel (TraceLevel level) { traceLevel = level; }
+  /// True if the trace level cost comparison was requested
+  bool TraceLevelReport () const { return traceLevelReport; }
+  /// True if the scenarios are to be checked against (or recorded as) a baseline
+  bool Regression () const { return !regression.empty (); }
+  /// Run the fixed regression scenarios, \return true if none drifted
+  bool RunRegression ();
 
 
 private:
@@ -56,14 +87,89 @@ private:
   bool pcap;
   /// Print routes if true
   bool printRoutes;
+  /// Routing table snapshot interval, seconds; 0 disables them
+  double routeSnapshots;
+  /// Log node positions if true
+  bool positions;
+  /// Binary position log file, read it with position-reader
+  std::string positionLog;
+  /// Position log buffer size, records
+  uint32_t positionBuffer;
+  /// Keep only the newest positionBuffer records instead of flushing
+  bool positionKeepLast;
+  /// Log a node again only after this many seconds (0: every course change)
+  double positionInterval;
+  /// ... or after it moved this far, meters (0: every course change)
+  double positionDistance;
+  /// Amount of trace output, see trace-level.h
+  TraceLevel traceLevel;
+  /// Run once per trace level and report the cost of each
+  bool traceLevelReport;
+  /// Wireless channel, "yans", "spectrum", the spatially indexed "grid" or "abstract" links
+  std::string channel;
+  /// grid channel: reception range, meters
+  double rxRange;
+  /// grid channel: path loss above which receivers are skipped, dB; they get no interference either
+  double lossCutoffDb;
+  /// grid channel: check every lookup against a full scan
+  bool validateChannel;
+  /// Cache path loss and delay per node pair between course changes
+  bool propagationCache;
+  /// propagation cache: how far a pair may have moved before it is recomputed, meters
+  double cacheTolerance;
+  /// Event scheduler: map, heap, list, calendar or radix
+  std::string scheduler;
+  /// Wall-clock seconds between progress reports on stderr, 0 disables
+  double progress;
+  ProgressMonitor progressMonitor;
+  /// Lean-memory mode: no node names and no IPv6 stack
+  bool leanMemory;
+  /// Print the memory taken by each subsystem
+  bool memoryReport;
+  MemoryReport memory;
+  /// Write pcap traces from a background thread
+  bool asyncTraces;
+  /// asyncTraces: buffer for the writer thread, MB, and what to do when it is full
+  uint32_t traceBufferMb;
+  std::string traceOverflow;
+  /// asyncTraces: bytes kept of each frame, and the nodes to trace (empty: all)
+  uint32_t snapLength;
+  std::string traceNodes;
+  AsyncTraceWriter traceWriter;
+  /// Baseline file of the regression scenarios; empty: no regression run
+  std::string regression;
+  /// Write the baseline instead of checking against it
+  bool recordBaseline;
+  /// Relative growth of wall time and peak RSS a regression run tolerates
+  double timeTolerance;
+  double rssTolerance;
+  /// Events of the last run
+  uint64_t events;
 
   // network
+  Ptr<GridSpectrumChannel> gridChannel;
+  Ptr<AbstractLinkChannel> abstractChannel;
+  Ptr<PropagationCache> pairCache;
+  PositionLogger positionLogger;
+  RouteSnapshotter routeSnapshotter;
   NodeContainer nodes;
   NetDeviceContainer devices;
   Ipv4InterfaceContainer interfaces;
-    // flowmonitor doesnt seem to work with AODV
-    //FlowMonitorHelper flowmon;
-    //Ptr<FlowMonitor> monitor ;
+
+  // flow measurement
+  /// A TCP flow measured at the IP layer of its two end nodes
+  struct TcpFlow
+  {
+    Ipv4Address source;
+    Ipv4Address destination;
+    uint16_t port;
+    Ptr<PacketSink> sink;
+    bool sent;                   ///< a data segment was sent
+    SequenceNumber32 highestTx;  ///< end of the highest data sent
+    uint64_t retransmissions;    ///< data segments sent again
+  };
+  std::vector<TcpFlow> flows;
+  FlowStatsEngine flowStats;
 
 
 private:
@@ -71,22 +177,37 @@ private:
   void CreateDevices ();
   void InstallInternetStack ();
   void InstallApplications ();
+  /// Measure the TCP flow from \p source to \p sink
+  void AddTcpFlow (Ptr<Node> source, Ptr<Node> sink, Ptr<PacketSink> app, uint16_t port);
+  /// Return the flow a TCP data segment belongs to, or -1
+  int FindTcpFlow (const Ipv4Header &header, Ptr<const Packet> segment, TcpHeader &tcpHeader) const;
+  void SendOutgoing (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t interface);
+  void LocalDeliver (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t interface);
+  /// Add the results of the last run to \p sample
+  void Measure (RegressionSample &sample) const;
 };
 
-void
-CourseChange (std::string context, Ptr<const MobilityModel> model)
-{
-    Vector position = model->GetPosition ();
-    NS_LOG_UNCOND (context <<
-                   " x = " << position.x << ", y = " << position.y);
-}
-
 int main (int argc, char **argv)
 {
   AodvExample test;
   if (!test.Configure (argc, argv))
     NS_FATAL_ERROR ("Configuration failed. Aborted.");
 
+  if (test.Regression ())
+    {
+      return test.RunRegression () ? 0 : 1;
+    }
+  if (test.TraceLevelReport ())
+    {
+      ReportTraceLevelCost (std::cout, [&] (TraceLevel level)
+        {
+          test.SetTraceLevel (level);
+          test.Run ();
+          test.Report (std::cout);
+        });
+      return 0;
+    }
+
   test.Run ();
   test.Report (std::cout);
   return 0;
@@ -97,8 +218,35 @@ AodvExample::AodvExample () :
   size (25),
   step (100),
   totalTime (10),
-  pcap (true),
-  printRoutes (true)
+  pcap (false),
+  printRoutes (false),
+  routeSnapshots (0),
+  positions (false),
+  positionLog ("aodv.positions"),
+  positionBuffer (65536),
+  positionKeepLast (false),
+  positionInterval (0),
+  positionDistance (0),
+  traceLevel (TRACE_METRICS),
+  traceLevelReport (false),
+  channel ("yans"),
+  rxRange (250),
+  lossCutoffDb (1.0e9),
+  validateChannel (false),
+  propagationCache (false),
+  cacheTolerance (0),
+  scheduler ("map"),
+  progress (0),
+  leanMemory (false),
+  memoryReport (false),
+  asyncTraces (false),
+  traceBufferMb (64),
+  traceOverflow ("block"),
+  snapLength (65535),
+  recordBaseline (false),
+  timeTolerance (0.25),
+  rssTolerance (0.10),
+  events (0)
 {
 }
 
@@ -107,18 +255,51 @@ AodvExample::Configure (int argc, char **argv)
 {
   // Enable AODV logs by default. Comment this if too noisy
   //LogComponentEnable("AodvRoutingProtocol", LOG_LEVEL_ALL);
-    LogComponentEnable("MobilityHelper", LOG_LEVEL_ALL);
 
   SeedManager::SetSeed (12345);
   CommandLine cmd;
 
-  cmd.AddValue ("pcap", "Write PCAP traces.", pcap);
-  cmd.AddValue ("printRoutes", "Print routing table dumps.", printRoutes);
+  std::string level = TraceLevelName (traceLevel);
+  cmd.AddValue ("traceLevel", "Trace output: none|metrics|debug|full.", level);
+  cmd.AddValue ("traceLevelReport", "Run once per trace level and report the cost.", traceLevelReport);
+  cmd.AddValue ("pcap", "Write PCAP traces (implied by traceLevel=full).", pcap);
+  cmd.AddValue ("printRoutes", "Print routing table dumps (implied by traceLevel=debug).", printRoutes);
+  cmd.AddValue ("routeSnapshots", "Snapshot routing tables every this many s into aodv.routes.bin, 0 disables (needs ns-3-routing-table-access.sh).", routeSnapshots);
+  cmd.AddValue ("positions", "Log node positions (implied by traceLevel=debug).", positions);
+  cmd.AddValue ("positionLog", "Binary position log file.", positionLog);
+  cmd.AddValue ("positionBuffer", "Position log buffer size, records.", positionBuffer);
+  cmd.AddValue ("positionKeepLast", "Keep only the last positionBuffer positions.", positionKeepLast);
+  cmd.AddValue ("positionInterval", "Log a node at most every this many s (0: every course change).", positionInterval);
+  cmd.AddValue ("positionDistance", "... or once it moved this many m (0: every course change).", positionDistance);
+  cmd.AddValue ("channel", "Wireless channel: yans (YansWifiPhy), spectrum (SpectrumWifiPhy), grid (SpectrumWifiPhy, spatially indexed) or abstract (lookup-table links, no Wi-Fi PHY).", channel);
+  cmd.AddValue ("rxRange", "grid channel: reception range, m.", rxRange);
+  cmd.AddValue ("lossCutoffDb", "grid channel: skip receivers with a higher path loss, dB; their interference is dropped too.", lossCutoffDb);
+  cmd.AddValue ("validateChannel", "grid channel: check every lookup against a full scan.", validateChannel);
+  cmd.AddValue ("propagationCache", "yans and grid channels: cache path loss and delay per node pair.", propagationCache);
+  cmd.AddValue ("cacheTolerance", "propagationCache: recompute once a pair may have moved this far, m; non-zero changes the results.", cacheTolerance);
+  cmd.AddValue ("scheduler", "Event scheduler: map, heap, list, calendar or radix.", scheduler);
+  cmd.AddValue ("progress", "Report simulated time, event rate, queue size, RSS and events per module every this many wall-clock s (0: off).", progress);
+  cmd.AddValue ("leanMemory", "Save memory per node: no node names and no IPv6 stack.", leanMemory);
+  cmd.AddValue ("memoryReport", "Print the memory taken by nodes, devices, routing, applications, trace sinks and the run.", memoryReport);
+  cmd.AddValue ("asyncTraces", "Write PCAP traces from a background thread.", asyncTraces);
+  cmd.AddValue ("traceBuffer", "asyncTraces: buffer between the simulation and the writer thread, MB.", traceBufferMb);
+  cmd.AddValue ("traceOverflow", "asyncTraces: when the buffer is full, block or drop.", traceOverflow);
+  cmd.AddValue ("snapLength", "asyncTraces: bytes of each frame kept.", snapLength);
+  cmd.AddValue ("traceNodes", "asyncTraces: comma-separated ids of the nodes to trace (default: all).", traceNodes);
+  cmd.AddValue ("regression", "Run the regression scenarios and compare them with this baseline file.", regression);
+  cmd.AddValue ("recordBaseline", "regression: write the baseline file instead of checking against it.", recordBaseline);
+  cmd.AddValue ("timeTolerance", "regression: relative growth of the wall-clock time that still passes.", timeTolerance);
+  cmd.AddValue ("rssTolerance", "regression: relative growth of the peak RSS that still passes.", rssTolerance);
   cmd.AddValue ("size", "Number of nodes.", size);
   cmd.AddValue ("time", "Simulation time, s.", totalTime);
   cmd.AddValue ("step", "Grid step, m", step);
 
   cmd.Parse (argc, argv);
+  traceLevel = ParseTraceLevel (level);
+  if (routeSnapshots > 0 && !RouteSnapshotter::CanSnapshot ("AODV"))
+    {
+      NS_FATAL_ERROR ("routeSnapshots needs the AODV table accessors of ns-3-routing-table-access.sh");
+    }
   return true;
 }
 
@@ -126,65 +307,177 @@ void
 AodvExample::Run ()
 {
 //  Config::SetDefault ("ns3::WifiRemoteStationManager::RtsCtsThreshold", UintegerValue (1)); // enable rts cts all the time.
+  if (traceLevel >= TRACE_FULL)
+    {
+      LogComponentEnable("MobilityHelper", LOG_LEVEL_ALL);
+    }
+  if (progress > 0)
+    {
+      progressMonitor.Start (SchedulerTypeName (scheduler), progress, totalTime, "");
+    }
+  else
+    {
+      SelectScheduler (scheduler);
+    }
+  if (memoryReport)
+    {
+      memory.Reset ();
+    }
+  if (asyncTraces)
+    {
+      traceWriter.Start (uint64_t (traceBufferMb) << 20, AsyncTraceWriter::ParsePolicy (traceOverflow));
+    }
   CreateNodes ();
+  memory.Mark ("nodes");
   CreateDevices ();
+  memory.Mark ("devices");
   InstallInternetStack ();
+  memory.Mark ("routing");
   InstallApplications ();
+  memory.Mark ("applications");
 
   std::cout << "Starting simulation for " << totalTime << " s ...\n";
 
   Simulator::Stop (Seconds (totalTime));
-    
-    std::ostringstream oss;
-  
-    for (int i =0; i<size; i++)
+
+  if (positions || traceLevel >= TRACE_DEBUG)
     {
-        oss.str("");
-        oss << "/NodeList/" << nodes.Get (i)->GetId () << "/$ns3::MobilityModel/CourseChange";
-        Config::Connect (oss.str (), MakeCallback (&CourseChange));
-    
-  //    oss << "/NodeList/" << nodes.Get (1)->GetId () << "/$ns3::MobilityModel/CourseChange";
-  //  Config::Connect (oss.str (), MakeCallback (&CourseChange));
+      positionLogger.Open (positionLog, positionBuffer, positionKeepLast);
+      positionLogger.SetDecimation (positionInterval, positionDistance);
+      positionLogger.Attach (nodes);
     }
+  if (routeSnapshots > 0)
+    {
+      routeSnapshotter.Start (nodes, Seconds (routeSnapshots),
+                              traceLevel >= TRACE_METRICS ? "aodv.routes.bin" : "");
+    }
+  memory.Mark ("trace sinks");
 
+  double runStart = WallClockSeconds ();
   Simulator::Run ();
+  double runSeconds = WallClockSeconds () - runStart;
+  events = Simulator::GetEventCount ();
+  if (progress > 0)
+    {
+      progressMonitor.Stop ();
+    }
+  if (asyncTraces)
+    {
+      traceWriter.Stop ();
+      traceWriter.PrintStats (std::cout);
+    }
+  if (memoryReport)
+    {
+      memory.CountQueues (devices);
+      memory.Mark ("run");
+      memory.PrintStats (std::cout, size);
+    }
+  std::cout << events << " events in " << runSeconds << " s with the " << scheduler
+            << " scheduler (" << (runSeconds > 0 ? events / runSeconds : 0) << " events/s)\n";
+  if (gridChannel)
+    {
+      gridChannel->PrintStats (std::cout);
+    }
+  if (abstractChannel)
+    {
+      abstractChannel->PrintStats (std::cout);
+    }
+  if (pairCache)
+    {
+      pairCache->PrintStats (std::cout);
+    }
+  if (positions || traceLevel >= TRACE_DEBUG)
+    {
+      positionLogger.Close ();
+      std::cout << "Logged " << positionLogger.GetLogged () << " positions to " << positionLog
+                << " (" << positionLogger.GetSkipped () << " decimated)\n";
+    }
+  if (routeSnapshots > 0)
+    {
+      routeSnapshotter.Stop ();
+      routeSnapshotter.PrintStats (std::cout);
+    }
 
-    // Print flow charactristics doesnt seem to work with AODV
-    
-    /*
-    monitor->CheckForLostPackets ();
-    Ptr<Ipv4FlowClassifier> classifier = DynamicCast<Ipv4FlowClassifier> (flowmon.GetClassifier ());
-    FlowMonitor::FlowStatsContainer stats = monitor->GetFlowStats ();
-    for (std::map<FlowId, FlowMonitor::FlowStats>::const_iterator i = stats.begin (); i != stats.end (); ++i)
-    {
-        // first 2 FlowIds are for ECHO apps, we don't want to display them
-        //
-        // Duration for throughput measurement is 9.0 seconds, since
-        //   StartTime of the OnOffApplication is at about "second 1"
-        // and
-        //   Simulator::Stops at "second 10".
-        if (i->first > 0)
+  Simulator::Destroy ();
+}
+
+bool
+AodvExample::RunRegression ()
+{
+  // Every option not set here applies as given, so a run with e.g.
+  // --propagationCache=1 or --scheduler=radix against a baseline recorded
+  // without it shows whether the results stay the same
+  struct Scenario
+  {
+    const char *name;
+    uint32_t size;
+    double step;
+    double totalTime;
+  };
+  static const Scenario scenarios[] = {
+    { "nodes-10", 10, 100, 30 },
+    { "nodes-25", 25, 100, 30 },
+    { "nodes-50", 50, 50, 30 },
+  };
+  RegressionBaseline baseline;
+  baseline.Open (regression, recordBaseline, timeTolerance, rssTolerance);
+  for (size_t i = 0; i < sizeof (scenarios) / sizeof (scenarios[0]); i++)
+    {
+      const Scenario &scenario = scenarios[i];
+      std::cout << "Regression scenario " << scenario.name << "\n";
+      RegressionSample sample = RunIsolated ([&] (RegressionSample &s)
         {
-            Ipv4FlowClassifier::FiveTuple t = classifier->FindFlow (i->first);
-            std::cout << "Flow " << i->first - 2 << " (" << t.sourceAddress << " -> " << t.destinationAddress << ")\n";
-            std::cout << "  Tx Packets: " << i->second.txPackets << "\n";
-            std::cout << "  Tx Bytes:   " << i->second.txBytes << "\n";
-            std::cout << "  TxOffered:  " << i->second.txBytes * 8.0 / 9.0 / 1000 / 1000  << " Mbps\n";
-            std::cout << "  Rx Packets: " << i->second.rxPackets << "\n";
-            std::cout << "  Rx Bytes:   " << i->second.rxBytes << "\n";
-            std::cout << "  Throughput: " << i->second.rxBytes * 8.0 / 9.0 / 1000 / 1000  << " Mbps\n";
-        }
+          size = scenario.size;
+          step = scenario.step;
+          totalTime = scenario.totalTime;
+          Run ();
+          Measure (s);
+        });
+      baseline.Check (scenario.name, sample);
+    }
+  return baseline.Finish (std::cout);
+}
+
+void
+AodvExample::Measure (RegressionSample &sample) const
+{
+  sample.Add ("events", events);
+  for (uint32_t i = 0; i < flows.size (); i++)
+    {
+      const FlowRecord &f = flowStats.GetFlow (i);
+      std::string flow = "flow" + std::to_string (i) + ".";
+      sample.Add (flow + "dataSegments", f.txPackets);
+      sample.Add (flow + "delivered", f.rxPackets);
+      sample.Add (flow + "goodputBytes", flows[i].sink->GetTotalRx ());
+      sample.Add (flow + "retransmissions", flows[i].retransmissions);
+      sample.Add (flow + "delayMean", f.delay.GetMean ());
+      sample.Add (flow + "delayMax", f.delay.GetMax ());
+      sample.Add (flow + "delayP99", f.latency.GetPercentile (0.99));
+      sample.Add (flow + "jitter", f.jitter.GetMean ());
     }
-     */
-  
-    
-    
-  Simulator::Destroy ();
 }
 
 void
-AodvExample::Report (std::ostream &)
-{ 
+AodvExample::Report (std::ostream & os)
+{
+  for (uint32_t i = 0; i < flows.size (); i++)
+    {
+      const TcpFlow &flow = flows[i];
+      const FlowRecord &f = flowStats.GetFlow (i);
+      double window = f.GetWindow ().GetSeconds ();
+      uint64_t dataSegments = f.txPackets;
+      os << "Flow " << i << " (" << flow.source << " -> " << flow.destination << ":" << flow.port << ")\n";
+      os << "  Goodput:          " << (window > 0 ? flow.sink->GetTotalRx () * 8.0 / window / 1000 : 0) << " kbps\n";
+      os << "  Data segments:    " << dataSegments << " sent, " << f.rxPackets << " delivered\n";
+      os << "  Delivery ratio:   " << f.GetDeliveryRatio () << "\n";
+      os << "  Delay:            " << f.delay.GetMean () * 1000 << " ms (min " << f.delay.GetMin () * 1000
+         << ", max " << f.delay.GetMax () * 1000 << ", std dev " << f.delay.GetStdDev () * 1000 << ")\n";
+      os << "  Delay percentiles: p50 " << f.latency.GetPercentile (0.5) * 1000 << " / p90 " << f.latency.GetPercentile (0.9) * 1000
+         << " / p99 " << f.latency.GetPercentile (0.99) * 1000 << " / p99.9 " << f.latency.GetPercentile (0.999) * 1000 << " ms\n";
+      os << "  Jitter:           " << f.jitter.GetMean () * 1000 << " ms\n";
+      os << "  Retransmissions:  " << flow.retransmissions << " ("
+         << (dataSegments ? 100.0 * flow.retransmissions / dataSegments : 0) << "% of data segments)\n";
+    }
 }
 
 void
@@ -192,8 +485,8 @@ AodvExample::CreateNodes ()
 {
   std::cout << "Creating " << (unsigned)size << " nodes " << step << " m apart.\n";
   nodes.Create (size);
-  // Name nodes
-  for (uint32_t i = 0; i < size; ++i)
+  // Name nodes; nothing looks them up, so lean runs do without
+  for (uint32_t i = 0; i < size && !leanMemory; ++i)
     {
       std::ostringstream os;
       os << "node-" << i;
@@ -241,14 +534,80 @@ AodvExample::CreateDevices ()
 {
   WifiMacHelper wifiMac;
   wifiMac.SetType ("ns3::AdhocWifiMac");
-  YansWifiPhyHelper wifiPhy = YansWifiPhyHelper::Default ();
-  YansWifiChannelHelper wifiChannel = YansWifiChannelHelper::Default ();
-  wifiPhy.SetChannel (wifiChannel.Create ());
-  WifiHelper wifi;
-  wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager", "DataMode", StringValue ("OfdmRate6Mbps"), "RtsCtsThreshold", UintegerValue (0));
-  devices = wifi.Install (wifiPhy, wifiMac, nodes); 
+  YansWifiPhyHelper yansPhy = YansWifiPhyHelper::Default ();
+  SpectrumWifiPhyHelper spectrumPhy = SpectrumWifiPhyHelper::Default ();
+  // the models of YansWifiChannelHelper::Default ()
+  Ptr<PropagationLossModel> loss = CreateObject<LogDistancePropagationLossModel> ();
+  Ptr<PropagationDelayModel> delay = CreateObject<ConstantSpeedPropagationDelayModel> ();
+  if (propagationCache && channel != "abstract")
+    {
+      pairCache = CreateObject<PropagationCache> ();
+      pairCache->SetAttribute ("Tolerance", DoubleValue (cacheTolerance));
+      loss = pairCache->CacheLoss (loss);
+      delay = pairCache->CacheDelay (delay);
+    }
+  if (channel == "yans")
+    {
+      Ptr<YansWifiChannel> yansChannel = CreateObject<YansWifiChannel> ();
+      yansChannel->SetPropagationLossModel (loss);
+      yansChannel->SetPropagationDelayModel (delay);
+      yansPhy.SetChannel (yansChannel);
+    }
+  else if (channel == "spectrum")
+    {
+      // the PHY of the grid channel without its index or cutoffs, to tell
+      // the effect of the index from that of the PHY
+      Ptr<MultiModelSpectrumChannel> spectrumChannel = CreateObject<MultiModelSpectrumChannel> ();
+      spectrumChannel->SetPropagationDelayModel (delay);
+      spectrumChannel->AddPropagationLossModel (loss);
+      spectrumPhy.SetChannel (spectrumChannel);
+    }
+  else if (channel == "grid")
+    {
+      // a SpectrumWifiPhy, unlike yans; compare with --channel=spectrum to
+      // see what the index and the cutoffs change
+      gridChannel = CreateObject<GridSpectrumChannel> ();
+      gridChannel->SetAttribute ("ReceptionRange", DoubleValue (rxRange));
+      gridChannel->SetAttribute ("LossCutoffDb", DoubleValue (lossCutoffDb));
+      gridChannel->SetAttribute ("Validate", BooleanValue (validateChannel));
+      gridChannel->SetPropagationDelayModel (delay);
+      gridChannel->AddPropagationLossModel (loss);
+      spectrumPhy.SetChannel (gridChannel);
+    }
+  else if (channel == "abstract")
+    {
+      // calibrated for the default PHY transmit power, the data mode below
+      // and the loss model above
+      TypeId::AttributeInformation txPower;
+      TypeId::LookupByName ("ns3::WifiPhy").LookupAttributeByName ("TxPowerStart", &txPower);
+      abstractChannel = CreateObject<AbstractLinkChannel> ();
+      abstractChannel->Calibrate (loss, WifiMode ("OfdmRate6Mbps"),
+                                  DynamicCast<const DoubleValue> (txPower.initialValue)->Get ());
+    }
+  else
+    {
+      NS_FATAL_ERROR ("No such channel: " << channel);
+    }
+  bool spectrum = gridChannel || channel == "spectrum";
+  WifiPhyHelper &wifiPhy = spectrum ? static_cast<WifiPhyHelper &> (spectrumPhy) : static_cast<WifiPhyHelper &> (yansPhy);
+  if (abstractChannel)
+    {
+      SimpleNetDeviceHelper simple;
+      simple.SetDeviceAttribute ("DataRate", DataRateValue (abstractChannel->GetDataRate ()));
+      devices = simple.Install (nodes, abstractChannel);
+    }
+  else
+    {
+      WifiHelper wifi;
+      wifi.SetRemoteStationManager ("ns3::ConstantRateWifiManager", "DataMode", StringValue ("OfdmRate6Mbps"), "RtsCtsThreshold", UintegerValue (0));
+      devices = wifi.Install (wifiPhy, wifiMac, nodes);
+    }
 
-  if (pcap)
+  if ((pcap || traceLevel >= TRACE_FULL) && asyncTraces)
+    {
+      traceWriter.EnablePcap ("aodv", TracedNodes (traceNodes, nodes), snapLength);
+    }
+  else if (pcap || traceLevel >= TRACE_FULL)
     {
       wifiPhy.EnablePcapAll (std::string ("aodv"));
     }
@@ -261,12 +620,13 @@ AodvExample::InstallInternetStack ()
   // you can configure AODV attributes here using aodv.Set(name, value)
   InternetStackHelper stack;
   stack.SetRoutingHelper (aodv); // has effect on the next Install ()
+  stack.SetIpv6StackInstall (!leanMemory);
   stack.Install (nodes);
   Ipv4AddressHelper address;
   address.SetBase ("10.0.0.0", "255.0.0.0");
   interfaces = address.Assign (devices);
 
-  if (printRoutes)
+  if (printRoutes || traceLevel >= TRACE_DEBUG)
     {
       Ptr<OutputStreamWrapper> routingStream = Create<OutputStreamWrapper> ("aodv.routes", std::ios::out);
       aodv.PrintRoutingTableAllAt (Seconds (8), routingStream);
@@ -305,11 +665,11 @@ AodvExample::InstallApplications ()
     
     ApplicationContainer sourceApps;
     sourceApps.Add (onOffHelper.Install (nodes.Get(1)));
-    
-    // 8. Install FlowMonitor on all nodes
-    // Flowmonitor doesn't seem to work with AODV type protocols
-    //Ptr<FlowMonitor> monitor = flowmon.InstallAll ();
-    
+
+    flows.clear ();
+    AddTcpFlow (nodes.Get (1), nodes.Get (0), DynamicCast<PacketSink> (sinkApps.Get (0)), sinkPort);
+    flowStats.Setup (flows.size ());
+
     sourceApps.Start (Seconds (0));
     sourceApps.Stop (Seconds (totalTime)-Seconds (0.001));
 
@@ -320,3 +680,79 @@ AodvExample::InstallApplications ()
   Simulator::Schedule (Seconds (totalTime/3), &MobilityModel::SetPosition, mob, Vector (5e3, 5e3, 5e3));
 }
 
+
+void
+AodvExample::AddTcpFlow (Ptr<Node> source, Ptr<Node> sink, Ptr<PacketSink> app, uint16_t port)
+{
+  TcpFlow flow;
+  flow.source = source->GetObject<Ipv4> ()->GetAddress (1, 0).GetLocal ();
+  flow.destination = sink->GetObject<Ipv4> ()->GetAddress (1, 0).GetLocal ();
+  flow.port = port;
+  flow.sink = app;
+  flow.sent = false;
+  flow.retransmissions = 0;
+  flows.push_back (flow);
+
+  // Hook the IP layer of both ends directly: every segment TCP sends,
+  // retransmissions included, passes SendOutgoing once even when AODV has
+  // to buffer it during route discovery, and forwarding nodes are not
+  // involved at all.
+  source->GetObject<Ipv4L3Protocol> ()->TraceConnectWithoutContext ("SendOutgoing", MakeCallback (&AodvExample::SendOutgoing, this));
+  sink->GetObject<Ipv4L3Protocol> ()->TraceConnectWithoutContext ("LocalDeliver", MakeCallback (&AodvExample::LocalDeliver, this));
+}
+
+int
+AodvExample::FindTcpFlow (const Ipv4Header &header, Ptr<const Packet> segment, TcpHeader &tcpHeader) const
+{
+  if (header.GetProtocol () != TcpL4Protocol::PROT_NUMBER)
+    {
+      return -1;
+    }
+  segment->PeekHeader (tcpHeader);
+  if (segment->GetSize () <= tcpHeader.GetSerializedSize ())
+    {
+      return -1; // SYN, FIN or pure ACK
+    }
+  for (uint32_t i = 0; i < flows.size (); i++)
+    {
+      if (flows[i].source == header.GetSource () && flows[i].destination == header.GetDestination ()
+          && flows[i].port == tcpHeader.GetDestinationPort ())
+        {
+          return i;
+        }
+    }
+  return -1;
+}
+
+void
+AodvExample::SendOutgoing (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t)
+{
+  TcpHeader tcpHeader;
+  int i = FindTcpFlow (header, packet, tcpHeader);
+  if (i < 0)
+    {
+      return;
+    }
+  TcpFlow &flow = flows[i];
+  SequenceNumber32 end = tcpHeader.GetSequenceNumber () + (packet->GetSize () - tcpHeader.GetSerializedSize ());
+  if (flow.sent && tcpHeader.GetSequenceNumber () < flow.highestTx)
+    {
+      flow.retransmissions++;
+    }
+  if (!flow.sent || end > flow.highestTx)
+    {
+      flow.highestTx = end;
+    }
+  flow.sent = true;
+  flowStats.Tx (i, packet);
+}
+
+void
+AodvExample::LocalDeliver (const Ipv4Header &header, Ptr<const Packet> packet, uint32_t)
+{
+  TcpHeader tcpHeader;
+  if (FindTcpFlow (header, packet, tcpHeader) >= 0)
+    {
+      flowStats.Rx (packet);
+    }
+}
@@ -0,0 +1,491 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Trace files written by a background thread, shared by adhoc_routing.cc
+ * and aodv.cc.
+ *
+ * The pcap and mobility ASCII helpers of ns-3 write from inside the event
+ * handlers, so a slow disk slows down the simulation.  AsyncTraceWriter
+ * gives the simulation thread a single-producer, single-consumer ring of
+ * bytes: a trace sink only copies its record into the ring and moves the
+ * head; a writer thread takes the records out, in order, and leaves them to
+ * stdio buffers of a megabyte per file.  Neither side takes a lock.  Files
+ * are opened through the ring as well, so the writer thread owns all of
+ * them.
+ *
+ * The ring has a fixed size.  When the disk falls behind by more than that,
+ * the simulation either waits for room (Block) or drops the record and
+ * counts it (Drop).
+ *
+ * EnablePcap () writes one DLT_IEEE802_11 file per Wi-Fi device, as
+ * WifiPhyHelper::EnablePcap does, with frames cut to a snap length;
+ * EnableMobilityAscii () writes the course change lines of
+ * MobilityHelper::EnableAsciiAll.  Both take the nodes to trace, so
+ * capture can be limited to some of them.
+ */
+
+#ifndef ASYNC_TRACE_H
+#define ASYNC_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ns3/callback.h"
+#include "ns3/fatal-error.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/node-list.h"
+#include "ns3/packet.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+
+namespace ns3 {
+
+class AsyncTraceWriter
+{
+public:
+  enum Policy
+  {
+    BLOCK,
+    DROP
+  };
+
+  /// "block" or "drop"
+  static Policy ParsePolicy (const std::string &name)
+  {
+    if (name == "block")
+      {
+        return BLOCK;
+      }
+    if (name == "drop")
+      {
+        return DROP;
+      }
+    NS_FATAL_ERROR ("Unknown trace overflow policy \"" << name << "\"; use block or drop");
+    return BLOCK;
+  }
+
+  AsyncTraceWriter ()
+    : m_policy (BLOCK),
+      m_head (0),
+      m_tail (0),
+      m_running (false),
+      m_nFiles (0),
+      m_records (0),
+      m_bytes (0),
+      m_dropped (0),
+      m_waits (0),
+      m_peak (0)
+  {
+  }
+
+  ~AsyncTraceWriter ()
+  {
+    Stop ();
+  }
+
+  /// Start the writer thread with a ring of \p bufferBytes (rounded up to a power of two)
+  void Start (uint64_t bufferBytes, Policy policy)
+  {
+    Stop ();
+    uint64_t size = 4096;
+    while (size < bufferBytes)
+      {
+        size <<= 1;
+      }
+    m_ring.assign (size, 0);
+    m_policy = policy;
+    m_head.store (0);
+    m_tail.store (0);
+    m_nFiles = 0;
+    m_records = 0;
+    m_bytes = 0;
+    m_dropped = 0;
+    m_waits = 0;
+    m_peak = 0;
+    m_probes.clear ();
+    m_connections.clear ();
+    m_running.store (true);
+    m_thread = std::thread (&AsyncTraceWriter::Drain, this);
+  }
+
+  /// Write out everything queued, close the files and end the thread
+  void Stop ()
+  {
+    if (!m_thread.joinable ())
+      {
+        return;
+      }
+    m_running.store (false);
+    m_thread.join ();
+    // the trace sources hold raw pointers to the probes
+    for (size_t i = 0; i < m_connections.size (); i++)
+      {
+        m_connections[i].source->TraceDisconnectWithoutContext (m_connections[i].name, m_connections[i].callback);
+      }
+    m_connections.clear ();
+    m_probes.clear ();
+  }
+
+  bool IsRunning () const { return m_thread.joinable (); }
+
+  /// Open \p fileName for writing; returns its handle for Write ()
+  uint32_t Open (const std::string &fileName)
+  {
+    Put (m_nFiles, OPEN, fileName.data (), fileName.size (), 0, 0, true);
+    return m_nFiles++;
+  }
+
+  /// Append \p length bytes of \p data, then \p length2 bytes of \p data2, to \p file
+  void Write (uint32_t file, const void *data, uint32_t length, const void *data2 = 0, uint32_t length2 = 0)
+  {
+    Put (file, DATA, data, length, data2, length2, m_policy == BLOCK);
+  }
+
+  /// Write a pcap file for each Wi-Fi device of \p nodes, named <prefix>-<node>-<device>.pcap
+  void EnablePcap (const std::string &prefix, NodeContainer nodes, uint32_t snapLength)
+  {
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        for (uint32_t d = 0; d < (*i)->GetNDevices (); d++)
+          {
+            Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice> ((*i)->GetDevice (d));
+            if (!device)
+              {
+                continue;
+              }
+            std::string name = prefix + "-" + std::to_string ((*i)->GetId ()) + "-" + std::to_string (d) + ".pcap";
+            uint32_t file = Open (name);
+            PcapFileHeader header;
+            header.snapLength = snapLength;
+            Write (file, &header, sizeof (header));
+            Ptr<PcapProbe> probe = Create<PcapProbe> (this, file, snapLength);
+            m_probes.push_back (probe);
+            Connect (device->GetPhy (), "MonitorSnifferTx", MakeCallback (&PcapProbe::Tx, PeekPointer (probe)));
+            Connect (device->GetPhy (), "MonitorSnifferRx", MakeCallback (&PcapProbe::Rx, PeekPointer (probe)));
+          }
+      }
+  }
+
+  /// Write a line to \p fileName on every course change of \p nodes
+  void EnableMobilityAscii (const std::string &fileName, NodeContainer nodes)
+  {
+    uint32_t file = Open (fileName);
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        Ptr<MobilityModel> model = (*i)->GetObject<MobilityModel> ();
+        if (!model)
+          {
+            continue;
+          }
+        Ptr<MobilityProbe> probe = Create<MobilityProbe> (this, file, (*i)->GetId ());
+        m_probes.push_back (probe);
+        Connect (model, "CourseChange", MakeCallback (&MobilityProbe::CourseChange, PeekPointer (probe)));
+      }
+  }
+
+  /// Print the records and bytes written, the drops and how often the simulation had to wait
+  void PrintStats (std::ostream &os) const
+  {
+    os << "Async traces: " << m_nFiles << " files, " << m_records << " records, " << m_bytes << " bytes, "
+       << m_dropped << " dropped, " << m_waits << " waits for the writer, peak buffer "
+       << m_peak / 1024 << " of " << m_ring.size () / 1024 << " kB\n";
+  }
+
+private:
+  enum Kind
+  {
+    OPEN,
+    DATA
+  };
+
+  struct RecordHeader
+  {
+    uint32_t file;
+    uint32_t kind;
+    uint64_t length;
+  };
+
+  struct PcapFileHeader
+  {
+    PcapFileHeader ()
+      : magic (0xa1b2c3d4), versionMajor (2), versionMinor (4), zone (0), sigFigs (0),
+        snapLength (65535), dataLinkType (105) {}   // DLT_IEEE802_11
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t zone;
+    uint32_t sigFigs;
+    uint32_t snapLength;
+    uint32_t dataLinkType;
+  };
+
+  struct PcapRecordHeader
+  {
+    uint32_t seconds;
+    uint32_t microseconds;
+    uint32_t includedLength;
+    uint32_t originalLength;
+  };
+
+  class Probe : public SimpleRefCount<Probe>
+  {
+  public:
+    virtual ~Probe () {}
+  };
+
+  class PcapProbe : public Probe
+  {
+  public:
+    PcapProbe (AsyncTraceWriter *writer, uint32_t file, uint32_t snapLength)
+      : m_writer (writer), m_file (file), m_snapLength (snapLength) {}
+    void Tx (Ptr<const Packet> packet, uint16_t, WifiTxVector, MpduInfo)
+    {
+      Capture (packet);
+    }
+    void Rx (Ptr<const Packet> packet, uint16_t, WifiTxVector, MpduInfo, SignalNoiseDbm)
+    {
+      Capture (packet);
+    }
+  private:
+    void Capture (Ptr<const Packet> packet)
+    {
+      uint64_t us = Simulator::Now ().GetMicroSeconds ();
+      PcapRecordHeader header;
+      header.seconds = us / 1000000;
+      header.microseconds = us % 1000000;
+      header.originalLength = packet->GetSize ();
+      header.includedLength = std::min (header.originalLength, m_snapLength);
+      if (m_data.size () < header.includedLength)
+        {
+          m_data.resize (header.includedLength);
+        }
+      packet->CopyData (m_data.data (), header.includedLength);
+      m_writer->Write (m_file, &header, sizeof (header), m_data.data (), header.includedLength);
+    }
+    AsyncTraceWriter *m_writer;
+    uint32_t m_file;
+    uint32_t m_snapLength;
+    std::vector<uint8_t> m_data;
+  };
+
+  class MobilityProbe : public Probe
+  {
+  public:
+    MobilityProbe (AsyncTraceWriter *writer, uint32_t file, uint32_t node)
+      : m_writer (writer), m_file (file), m_node (node) {}
+    void CourseChange (Ptr<const MobilityModel> model)
+    {
+      Vector pos = model->GetPosition ();
+      Vector vel = model->GetVelocity ();
+      char line[256];
+      int length = std::snprintf (line, sizeof (line),
+                                  "now=+%" PRId64 "ns node=%u pos=%.3f:%.3f:%.3f vel=%.3f:%.3f:%.3f\n",
+                                  Simulator::Now ().GetNanoSeconds (), m_node, pos.x, pos.y, pos.z,
+                                  vel.x, vel.y, vel.z);
+      m_writer->Write (m_file, line, std::min<int> (length, sizeof (line) - 1));
+    }
+  private:
+    AsyncTraceWriter *m_writer;
+    uint32_t m_file;
+    uint32_t m_node;
+  };
+
+  /// A probe callback connected to a trace source, to be disconnected in Stop ()
+  struct Connection
+  {
+    Ptr<Object> source;
+    std::string name;
+    CallbackBase callback;
+  };
+
+  void Connect (Ptr<Object> source, const std::string &name, const CallbackBase &callback)
+  {
+    source->TraceConnectWithoutContext (name, callback);
+    Connection c;
+    c.source = source;
+    c.name = name;
+    c.callback = callback;
+    m_connections.push_back (c);
+  }
+
+  void Copy (uint64_t at, const void *data, uint64_t length)
+  {
+    uint64_t mask = m_ring.size () - 1;
+    uint64_t offset = at & mask;
+    uint64_t first = std::min (length, m_ring.size () - offset);
+    std::memcpy (&m_ring[offset], data, first);
+    std::memcpy (&m_ring[0], static_cast<const uint8_t *> (data) + first, length - first);
+  }
+
+  void Put (uint32_t file, Kind kind, const void *data, uint64_t length, const void *data2, uint64_t length2,
+            bool wait)
+  {
+    NS_ASSERT_MSG (IsRunning (), "AsyncTraceWriter used before Start ()");
+    RecordHeader header;
+    header.file = file;
+    header.kind = kind;
+    header.length = length + length2;
+    uint64_t need = sizeof (header) + header.length;
+    if (need > m_ring.size ())
+      {
+        NS_FATAL_ERROR ("Trace record of " << need << " bytes does not fit the " << m_ring.size () << " byte buffer");
+      }
+    uint64_t head = m_head.load (std::memory_order_relaxed);
+    if (m_ring.size () - (head - m_tail.load (std::memory_order_acquire)) < need)
+      {
+        if (!wait)
+          {
+            m_dropped++;
+            return;
+          }
+        m_waits++;
+        while (m_ring.size () - (head - m_tail.load (std::memory_order_acquire)) < need)
+          {
+            std::this_thread::yield ();
+          }
+      }
+    Copy (head, &header, sizeof (header));
+    Copy (head + sizeof (header), data, length);
+    if (length2 > 0)
+      {
+        Copy (head + sizeof (header) + length, data2, length2);
+      }
+    m_head.store (head + need, std::memory_order_release);
+    m_records++;
+    m_bytes += header.length;
+    m_peak = std::max (m_peak, head + need - m_tail.load (std::memory_order_relaxed));
+  }
+
+  /// Writer thread: the only reader of the ring and the only user of the files
+  void Drain ()
+  {
+    std::vector<std::FILE *> files;
+    std::vector<std::vector<char> > buffers;
+    std::vector<uint8_t> record;
+    while (true)
+      {
+        // read m_running first: whatever was queued before it went false
+        // is seen by the load of m_head below
+        bool running = m_running.load (std::memory_order_acquire);
+        uint64_t tail = m_tail.load (std::memory_order_relaxed);
+        uint64_t head = m_head.load (std::memory_order_acquire);
+        if (tail == head)
+          {
+            if (!running)
+              {
+                break;
+              }
+            std::this_thread::sleep_for (std::chrono::microseconds (500));
+            continue;
+          }
+        while (tail != head)
+          {
+            RecordHeader header;
+            Take (tail, &header, sizeof (header));
+            if (record.size () < header.length)
+              {
+                record.resize (header.length);
+              }
+            Take (tail + sizeof (header), record.data (), header.length);
+            tail += sizeof (header) + header.length;
+            m_tail.store (tail, std::memory_order_release);
+            if (header.kind == OPEN)
+              {
+                std::string name (reinterpret_cast<char *> (record.data ()), header.length);
+                if (files.size () <= header.file)
+                  {
+                    files.resize (header.file + 1, 0);
+                    buffers.resize (header.file + 1);
+                  }
+                files[header.file] = std::fopen (name.c_str (), "wb");
+                if (!files[header.file])
+                  {
+                    NS_FATAL_ERROR ("Cannot open trace file " << name);
+                  }
+                buffers[header.file].resize (1 << 20);
+                setvbuf (files[header.file], &buffers[header.file][0], _IOFBF, buffers[header.file].size ());
+              }
+            else
+              {
+                std::fwrite (record.data (), 1, header.length, files[header.file]);
+              }
+          }
+      }
+    for (size_t i = 0; i < files.size (); i++)
+      {
+        if (files[i])
+          {
+            std::fclose (files[i]);
+          }
+      }
+  }
+
+  void Take (uint64_t at, void *data, uint64_t length) const
+  {
+    uint64_t mask = m_ring.size () - 1;
+    uint64_t offset = at & mask;
+    uint64_t first = std::min (length, m_ring.size () - offset);
+    std::memcpy (data, &m_ring[offset], first);
+    std::memcpy (static_cast<uint8_t *> (data) + first, &m_ring[0], length - first);
+  }
+
+  std::vector<uint8_t> m_ring;
+  Policy m_policy;
+  std::atomic<uint64_t> m_head;   ///< bytes ever queued; written by the simulation only
+  std::atomic<uint64_t> m_tail;   ///< bytes ever written out; written by the writer thread only
+  std::atomic<bool> m_running;
+  std::thread m_thread;
+  std::vector<Ptr<Probe> > m_probes;
+  std::vector<Connection> m_connections;
+
+  // simulation thread only
+  uint32_t m_nFiles;
+  uint64_t m_records;
+  uint64_t m_bytes;
+  uint64_t m_dropped;
+  uint64_t m_waits;
+  uint64_t m_peak;
+};
+
+/// The nodes with the comma-separated ids in \p ids, or \p all if it is empty
+inline NodeContainer
+TracedNodes (const std::string &ids, NodeContainer all)
+{
+  if (ids.empty ())
+    {
+      return all;
+    }
+  NodeContainer nodes;
+  size_t start = 0;
+  while (start <= ids.size ())
+    {
+      size_t end = std::min (ids.find (',', start), ids.size ());
+      std::string item = ids.substr (start, end - start);
+      if (item.empty () || item.find_first_not_of ("0123456789") != std::string::npos
+          || item.size () > 9)
+        {
+          NS_FATAL_ERROR ("traceNodes entry \"" << item << "\" is not a node id");
+        }
+      uint32_t id = std::stoul (item);
+      if (id >= NodeList::GetNNodes ())
+        {
+          NS_FATAL_ERROR ("No node " << id << " to trace");
+        }
+      nodes.Add (NodeList::GetNode (id));
+      start = end + 1;
+    }
+  return nodes;
+}
+
+} // namespace ns3
+
+#endif /* ASYNC_TRACE_H */
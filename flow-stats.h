@@ -0,0 +1,375 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Streaming per-flow statistics.
+ *
+ * Every packet a source sends is counted and stamped with a FlowTimestampTag
+ * (flow index and send time).  The receive path reads the tag back, so
+ * throughput, delivery ratio and delay are accumulated while the simulation
+ * runs instead of being reconstructed from FlowMonitor afterwards.  All
+ * counters are 64 bit and delays go through Welford's online algorithm, so
+ * long runs neither overflow nor lose precision.  Each flow also keeps a
+ * log-bucketed delay histogram for percentiles and the mean delay variation
+ * between consecutive packets (jitter).
+ */
+
+#ifndef FLOW_STATS_H
+#define FLOW_STATS_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "ns3/callback.h"
+#include "ns3/nstime.h"
+#include "ns3/packet.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+#include "ns3/tag.h"
+
+namespace ns3 {
+
+/**
+ * Numerically stable running mean and variance (Welford), mergeable with
+ * Chan's formula so results from separate processes combine exactly.
+ */
+class OnlineStats
+{
+public:
+  OnlineStats ()
+    : m_count (0),
+      m_mean (0),
+      m_m2 (0),
+      m_min (std::numeric_limits<double>::infinity ()),
+      m_max (-std::numeric_limits<double>::infinity ())
+  {
+  }
+
+  void Add (double x)
+  {
+    m_count++;
+    double delta = x - m_mean;
+    m_mean += delta / m_count;
+    m_m2 += delta * (x - m_mean);
+    m_min = std::min (m_min, x);
+    m_max = std::max (m_max, x);
+  }
+
+  void Merge (const OnlineStats &o)
+  {
+    if (o.m_count == 0)
+      {
+        return;
+      }
+    uint64_t n = m_count + o.m_count;
+    double delta = o.m_mean - m_mean;
+    m_m2 += o.m_m2 + delta * delta * m_count * o.m_count / n;
+    m_mean += delta * o.m_count / n;
+    m_count = n;
+    m_min = std::min (m_min, o.m_min);
+    m_max = std::max (m_max, o.m_max);
+  }
+
+  uint64_t GetCount () const { return m_count; }
+  double GetMean () const { return m_mean; }
+  double GetMin () const { return m_count ? m_min : 0; }
+  double GetMax () const { return m_count ? m_max : 0; }
+  double GetVariance () const { return m_count > 1 ? m_m2 / (m_count - 1) : 0; }
+  double GetStdDev () const { return std::sqrt (GetVariance ()); }
+
+  /// Half-width of the 95% confidence interval of the mean (Student t)
+  double GetConfidenceHalfWidth () const
+  {
+    if (m_count < 2)
+      {
+        return 0;
+      }
+    static const double t975[] = {
+      12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+      2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+      2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    uint64_t df = m_count - 1;
+    double t = df <= 30 ? t975[df - 1] : (df <= 60 ? 2.000 : (df <= 120 ? 1.980 : 1.960));
+    return t * GetStdDev () / std::sqrt (static_cast<double> (m_count));
+  }
+
+private:
+  uint64_t m_count;
+  double m_mean;
+  double m_m2;
+  double m_min;
+  double m_max;
+};
+
+/**
+ * Fixed-size histogram of delays with logarithmic buckets.
+ *
+ * Delays are counted in microseconds.  Below 32 us every value has its own
+ * bucket; above, each power of two is split into 32 buckets, so a bucket is
+ * at most 1/32 (3%) of its value wide.  864 buckets reach past 2^30 us
+ * (about 18 minutes); longer delays land in the last one.  The class is
+ * plain data, so it can be sent through a pipe, and two histograms merge
+ * exactly by adding their buckets.
+ */
+class LatencyHistogram
+{
+public:
+  static const int SUB_BUCKETS_BITS = 5;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKETS_BITS;
+  static const int N_BUCKETS = 27 * SUB_BUCKETS;
+
+  LatencyHistogram ()
+    : m_count (0),
+      m_sum (0),
+      m_min (0),
+      m_max (0)
+  {
+    std::fill (m_buckets, m_buckets + N_BUCKETS, 0);
+  }
+
+  void Add (Time delay)
+  {
+    int64_t us = delay.GetMicroSeconds ();
+    uint64_t v = us > 0 ? us : 0;
+    m_buckets[std::min (Bucket (v), N_BUCKETS - 1)]++;
+    m_min = m_count ? std::min (m_min, v) : v;
+    m_max = std::max (m_max, v);
+    m_count++;
+    m_sum += v;
+  }
+
+  void Merge (const LatencyHistogram &o)
+  {
+    if (o.m_count == 0)
+      {
+        return;
+      }
+    for (int i = 0; i < N_BUCKETS; i++)
+      {
+        m_buckets[i] += o.m_buckets[i];
+      }
+    m_min = m_count ? std::min (m_min, o.m_min) : o.m_min;
+    m_max = std::max (m_max, o.m_max);
+    m_count += o.m_count;
+    m_sum += o.m_sum;
+  }
+
+  uint64_t GetCount () const { return m_count; }
+  /// Mean delay, s
+  double GetMean () const { return m_count ? m_sum / 1e6 / m_count : 0; }
+
+  /// Delay below which a fraction \p q of the packets stayed, s
+  double GetPercentile (double q) const
+  {
+    if (m_count == 0)
+      {
+        return 0;
+      }
+    uint64_t rank = std::max<uint64_t> (1, std::ceil (q * m_count));
+    uint64_t seen = 0;
+    for (int i = 0; i < N_BUCKETS; i++)
+      {
+        seen += m_buckets[i];
+        if (seen >= rank)
+          {
+            // middle of the bucket, but never outside the values seen
+            double mid = (Lower (i) + Lower (i + 1) - 1) / 2.0;
+            return std::min<double> (std::max<double> (mid, m_min), m_max) / 1e6;
+          }
+      }
+    return m_max / 1e6;
+  }
+
+private:
+  static int Bucket (uint64_t v)
+  {
+    if (v < static_cast<uint64_t> (SUB_BUCKETS))
+      {
+        return v;
+      }
+    int exponent = 63 - __builtin_clzll (v);
+    int shift = exponent - SUB_BUCKETS_BITS;
+    return (shift + 1) * SUB_BUCKETS + (v >> shift) - SUB_BUCKETS;
+  }
+
+  /// Smallest value of bucket \p i
+  static uint64_t Lower (int i)
+  {
+    if (i < SUB_BUCKETS)
+      {
+        return i;
+      }
+    int shift = i / SUB_BUCKETS - 1;
+    return static_cast<uint64_t> (i % SUB_BUCKETS + SUB_BUCKETS) << shift;
+  }
+
+  uint64_t m_count;
+  double m_sum;       ///< us
+  uint64_t m_min;     ///< us
+  uint64_t m_max;     ///< us
+  uint64_t m_buckets[N_BUCKETS];
+};
+
+/// Byte tag carrying the flow index and send time of a packet
+class FlowTimestampTag : public Tag
+{
+public:
+  FlowTimestampTag () : m_flow (0), m_txTime (0) {}
+  FlowTimestampTag (uint32_t flow, Time txTime) : m_flow (flow), m_txTime (txTime.GetTimeStep ()) {}
+
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::FlowTimestampTag")
+      .SetParent<Tag> ()
+      .AddConstructor<FlowTimestampTag> ()
+    ;
+    return tid;
+  }
+  virtual TypeId GetInstanceTypeId (void) const { return GetTypeId (); }
+  virtual uint32_t GetSerializedSize (void) const { return 4 + 8; }
+  virtual void Serialize (TagBuffer i) const
+  {
+    i.WriteU32 (m_flow);
+    i.WriteU64 (m_txTime);
+  }
+  virtual void Deserialize (TagBuffer i)
+  {
+    m_flow = i.ReadU32 ();
+    m_txTime = i.ReadU64 ();
+  }
+  virtual void Print (std::ostream &os) const
+  {
+    os << "flow=" << m_flow << " tx=" << GetTxTime ().GetSeconds ();
+  }
+
+  uint32_t GetFlow (void) const { return m_flow; }
+  Time GetTxTime (void) const { return TimeStep (m_txTime); }
+
+private:
+  uint32_t m_flow;
+  uint64_t m_txTime;
+};
+
+/// Counters of one flow
+struct FlowRecord
+{
+  FlowRecord () : txPackets (0), txBytes (0), rxPackets (0), rxBytes (0), lastDelay (0) {}
+
+  uint64_t txPackets;
+  uint64_t txBytes;
+  uint64_t rxPackets;
+  uint64_t rxBytes;
+  OnlineStats delay;  ///< end-to-end delay of each received packet, s
+  LatencyHistogram latency;
+  OnlineStats jitter; ///< |delay - delay of the previous packet received|, s
+  Time lastDelay;
+  Time firstTx;
+  Time lastRx;
+
+  /// From the first packet sent to the last one received
+  Time GetWindow () const { return rxPackets ? lastRx - firstTx : Time (0); }
+  double GetThroughputKbps () const
+  {
+    double window = GetWindow ().GetSeconds ();
+    return window > 0 ? rxBytes * 8.0 / window / 1000 : 0;
+  }
+  double GetDeliveryRatio () const { return txPackets ? double (rxPackets) / txPackets : 0; }
+};
+
+class FlowStatsEngine
+{
+public:
+  FlowStatsEngine () {}
+
+  /// Forget everything and track flows 0 .. nFlows-1
+  void Setup (uint32_t nFlows)
+  {
+    m_flows.assign (nFlows, FlowRecord ());
+    m_probes.clear ();
+    for (uint32_t i = 0; i < nFlows; i++)
+      {
+        m_probes.push_back (Create<TxProbe> (this, i));
+      }
+  }
+
+  /// Callback for a source's "Tx" trace that counts and stamps flow \p flow
+  Callback<void, Ptr<const Packet> > MakeTxCallback (uint32_t flow)
+  {
+    return MakeCallback (&TxProbe::Tx, PeekPointer (m_probes[flow]));
+  }
+
+  void Tx (uint32_t flow, Ptr<const Packet> packet)
+  {
+    FlowRecord &f = m_flows[flow];
+    if (f.txPackets == 0)
+      {
+        f.firstTx = Simulator::Now ();
+      }
+    f.txPackets++;
+    f.txBytes += packet->GetSize ();
+    packet->AddByteTag (FlowTimestampTag (flow, Simulator::Now ()));
+  }
+
+  /// Account a received packet; returns the flow index or -1 if untagged
+  int Rx (Ptr<const Packet> packet)
+  {
+    int flow = -1;
+    Time now = Simulator::Now ();
+    ByteTagIterator it = packet->GetByteTagIterator ();
+    while (it.HasNext ())
+      {
+        ByteTagIterator::Item item = it.Next ();
+        if (item.GetTypeId () != FlowTimestampTag::GetTypeId ())
+          {
+            continue;
+          }
+        FlowTimestampTag tag;
+        item.GetTag (tag);
+        if (tag.GetFlow () >= m_flows.size ())
+          {
+            continue;
+          }
+        flow = tag.GetFlow ();
+        FlowRecord &f = m_flows[flow];
+        Time delay = now - tag.GetTxTime ();
+        f.delay.Add (delay.GetSeconds ());
+        f.latency.Add (delay);
+        if (f.delay.GetCount () > 1)
+          {
+            f.jitter.Add (Abs (delay - f.lastDelay).GetSeconds ());
+          }
+        f.lastDelay = delay;
+        // one timestamp per packet; a second tag must not count it twice
+        break;
+      }
+    if (flow >= 0)
+      {
+        FlowRecord &f = m_flows[flow];
+        f.rxPackets++;
+        f.rxBytes += packet->GetSize ();
+        f.lastRx = now;
+      }
+    return flow;
+  }
+
+  uint32_t GetNFlows () const { return m_flows.size (); }
+  const FlowRecord &GetFlow (uint32_t flow) const { return m_flows[flow]; }
+
+private:
+  class TxProbe : public SimpleRefCount<TxProbe>
+  {
+  public:
+    TxProbe (FlowStatsEngine *engine, uint32_t flow) : m_engine (engine), m_flow (flow) {}
+    void Tx (Ptr<const Packet> packet) { m_engine->Tx (m_flow, packet); }
+  private:
+    FlowStatsEngine *m_engine;
+    uint32_t m_flow;
+  };
+
+  std::vector<FlowRecord> m_flows;
+  std::vector<Ptr<TxProbe> > m_probes;
+};
+
+} // namespace ns3
+
+#endif /* FLOW_STATS_H */
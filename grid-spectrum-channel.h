@@ -0,0 +1,342 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Spatially indexed wireless channel shared by adhoc_routing.cc and aodv.cc.
+ *
+ * The stock channels hand every frame to every PHY on the channel, so the
+ * cost of a transmission grows with the number of nodes.  This channel keeps
+ * the receivers in a uniform grid whose cells are ReceptionRange wide and
+ * only looks at the cells around the sender (see mobility-grid.h).
+ * Receivers further away than ReceptionRange, or whose path loss exceeds
+ * LossCutoffDb, are skipped.  A skipped receiver does not get the signal at
+ * all, so it also no longer counts as interference there: many distant
+ * senders that are each beyond the cutoff no longer add up, and delivery
+ * can come out higher than on the stock channel.  Keep the cutoffs well
+ * below the PHY's energy detection threshold where that matters.
+ *
+ * The channel carries SpectrumWifiPhy, not the YansWifiPhy of the yans
+ * channel, and the two PHYs model reception differently.  To see what the
+ * index and the cutoffs alone change, compare with a stock
+ * MultiModelSpectrumChannel (--channel=spectrum in the scripts).
+ *
+ * With UseIndex=false the channel scans every PHY (brute force) but applies
+ * the same cutoff.  Validate=true does both on every transmission and aborts
+ * if the receiver sets differ.  Receivers are always served in the order
+ * they were added, so both modes schedule exactly the same events.
+ *
+ * Members are defined inline; adhoc_routing.cc and aodv.cc register the
+ * TypeId.
+ */
+
+#ifndef GRID_SPECTRUM_CHANNEL_H
+#define GRID_SPECTRUM_CHANNEL_H
+
+#include <cmath>
+#include <ostream>
+#include <vector>
+#include "ns3/boolean.h"
+#include "ns3/double.h"
+#include "ns3/log.h"
+#include "ns3/mobility-model.h"
+#include "ns3/net-device.h"
+#include "ns3/node.h"
+#include "ns3/propagation-delay-model.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/simulator.h"
+#include "ns3/spectrum-channel.h"
+#include "ns3/spectrum-phy.h"
+#include "ns3/spectrum-propagation-loss-model.h"
+#include "ns3/spectrum-signal-parameters.h"
+#include "ns3/spectrum-value.h"
+#include "mobility-grid.h"
+
+namespace ns3 {
+
+class GridSpectrumChannel : public SpectrumChannel
+{
+public:
+  static TypeId GetTypeId (void);
+  GridSpectrumChannel ();
+
+  // inherited from SpectrumChannel
+  virtual void AddPropagationLossModel (Ptr<PropagationLossModel> loss);
+  virtual void AddSpectrumPropagationLossModel (Ptr<SpectrumPropagationLossModel> loss);
+  virtual void SetPropagationDelayModel (Ptr<PropagationDelayModel> delay);
+  virtual Ptr<SpectrumPropagationLossModel> GetSpectrumPropagationLossModel (void);
+  virtual void AddRx (Ptr<SpectrumPhy> phy);
+  virtual void StartTx (Ptr<SpectrumSignalParameters> params);
+
+  // inherited from Channel
+  virtual std::size_t GetNDevices (void) const;
+  virtual Ptr<NetDevice> GetDevice (std::size_t i) const;
+
+  /// Print transmission, candidate and delivery counters
+  void PrintStats (std::ostream &os) const;
+
+private:
+  virtual void DoDispose (void);
+  static void StartRx (Ptr<SpectrumSignalParameters> params, Ptr<SpectrumPhy> receiver);
+
+  void BuildIndex (void);
+  bool InRange (Ptr<MobilityModel> sender, uint32_t phy) const;
+
+  std::vector<Ptr<SpectrumPhy> > m_phys;
+  Ptr<PropagationLossModel> m_loss;
+  Ptr<PropagationDelayModel> m_delay;
+  Ptr<SpectrumPropagationLossModel> m_spectrumLoss;
+
+  double m_range;
+  double m_lossCutoffDb;
+  bool m_useIndex;
+  bool m_validate;
+
+  MobilityGrid m_grid;
+  std::vector<uint32_t> m_candidates;
+  std::vector<uint32_t> m_bruteForce;
+
+  uint64_t m_transmissions;
+  uint64_t m_examined;
+  uint64_t m_delivered;
+};
+
+inline TypeId
+GridSpectrumChannel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::GridSpectrumChannel")
+    .SetParent<SpectrumChannel> ()
+    .AddConstructor<GridSpectrumChannel> ()
+    .AddAttribute ("ReceptionRange",
+                   "Receivers further away than this (m) never get the signal, not even as interference; also the grid cell size.",
+                   DoubleValue (250.0),
+                   MakeDoubleAccessor (&GridSpectrumChannel::m_range),
+                   MakeDoubleChecker<double> (1e-3))
+    .AddAttribute ("LossCutoffDb",
+                   "Receivers whose path loss exceeds this (dB) do not get the signal, not even as interference.",
+                   DoubleValue (1.0e9),
+                   MakeDoubleAccessor (&GridSpectrumChannel::m_lossCutoffDb),
+                   MakeDoubleChecker<double> ())
+    .AddAttribute ("UseIndex",
+                   "Look receivers up in the spatial grid instead of scanning every PHY.",
+                   BooleanValue (true),
+                   MakeBooleanAccessor (&GridSpectrumChannel::m_useIndex),
+                   MakeBooleanChecker ())
+    .AddAttribute ("Validate",
+                   "Compare the grid lookup against a full scan on every transmission.",
+                   BooleanValue (false),
+                   MakeBooleanAccessor (&GridSpectrumChannel::m_validate),
+                   MakeBooleanChecker ())
+  ;
+  return tid;
+}
+
+inline
+GridSpectrumChannel::GridSpectrumChannel ()
+  : m_range (250.0),
+    m_lossCutoffDb (1.0e9),
+    m_useIndex (true),
+    m_validate (false),
+    m_transmissions (0),
+    m_examined (0),
+    m_delivered (0)
+{
+}
+
+inline void
+GridSpectrumChannel::DoDispose (void)
+{
+  m_phys.clear ();
+  m_loss = 0;
+  m_delay = 0;
+  m_spectrumLoss = 0;
+  m_grid.Clear ();
+  SpectrumChannel::DoDispose ();
+}
+
+inline void
+GridSpectrumChannel::AddPropagationLossModel (Ptr<PropagationLossModel> loss)
+{
+  if (m_loss)
+    {
+      loss->SetNext (m_loss);
+    }
+  m_loss = loss;
+}
+
+inline void
+GridSpectrumChannel::AddSpectrumPropagationLossModel (Ptr<SpectrumPropagationLossModel> loss)
+{
+  if (m_spectrumLoss)
+    {
+      loss->SetNext (m_spectrumLoss);
+    }
+  m_spectrumLoss = loss;
+}
+
+inline void
+GridSpectrumChannel::SetPropagationDelayModel (Ptr<PropagationDelayModel> delay)
+{
+  m_delay = delay;
+}
+
+inline Ptr<SpectrumPropagationLossModel>
+GridSpectrumChannel::GetSpectrumPropagationLossModel (void)
+{
+  return m_spectrumLoss;
+}
+
+inline void
+GridSpectrumChannel::AddRx (Ptr<SpectrumPhy> phy)
+{
+  // Mobility is usually installed after the devices, so the grid is only
+  // built on the first transmission
+  m_phys.push_back (phy);
+  m_grid.Invalidate ();
+}
+
+inline std::size_t
+GridSpectrumChannel::GetNDevices (void) const
+{
+  return m_phys.size ();
+}
+
+inline Ptr<NetDevice>
+GridSpectrumChannel::GetDevice (std::size_t i) const
+{
+  return m_phys[i]->GetDevice ();
+}
+
+inline void
+GridSpectrumChannel::BuildIndex (void)
+{
+  std::vector<Ptr<MobilityModel> > mobility (m_phys.size ());
+  for (uint32_t i = 0; i < m_phys.size (); i++)
+    {
+      mobility[i] = m_phys[i]->GetMobility ();
+    }
+  m_grid.Build (mobility, m_range);
+}
+
+inline bool
+GridSpectrumChannel::InRange (Ptr<MobilityModel> sender, uint32_t phy) const
+{
+  Ptr<MobilityModel> receiver = m_phys[phy]->GetMobility ();
+  return !sender || !receiver || sender->GetDistanceFrom (receiver) <= m_range;
+}
+
+inline void
+GridSpectrumChannel::StartTx (Ptr<SpectrumSignalParameters> txParams)
+{
+  NS_ASSERT_MSG (txParams->psd, "NULL txPsd");
+  NS_ASSERT_MSG (txParams->txPhy, "NULL txPhy");
+  m_transmissions++;
+
+  Ptr<MobilityModel> senderMobility = txParams->txPhy->GetMobility ();
+  if (!m_grid.IsBuilt ())
+    {
+      BuildIndex ();
+    }
+
+  m_candidates.clear ();
+  if (m_useIndex && senderMobility)
+    {
+      m_grid.Candidates (senderMobility->GetPosition (), m_candidates);
+    }
+  else
+    {
+      for (uint32_t i = 0; i < m_phys.size (); i++)
+        {
+          m_candidates.push_back (i);
+        }
+    }
+
+  if (m_validate && m_useIndex)
+    {
+      std::vector<uint32_t> indexed;
+      for (std::vector<uint32_t>::const_iterator i = m_candidates.begin (); i != m_candidates.end (); ++i)
+        {
+          if (InRange (senderMobility, *i))
+            {
+              indexed.push_back (*i);
+            }
+        }
+      m_bruteForce.clear ();
+      for (uint32_t i = 0; i < m_phys.size (); i++)
+        {
+          if (InRange (senderMobility, i))
+            {
+              m_bruteForce.push_back (i);
+            }
+        }
+      if (indexed != m_bruteForce)
+        {
+          NS_FATAL_ERROR ("GridSpectrumChannel: grid lookup found " << indexed.size ()
+                          << " receivers in range, full scan found " << m_bruteForce.size ()
+                          << " at " << Simulator::Now ().GetSeconds () << "s");
+        }
+    }
+
+  for (std::vector<uint32_t>::const_iterator i = m_candidates.begin (); i != m_candidates.end (); ++i)
+    {
+      Ptr<SpectrumPhy> rxPhy = m_phys[*i];
+      if (rxPhy == txParams->txPhy)
+        {
+          continue;
+        }
+      m_examined++;
+      if (!InRange (senderMobility, *i))
+        {
+          continue;
+        }
+      Time delay = MicroSeconds (0);
+      double gainLinear = 1.0;
+      Ptr<MobilityModel> receiverMobility = rxPhy->GetMobility ();
+      if (senderMobility && receiverMobility)
+        {
+          if (m_loss)
+            {
+              double gainDb = m_loss->CalcRxPower (0, senderMobility, receiverMobility);
+              if (-gainDb > m_lossCutoffDb)
+                {
+                  continue;
+                }
+              gainLinear = std::pow (10.0, gainDb / 10.0);
+            }
+          if (m_delay)
+            {
+              delay = m_delay->GetDelay (senderMobility, receiverMobility);
+            }
+        }
+
+      Ptr<SpectrumSignalParameters> rxParams = txParams->Copy ();
+      *(rxParams->psd) *= gainLinear;
+      if (m_spectrumLoss && senderMobility && receiverMobility)
+        {
+          rxParams->psd = m_spectrumLoss->CalcRxPowerSpectralDensity (rxParams->psd, senderMobility, receiverMobility);
+        }
+
+      Ptr<NetDevice> netDev = rxPhy->GetDevice ();
+      uint32_t dstNode = netDev ? netDev->GetNode ()->GetId () : 0xffffffff;
+      m_delivered++;
+      Simulator::ScheduleWithContext (dstNode, delay, &GridSpectrumChannel::StartRx, rxParams, rxPhy);
+    }
+}
+
+inline void
+GridSpectrumChannel::StartRx (Ptr<SpectrumSignalParameters> params, Ptr<SpectrumPhy> receiver)
+{
+  receiver->StartRx (params);
+}
+
+inline void
+GridSpectrumChannel::PrintStats (std::ostream &os) const
+{
+  os << "Channel: " << m_transmissions << " transmissions, "
+     << m_examined << " receivers examined, "
+     << m_delivered << " delivered, "
+     << (m_transmissions * (m_phys.size () ? m_phys.size () - 1 : 0)) - m_examined << " skipped by the grid, "
+     << m_grid.GetRebuilds () << " grid rebuilds"
+     << (m_validate ? ", every lookup matched a full scan" : "") << "\n";
+}
+
+} // namespace ns3
+
+#endif /* GRID_SPECTRUM_CHANNEL_H */
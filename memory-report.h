@@ -0,0 +1,172 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Memory used per subsystem, shared by adhoc_routing.cc and aodv.cc.
+ *
+ * The scripts build a network in stages: nodes and mobility, devices,
+ * internet stack and routing, applications, trace sinks.  MemoryReport
+ * reads the bytes the heap has handed out after each stage and charges the
+ * growth since the previous reading to the subsystem just built; a reading
+ * after the run charges what the run added (routing tables, neighbour and
+ * ARP caches, queued packets and the other state that grows with traffic)
+ * to "run".  Readings cost a walk over the malloc arenas, so they are only
+ * taken between stages, never per event.
+ *
+ * The device queues are also counted at the end of the run, so the packets
+ * still waiting for the channel can be told apart from the rest of "run".
+ */
+
+#ifndef MEMORY_REPORT_H
+#define MEMORY_REPORT_H
+
+#include <cstdio>
+#include <iomanip>
+#include <malloc.h>
+#include <ostream>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "ns3/net-device-container.h"
+#include "ns3/pointer.h"
+#include "ns3/queue.h"
+#include "ns3/regular-wifi-mac.h"
+#include "ns3/simple-net-device.h"
+#include "ns3/txop.h"
+#include "ns3/wifi-mac-queue.h"
+#include "ns3/wifi-net-device.h"
+
+namespace ns3 {
+
+class MemoryReport
+{
+public:
+  MemoryReport ()
+    : m_enabled (false),
+      m_last (0),
+      m_queuedPackets (0),
+      m_queuedBytes (0)
+  {
+  }
+
+  /// Forget the subsystems and take the starting point from now; Mark ()
+  /// does nothing before the first Reset ()
+  void Reset ()
+  {
+    m_enabled = true;
+    m_subsystems.clear ();
+    m_queuedPackets = 0;
+    m_queuedBytes = 0;
+    m_last = HeapBytes ();
+  }
+
+  /// Charge the heap growth since the previous call to \p subsystem
+  void Mark (const std::string &subsystem)
+  {
+    if (!m_enabled)
+      {
+        return;
+      }
+    uint64_t now = HeapBytes ();
+    int64_t grown = static_cast<int64_t> (now) - static_cast<int64_t> (m_last);
+    m_last = now;
+    for (size_t i = 0; i < m_subsystems.size (); i++)
+      {
+        if (m_subsystems[i].first == subsystem)
+          {
+            m_subsystems[i].second += grown;
+            return;
+          }
+      }
+    m_subsystems.push_back (std::make_pair (subsystem, grown));
+  }
+
+  /// Add the packets waiting in the transmit queues of \p devices
+  void CountQueues (const NetDeviceContainer &devices)
+  {
+    for (NetDeviceContainer::Iterator i = devices.Begin (); i != devices.End (); ++i)
+      {
+        Ptr<WifiNetDevice> wifi = DynamicCast<WifiNetDevice> (*i);
+        Ptr<SimpleNetDevice> simple = DynamicCast<SimpleNetDevice> (*i);
+        if (wifi)
+          {
+            PointerValue txop;
+            wifi->GetMac ()->GetAttribute ("Txop", txop);
+            Ptr<WifiMacQueue> queue = txop.Get<Txop> ()->GetWifiMacQueue ();
+            m_queuedPackets += queue->GetNPackets ();
+            m_queuedBytes += queue->GetNBytes ();
+          }
+        else if (simple)
+          {
+            PointerValue queue;
+            simple->GetAttribute ("TxQueue", queue);
+            m_queuedPackets += queue.Get<Queue<Packet> > ()->GetNPackets ();
+            m_queuedBytes += queue.Get<Queue<Packet> > ()->GetNBytes ();
+          }
+      }
+  }
+
+  /// Print the memory of each subsystem, in total and per node
+  void PrintStats (std::ostream &os, uint32_t nNodes) const
+  {
+    int64_t total = 0;
+    os << "Memory by subsystem (heap growth, " << nNodes << " nodes, RSS now "
+       << RssKb () << " kB):\n";
+    for (size_t i = 0; i < m_subsystems.size (); i++)
+      {
+        total += m_subsystems[i].second;
+        Line (os, m_subsystems[i].first, m_subsystems[i].second, nNodes);
+      }
+    Line (os, "total", total, nNodes);
+    os << "  queued at the end: " << m_queuedPackets << " packets, " << m_queuedBytes << " bytes\n";
+  }
+
+  /// Bytes handed out by malloc and not yet freed
+  static uint64_t HeapBytes ()
+  {
+#if defined (__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 info = mallinfo2 ();
+    return info.uordblks + info.hblkhd;
+#else
+    struct mallinfo info = mallinfo ();
+    return static_cast<unsigned int> (info.uordblks) + static_cast<unsigned int> (info.hblkhd);
+#endif
+  }
+
+  static long RssKb ()
+  {
+    std::FILE *statm = std::fopen ("/proc/self/statm", "r");
+    long size = 0;
+    long resident = 0;
+    if (statm)
+      {
+        if (std::fscanf (statm, "%ld %ld", &size, &resident) != 2)
+          {
+            resident = 0;
+          }
+        std::fclose (statm);
+      }
+    return resident * (sysconf (_SC_PAGESIZE) / 1024);
+  }
+
+private:
+  static void Line (std::ostream &os, const std::string &name, int64_t bytes, uint32_t nNodes)
+  {
+    std::ios::fmtflags flags = os.flags ();
+    std::streamsize precision = os.precision ();
+    os << "  " << std::left << std::setw (14) << name << std::right << std::setw (12) << bytes / 1024
+       << " kB" << std::fixed << std::setprecision (1) << std::setw (12)
+       << (nNodes > 0 ? bytes / 1024.0 / nNodes : 0.0) << " kB/node\n";
+    os.flags (flags);
+    os.precision (precision);
+  }
+
+  bool m_enabled;
+  uint64_t m_last;
+  std::vector<std::pair<std::string, int64_t> > m_subsystems;
+  uint64_t m_queuedPackets;
+  uint64_t m_queuedBytes;
+};
+
+} // namespace ns3
+
+#endif /* MEMORY_REPORT_H */
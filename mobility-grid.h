@@ -0,0 +1,197 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Uniform grid over the positions of mobile nodes, used by the channels
+ * of grid-spectrum-channel.h and abstract-link.h to find the receivers
+ * near a sender without looking at every node.
+ *
+ * Entries are numbered 0..n-1 and each has a mobility model; several
+ * entries may share one.  The grid is updated from the CourseChange trace
+ * of each model.  Between course changes nodes move in straight lines, so
+ * an entry can be at most (fastest speed) x (time since the last full
+ * rebuild) away from where it was indexed; the search radius is widened by
+ * that amount and the whole grid is rebuilt once the slack exceeds half a
+ * cell.  Entries without a mobility model are always candidates.
+ */
+
+#ifndef MOBILITY_GRID_H
+#define MOBILITY_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "ns3/callback.h"
+#include "ns3/mobility-model.h"
+#include "ns3/nstime.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+
+class MobilityGrid
+{
+public:
+  MobilityGrid ()
+    : m_cellSize (1),
+      m_built (false),
+      m_maxSpeed (0),
+      m_rebuilds (0)
+  {
+  }
+
+  /// Index entry i at the position of \p mobility[i], in cells \p cellSize wide
+  void Build (const std::vector<Ptr<MobilityModel> > &mobility, double cellSize)
+  {
+    m_mobility = mobility;
+    m_cellSize = cellSize;
+    Rebuild ();
+  }
+
+  bool IsBuilt (void) const { return m_built; }
+
+  /// Entries were added; Build () again before the next lookup
+  void Invalidate (void) { m_built = false; }
+
+  /**
+   * Put into \p out, in ascending order, every entry that may lie within
+   * one cell size of \p position, and possibly some further away.
+   */
+  void Candidates (const Vector &position, std::vector<uint32_t> &out)
+  {
+    double slack = m_maxSpeed * (Simulator::Now () - m_lastRebuild).GetSeconds ();
+    if (slack > m_cellSize / 2)
+      {
+        Rebuild ();
+        slack = 0;
+      }
+    int32_t reach = static_cast<int32_t> (std::ceil ((m_cellSize + slack) / m_cellSize));
+    int32_t cx = static_cast<int32_t> (std::floor (position.x / m_cellSize));
+    int32_t cy = static_cast<int32_t> (std::floor (position.y / m_cellSize));
+    out.assign (m_unindexed.begin (), m_unindexed.end ());
+    for (int32_t x = cx - reach; x <= cx + reach; x++)
+      {
+        for (int32_t y = cy - reach; y <= cy + reach; y++)
+          {
+            std::unordered_map<int64_t, std::vector<uint32_t> >::const_iterator cell = m_cells.find (Key (x, y));
+            if (cell != m_cells.end ())
+              {
+                out.insert (out.end (), cell->second.begin (), cell->second.end ());
+              }
+          }
+      }
+    std::sort (out.begin (), out.end ());
+  }
+
+  uint64_t GetRebuilds (void) const { return m_rebuilds; }
+
+  /// Forget the entries; the traces stay connected but are ignored
+  void Clear (void)
+  {
+    m_mobility.clear ();
+    m_connected.clear ();
+    m_cells.clear ();
+    m_cellOf.clear ();
+    m_unindexed.clear ();
+    m_entriesOf.clear ();
+    m_built = false;
+  }
+
+private:
+  static int64_t Key (int32_t x, int32_t y)
+  {
+    return (static_cast<int64_t> (x) << 32) | static_cast<uint32_t> (y);
+  }
+
+  int64_t CellOf (const Vector &position) const
+  {
+    return Key (static_cast<int32_t> (std::floor (position.x / m_cellSize)),
+                static_cast<int32_t> (std::floor (position.y / m_cellSize)));
+  }
+
+  void Insert (uint32_t entry, const Vector &position)
+  {
+    int64_t cell = CellOf (position);
+    m_cellOf[entry] = cell;
+    m_cells[cell].push_back (entry);
+  }
+
+  void Remove (uint32_t entry)
+  {
+    std::vector<uint32_t> &cell = m_cells[m_cellOf[entry]];
+    std::vector<uint32_t>::iterator it = std::find (cell.begin (), cell.end (), entry);
+    if (it != cell.end ())
+      {
+        *it = cell.back ();
+        cell.pop_back ();
+      }
+  }
+
+  void Rebuild (void)
+  {
+    for (std::map<const MobilityModel *, std::vector<uint32_t> >::iterator it = m_entriesOf.begin (); it != m_entriesOf.end (); ++it)
+      {
+        it->second.clear ();
+      }
+    m_cells.clear ();
+    m_unindexed.clear ();
+    m_cellOf.assign (m_mobility.size (), 0);
+    m_maxSpeed = 0;
+    for (uint32_t i = 0; i < m_mobility.size (); i++)
+      {
+        Ptr<MobilityModel> mobility = m_mobility[i];
+        if (!mobility)
+          {
+            m_unindexed.push_back (i);
+            continue;
+          }
+        // follow each model once, however often the grid is rebuilt
+        if (m_connected.insert (PeekPointer (mobility)).second)
+          {
+            mobility->TraceConnectWithoutContext ("CourseChange", MakeCallback (&MobilityGrid::CourseChanged, this));
+          }
+        m_entriesOf[PeekPointer (mobility)].push_back (i);
+        Insert (i, mobility->GetPosition ());
+        m_maxSpeed = std::max (m_maxSpeed, mobility->GetVelocity ().GetLength ());
+      }
+    m_lastRebuild = Simulator::Now ();
+    m_built = true;
+    m_rebuilds++;
+  }
+
+  void CourseChanged (Ptr<const MobilityModel> mobility)
+  {
+    if (!m_built)
+      {
+        return;
+      }
+    std::map<const MobilityModel *, std::vector<uint32_t> >::const_iterator it = m_entriesOf.find (PeekPointer (mobility));
+    if (it == m_entriesOf.end ())
+      {
+        return;
+      }
+    Vector position = mobility->GetPosition ();
+    for (std::vector<uint32_t>::const_iterator entry = it->second.begin (); entry != it->second.end (); ++entry)
+      {
+        Remove (*entry);
+        Insert (*entry, position);
+      }
+    m_maxSpeed = std::max (m_maxSpeed, mobility->GetVelocity ().GetLength ());
+  }
+
+  std::vector<Ptr<MobilityModel> > m_mobility;
+  double m_cellSize;
+  bool m_built;
+  double m_maxSpeed;
+  Time m_lastRebuild;
+  std::unordered_map<int64_t, std::vector<uint32_t> > m_cells;
+  std::vector<int64_t> m_cellOf;
+  std::vector<uint32_t> m_unindexed;
+  std::map<const MobilityModel *, std::vector<uint32_t> > m_entriesOf;
+  std::set<const MobilityModel *> m_connected;
+  uint64_t m_rebuilds;
+};
+
+} // namespace ns3
+
+#endif /* MOBILITY_GRID_H */
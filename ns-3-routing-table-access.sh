@@ -0,0 +1,38 @@
+#!/bin/sh
+# Add read-only accessors for the AODV and DSDV routing tables to an ns-3
+# source tree, for the route snapshots of route-snapshots.h.  The tables
+# are then read as they are, without formatting them as text and without
+# the purge their lookups do.  Each accessor goes in front of the private
+# member it returns.  Run once from anywhere, then rebuild ns-3:
+#   sh ns-3-routing-table-access.sh /path/to/ns-3
+
+set -e
+ns3=${1:?usage: $0 <ns-3 source directory>}
+
+# add <file> <member line> <accessor>
+add ()
+{
+  file="$ns3/$1"
+  if grep -qF "$3" "$file"; then
+    echo "$1: already patched"
+    return
+  fi
+  if ! grep -qx "$2" "$file"; then
+    echo "$1: no line \"$2\"; this ns-3 release is not supported" >&2
+    exit 1
+  fi
+  awk -v member="$2" -v accessor="$3" '
+    $0 == member { print "public:"; print accessor; print "private:" }
+    { print }' "$file" > "$file.tmp"
+  mv "$file.tmp" "$file"
+  echo "$1: patched"
+}
+
+add src/aodv/model/aodv-routing-protocol.h "  RoutingTable m_routingTable;" \
+  "  const RoutingTable & GetRoutingTable () const { return m_routingTable; }"
+add src/aodv/model/aodv-rtable.h "  std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;" \
+  "  const std::map<Ipv4Address, RoutingTableEntry> & GetEntries () const { return m_ipv4AddressEntry; }"
+add src/dsdv/model/dsdv-routing-protocol.h "  RoutingTable m_routingTable;" \
+  "  const RoutingTable & GetRoutingTable () const { return m_routingTable; }"
+add src/dsdv/model/dsdv-rtable.h "  std::map<Ipv4Address, RoutingTableEntry> m_ipv4AddressEntry;" \
+  "  const std::map<Ipv4Address, RoutingTableEntry> & GetEntries () const { return m_ipv4AddressEntry; }"
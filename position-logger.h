@@ -0,0 +1,230 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Binary node position logger.
+ *
+ * Every CourseChange is stored as a fixed-size PositionRecord in a
+ * preallocated ring buffer; the buffer goes to disk in one write whenever it
+ * fills up (or, in keep-last mode, only the newest records are written when
+ * the logger is closed).  Records can be decimated per node by time and/or
+ * by distance moved.  position-reader.cc turns a log back into text.
+ *
+ * File layout: PositionLogHeader followed by PositionRecords.
+ */
+
+#ifndef POSITION_LOGGER_H
+#define POSITION_LOGGER_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+struct PositionLogHeader
+{
+  char magic[8];         ///< "NS3POS01"
+  uint32_t recordSize;   ///< sizeof (PositionRecord)
+  uint32_t reserved;
+};
+
+struct PositionRecord
+{
+  double time;           ///< s
+  uint32_t node;
+  float x, y, z;         ///< m
+};
+
+#ifndef POSITION_LOG_READER_ONLY
+
+#include "ns3/fatal-error.h"
+#include "ns3/mobility-model.h"
+#include "ns3/node-container.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+
+class PositionLogger
+{
+public:
+  PositionLogger ()
+    : m_file (0),
+      m_head (0),
+      m_size (0),
+      m_keepLast (false),
+      m_minInterval (0),
+      m_minDistance (0),
+      m_logged (0),
+      m_skipped (0)
+  {
+  }
+
+  ~PositionLogger ()
+  {
+    Close ();
+  }
+
+  /**
+   * Start logging to \p fileName with room for \p bufferRecords records.
+   * With \p keepLast the buffer overwrites its oldest records instead of
+   * being flushed, and only the newest bufferRecords reach the file.
+   */
+  void Open (const std::string &fileName, uint32_t bufferRecords, bool keepLast)
+  {
+    Close ();
+    m_file = std::fopen (fileName.c_str (), "wb");
+    if (!m_file)
+      {
+        NS_FATAL_ERROR ("Cannot open position log " << fileName);
+      }
+    PositionLogHeader header;
+    std::memcpy (header.magic, "NS3POS01", 8);
+    header.recordSize = sizeof (PositionRecord);
+    header.reserved = 0;
+    std::fwrite (&header, sizeof (header), 1, m_file);
+    m_ring.resize (bufferRecords > 0 ? bufferRecords : 1);
+    m_head = 0;
+    m_size = 0;
+    m_keepLast = keepLast;
+    m_last.clear ();
+    m_probes.clear ();
+    m_logged = 0;
+    m_skipped = 0;
+  }
+
+  /// Skip a record unless the node moved \p minDistance m or \p minInterval s passed (0 disables)
+  void SetDecimation (double minInterval, double minDistance)
+  {
+    m_minInterval = minInterval;
+    m_minDistance = minDistance;
+  }
+
+  /// Log the current position of every node and each of its course changes
+  void Attach (NodeContainer nodes)
+  {
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        Ptr<MobilityModel> model = (*i)->GetObject<MobilityModel> ();
+        if (!model)
+          {
+            continue;
+          }
+        Ptr<Probe> probe = Create<Probe> (this, (*i)->GetId ());
+        m_probes.push_back (probe);
+        model->TraceConnectWithoutContext ("CourseChange", MakeCallback (&Probe::CourseChange, PeekPointer (probe)));
+        Log ((*i)->GetId (), model);
+      }
+  }
+
+  void Log (uint32_t node, Ptr<const MobilityModel> model)
+  {
+    double now = Simulator::Now ().GetSeconds ();
+    Vector position = model->GetPosition ();
+    if (node >= m_last.size ())
+      {
+        m_last.resize (node + 1);
+      }
+    LastRecord &last = m_last[node];
+    if (last.valid && (m_minInterval > 0 || m_minDistance > 0))
+      {
+        bool due = m_minInterval > 0 && now - last.time >= m_minInterval;
+        bool moved = m_minDistance > 0 && CalculateDistance (position, last.position) >= m_minDistance;
+        if (!due && !moved)
+          {
+            m_skipped++;
+            return;
+          }
+      }
+    last.valid = true;
+    last.time = now;
+    last.position = position;
+
+    if (!m_file)
+      {
+        return;
+      }
+    if (m_size == m_ring.size ())
+      {
+        if (m_keepLast)
+          {
+            m_head = (m_head + 1) % m_ring.size ();
+            m_size--;
+          }
+        else
+          {
+            Flush ();
+          }
+      }
+    PositionRecord &r = m_ring[(m_head + m_size) % m_ring.size ()];
+    r.time = now;
+    r.node = node;
+    r.x = position.x;
+    r.y = position.y;
+    r.z = position.z;
+    m_size++;
+    m_logged++;
+  }
+
+  /// Write what is buffered and close the file; later course changes are ignored
+  void Close ()
+  {
+    if (!m_file)
+      {
+        return;
+      }
+    Flush ();
+    std::fclose (m_file);
+    m_file = 0;
+  }
+
+  uint64_t GetLogged () const { return m_logged; }
+  uint64_t GetSkipped () const { return m_skipped; }
+
+private:
+  class Probe : public SimpleRefCount<Probe>
+  {
+  public:
+    Probe (PositionLogger *logger, uint32_t node) : m_logger (logger), m_node (node) {}
+    void CourseChange (Ptr<const MobilityModel> model) { m_logger->Log (m_node, model); }
+  private:
+    PositionLogger *m_logger;
+    uint32_t m_node;
+  };
+
+  struct LastRecord
+  {
+    LastRecord () : valid (false), time (0) {}
+    bool valid;
+    double time;
+    Vector position;
+  };
+
+  void Flush ()
+  {
+    // at most two writes: the ring may wrap around the end of the buffer
+    size_t first = std::min (m_size, m_ring.size () - m_head);
+    std::fwrite (&m_ring[m_head], sizeof (PositionRecord), first, m_file);
+    std::fwrite (&m_ring[0], sizeof (PositionRecord), m_size - first, m_file);
+    m_head = 0;
+    m_size = 0;
+  }
+
+  std::FILE *m_file;
+  std::vector<PositionRecord> m_ring;
+  size_t m_head;
+  size_t m_size;
+  bool m_keepLast;
+  double m_minInterval;
+  double m_minDistance;
+  std::vector<LastRecord> m_last;
+  std::vector<Ptr<Probe> > m_probes;
+  uint64_t m_logged;
+  uint64_t m_skipped;
+};
+
+} // namespace ns3
+
+#endif /* POSITION_LOG_READER_ONLY */
+
+#endif /* POSITION_LOGGER_H */
@@ -0,0 +1,93 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Print a binary position log written by PositionLogger (see
+ * position-logger.h) as CSV.
+ *
+ *   position-reader aodv.positions            all records
+ *   position-reader aodv.positions 3          node 3 only
+ *   position-reader aodv.positions summary    records and time span per node
+ */
+
+#define POSITION_LOG_READER_ONLY
+#include "position-logger.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 2)
+    {
+      std::cerr << "Usage: " << argv[0] << " <position log> [node|summary]\n";
+      return 1;
+    }
+  std::FILE *file = std::fopen (argv[1], "rb");
+  if (!file)
+    {
+      std::cerr << "Cannot open " << argv[1] << "\n";
+      return 1;
+    }
+  PositionLogHeader header;
+  if (std::fread (&header, sizeof (header), 1, file) != 1
+      || std::memcmp (header.magic, "NS3POS01", 8) != 0
+      || header.recordSize != sizeof (PositionRecord))
+    {
+      std::cerr << argv[1] << " is not a position log\n";
+      std::fclose (file);
+      return 1;
+    }
+
+  bool summary = argc > 2 && std::string (argv[2]) == "summary";
+  long node = argc > 2 && !summary ? std::atol (argv[2]) : -1;
+
+  struct NodeSummary
+  {
+    uint64_t records;
+    double first;
+    double last;
+  };
+  std::map<uint32_t, NodeSummary> nodes;
+
+  if (!summary)
+    {
+      std::cout << "Time,Node,X,Y,Z\n";
+    }
+  std::vector<PositionRecord> block (4096);
+  size_t n;
+  while ((n = std::fread (block.data (), sizeof (PositionRecord), block.size (), file)) > 0)
+    {
+      for (size_t i = 0; i < n; i++)
+        {
+          const PositionRecord &r = block[i];
+          if (summary)
+            {
+              std::map<uint32_t, NodeSummary>::iterator it = nodes.find (r.node);
+              if (it == nodes.end ())
+                {
+                  NodeSummary s = { 0, r.time, r.time };
+                  it = nodes.insert (std::make_pair (r.node, s)).first;
+                }
+              it->second.records++;
+              it->second.first = std::min (it->second.first, r.time);
+              it->second.last = std::max (it->second.last, r.time);
+            }
+          else if (node < 0 || r.node == static_cast<uint32_t> (node))
+            {
+              std::cout << r.time << "," << r.node << "," << r.x << "," << r.y << "," << r.z << "\n";
+            }
+        }
+    }
+  std::fclose (file);
+
+  if (summary)
+    {
+      std::cout << "Node,Records,First,Last\n";
+      for (std::map<uint32_t, NodeSummary>::const_iterator it = nodes.begin (); it != nodes.end (); ++it)
+        {
+          std::cout << it->first << "," << it->second.records << "," << it->second.first << "," << it->second.last << "\n";
+        }
+    }
+  return 0;
+}
@@ -0,0 +1,400 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Live progress of a running simulation.
+ *
+ * InstrumentedScheduler sits between the simulator and the scheduler chosen
+ * with --scheduler.  It keeps the number of pending events and counts the
+ * events leaving the queue per subsystem, telling them apart by the type of
+ * their EventImpl: the object a member function event is bound to is part
+ * of its C++ type, so its demangled name mentions e.g. aodv::RoutingProtocol
+ * or YansWifiPhy.  Each type is classified once and then looked up by its
+ * type_info.  Events of an ns3::Timer only show the timer's own type and
+ * count as "other", whichever module owns the timer.
+ *
+ * Every 4096 events ProgressMonitor reads the wall clock, and once per
+ * reporting interval it writes simulated and wall time, their ratio, the
+ * event rate, the queue size, the resident set size, the share of events
+ * per subsystem since the last report and an estimate of the time left,
+ * as a line on stderr or a CSV row.  Nothing else runs per event, so it is
+ * cheap enough to leave on.
+ *
+ * InstrumentedScheduler is defined inline; adhoc_routing.cc and aodv.cc
+ * register its TypeId.
+ */
+
+#ifndef PROGRESS_MONITOR_H
+#define PROGRESS_MONITOR_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <functional>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include "ns3/event-impl.h"
+#include "ns3/fatal-error.h"
+#include "ns3/object-factory.h"
+#include "ns3/scheduler.h"
+#include "ns3/simulator.h"
+#include "ns3/string.h"
+#include "memory-report.h"
+#include "trace-level.h"
+
+namespace ns3 {
+
+class InstrumentedScheduler : public Scheduler
+{
+public:
+  enum Module
+  {
+    MOBILITY,
+    ROUTING,
+    WIFI,
+    INTERNET,
+    APPLICATIONS,
+    OTHER,
+    N_MODULES
+  };
+
+  static const char *ModuleName (int m)
+  {
+    static const char *names[N_MODULES] = {
+      "mobility", "routing", "wifi", "internet", "applications", "other"
+    };
+    return names[m];
+  }
+
+  static TypeId GetTypeId (void);
+  InstrumentedScheduler ();
+  virtual ~InstrumentedScheduler ();
+
+  /// The scheduler the simulator uses now, if it is an InstrumentedScheduler
+  static InstrumentedScheduler *GetCurrent (void) { return Current (); }
+
+  /// Call \p check every 4096 events
+  void SetCheck (std::function<void ()> check) { m_check = check; }
+
+  uint64_t GetSize (void) const { return m_size; }
+  uint64_t GetPeakSize (void) const { return m_peakSize; }
+  uint64_t GetCount (int module) const { return m_counts[module]; }
+
+  // inherited from Scheduler
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+protected:
+  virtual void NotifyConstructionCompleted (void);
+
+private:
+  static InstrumentedScheduler *&Current (void)
+  {
+    static InstrumentedScheduler *current = 0;
+    return current;
+  }
+  int Classify (const EventImpl *impl);
+
+  std::string m_innerType;
+  Ptr<Scheduler> m_inner;
+  uint64_t m_size;
+  uint64_t m_peakSize;
+  uint64_t m_removed;
+  uint64_t m_counts[N_MODULES];
+  std::unordered_map<const std::type_info *, int> m_modules;
+  std::function<void ()> m_check;
+};
+
+inline TypeId
+InstrumentedScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::InstrumentedScheduler")
+    .SetParent<Scheduler> ()
+    .AddConstructor<InstrumentedScheduler> ()
+    .AddAttribute ("Scheduler",
+                   "TypeId of the scheduler that actually holds the events.",
+                   StringValue ("ns3::MapScheduler"),
+                   MakeStringAccessor (&InstrumentedScheduler::m_innerType),
+                   MakeStringChecker ())
+  ;
+  return tid;
+}
+
+inline
+InstrumentedScheduler::InstrumentedScheduler ()
+  : m_size (0),
+    m_peakSize (0),
+    m_removed (0)
+{
+  std::memset (m_counts, 0, sizeof (m_counts));
+}
+
+inline
+InstrumentedScheduler::~InstrumentedScheduler ()
+{
+  if (Current () == this)
+    {
+      Current () = 0;
+    }
+}
+
+inline void
+InstrumentedScheduler::NotifyConstructionCompleted (void)
+{
+  ObjectFactory factory;
+  factory.SetTypeId (m_innerType);
+  m_inner = factory.Create<Scheduler> ();
+  Current () = this;
+  Scheduler::NotifyConstructionCompleted ();
+}
+
+inline int
+InstrumentedScheduler::Classify (const EventImpl *impl)
+{
+  const std::type_info *type = &typeid (*impl);
+  std::unordered_map<const std::type_info *, int>::const_iterator it = m_modules.find (type);
+  if (it != m_modules.end ())
+    {
+      return it->second;
+    }
+  int status;
+  char *demangled = abi::__cxa_demangle (type->name (), 0, 0, &status);
+  std::string name = status == 0 ? demangled : type->name ();
+  std::free (demangled);
+
+  // first match wins; applications before internet, as they own sockets
+  static const struct
+  {
+    const char *needle;
+    int module;
+  } rules[] = {
+    { "Mobility", MOBILITY },
+    { "aodv::", ROUTING }, { "olsr::", ROUTING }, { "dsdv::", ROUTING }, { "dsr::", ROUTING },
+    { "Application", APPLICATIONS }, { "OnOff", APPLICATIONS }, { "PacketSink", APPLICATIONS },
+    { "TrafficGenerator", APPLICATIONS }, { "V4Ping", APPLICATIONS }, { "RoutingExperiment", APPLICATIONS },
+    { "Wifi", WIFI }, { "Yans", WIFI }, { "Spectrum", WIFI }, { "Txop", WIFI }, { "MacLow", WIFI },
+    { "ChannelAccess", WIFI }, { "SimpleNetDevice", WIFI }, { "AbstractLink", WIFI },
+    { "Ipv4", INTERNET }, { "Arp", INTERNET }, { "Udp", INTERNET }, { "Tcp", INTERNET },
+    { "Icmp", INTERNET }, { "Socket", INTERNET },
+  };
+  int module = OTHER;
+  for (size_t i = 0; i < sizeof (rules) / sizeof (rules[0]); i++)
+    {
+      if (name.find (rules[i].needle) != std::string::npos)
+        {
+          module = rules[i].module;
+          break;
+        }
+    }
+  m_modules[type] = module;
+  return module;
+}
+
+inline void
+InstrumentedScheduler::Insert (const Event &ev)
+{
+  m_inner->Insert (ev);
+  if (++m_size > m_peakSize)
+    {
+      m_peakSize = m_size;
+    }
+}
+
+inline bool
+InstrumentedScheduler::IsEmpty (void) const
+{
+  return m_inner->IsEmpty ();
+}
+
+inline Scheduler::Event
+InstrumentedScheduler::PeekNext (void) const
+{
+  return m_inner->PeekNext ();
+}
+
+inline Scheduler::Event
+InstrumentedScheduler::RemoveNext (void)
+{
+  Event ev = m_inner->RemoveNext ();
+  m_size--;
+  m_counts[Classify (ev.impl)]++;
+  if ((++m_removed & 4095) == 0 && m_check)
+    {
+      m_check ();
+    }
+  return ev;
+}
+
+inline void
+InstrumentedScheduler::Remove (const Event &ev)
+{
+  m_inner->Remove (ev);
+  m_size--;
+}
+
+class ProgressMonitor
+{
+public:
+  ProgressMonitor ()
+    : m_file (0),
+      m_interval (0),
+      m_stop (0)
+  {
+  }
+
+  ~ProgressMonitor ()
+  {
+    Close ();
+  }
+
+  /**
+   * Have the simulator use \p schedulerType through an InstrumentedScheduler
+   * and report every \p interval s of wall-clock time.  \p stop is the
+   * simulated time the run ends at, for the estimate of the time left.
+   * Reports go to \p fileName as CSV, or to stderr if it is empty.
+   */
+  void Start (const std::string &schedulerType, double interval, double stop, const std::string &fileName)
+  {
+    Close ();
+    ObjectFactory factory;
+    factory.SetTypeId ("ns3::InstrumentedScheduler");
+    factory.Set ("Scheduler", StringValue (schedulerType));
+    Simulator::SetScheduler (factory);
+    InstrumentedScheduler *scheduler = InstrumentedScheduler::GetCurrent ();
+    NS_ASSERT (scheduler);
+    scheduler->SetCheck (std::bind (&ProgressMonitor::Check, this));
+
+    m_interval = interval;
+    m_stop = stop;
+    m_start = Sample ();
+    m_last = m_start;
+    m_nextReport = m_start.wall + m_interval;
+    if (!fileName.empty ())
+      {
+        m_file = std::fopen (fileName.c_str (), "w");
+        if (!m_file)
+          {
+            NS_FATAL_ERROR ("Cannot open progress file " << fileName);
+          }
+        std::fprintf (m_file, "WallSeconds,SimSeconds,SimPerWall,Events,EventsPerSecond,QueueSize,PeakQueueSize,RssKb,EtaSeconds");
+        for (int m = 0; m < InstrumentedScheduler::N_MODULES; m++)
+          {
+            std::fprintf (m_file, ",%sEvents", InstrumentedScheduler::ModuleName (m));
+          }
+        std::fprintf (m_file, "\n");
+        std::fflush (m_file);
+      }
+  }
+
+  /// Write a last report and close the file
+  void Stop ()
+  {
+    if (InstrumentedScheduler::GetCurrent ())
+      {
+        Report ();
+        InstrumentedScheduler::GetCurrent ()->SetCheck (std::function<void ()> ());
+      }
+    Close ();
+  }
+
+private:
+  struct Snapshot
+  {
+    Snapshot () : wall (0), sim (0), events (0) {}
+    double wall;
+    double sim;
+    uint64_t events;
+    uint64_t counts[InstrumentedScheduler::N_MODULES];
+  };
+
+  Snapshot Sample () const
+  {
+    Snapshot s;
+    s.wall = WallClockSeconds ();
+    s.sim = Simulator::Now ().GetSeconds ();
+    s.events = Simulator::GetEventCount ();
+    InstrumentedScheduler *scheduler = InstrumentedScheduler::GetCurrent ();
+    for (int m = 0; m < InstrumentedScheduler::N_MODULES; m++)
+      {
+        s.counts[m] = scheduler ? scheduler->GetCount (m) : 0;
+      }
+    return s;
+  }
+
+  void Check ()
+  {
+    if (WallClockSeconds () >= m_nextReport)
+      {
+        Report ();
+      }
+  }
+
+  void Report ()
+  {
+    Snapshot now = Sample ();
+    InstrumentedScheduler *scheduler = InstrumentedScheduler::GetCurrent ();
+    double wall = now.wall - m_start.wall;
+    double dWall = now.wall - m_last.wall;
+    double dSim = now.sim - m_last.sim;
+    double ratio = dWall > 0 ? dSim / dWall : 0;
+    double eventRate = dWall > 0 ? (now.events - m_last.events) / dWall : 0;
+    double eta = ratio > 0 ? (m_stop - now.sim) / ratio : -1;
+    long rss = MemoryReport::RssKb ();
+    if (m_file)
+      {
+        std::fprintf (m_file, "%.3f,%.6f,%.4f,%llu,%.0f,%llu,%llu,%ld,%.1f", wall, now.sim, ratio,
+                      (unsigned long long) now.events, eventRate,
+                      (unsigned long long) scheduler->GetSize (), (unsigned long long) scheduler->GetPeakSize (),
+                      rss, eta);
+        for (int m = 0; m < InstrumentedScheduler::N_MODULES; m++)
+          {
+            std::fprintf (m_file, ",%llu", (unsigned long long) now.counts[m]);
+          }
+        std::fprintf (m_file, "\n");
+        std::fflush (m_file);
+      }
+    else
+      {
+        std::fprintf (stderr, "[progress] sim %.1f/%.0f s, wall %.1f s, %.2fx real time, %llu events (%.0f/s), "
+                      "queue %llu, RSS %ld MB, ETA %.0f s |", now.sim, m_stop, wall, ratio,
+                      (unsigned long long) now.events, eventRate, (unsigned long long) scheduler->GetSize (),
+                      rss / 1024, eta);
+        uint64_t total = 0;
+        for (int m = 0; m < InstrumentedScheduler::N_MODULES; m++)
+          {
+            total += now.counts[m] - m_last.counts[m];
+          }
+        for (int m = 0; m < InstrumentedScheduler::N_MODULES; m++)
+          {
+            std::fprintf (stderr, " %s %.0f%%", InstrumentedScheduler::ModuleName (m),
+                          total ? 100.0 * (now.counts[m] - m_last.counts[m]) / total : 0.0);
+          }
+        std::fprintf (stderr, "\n");
+      }
+    m_last = now;
+    m_nextReport = now.wall + m_interval;
+  }
+
+  void Close ()
+  {
+    if (m_file)
+      {
+        std::fclose (m_file);
+        m_file = 0;
+      }
+  }
+
+  std::FILE *m_file;
+  double m_interval;
+  double m_stop;
+  double m_nextReport;
+  Snapshot m_start;
+  Snapshot m_last;
+};
+
+} // namespace ns3
+
+#endif /* PROGRESS_MONITOR_H */
@@ -0,0 +1,335 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Pairwise propagation loss and delay cache, shared by adhoc_routing.cc and
+ * aodv.cc.
+ *
+ * The channels ask the loss and delay models about every sender/receiver
+ * pair on every frame, and each answer costs two GetPosition () calls, a
+ * distance and (for the loss) a log10.  PropagationCache wraps the models
+ * and keeps their last answer per unordered pair of mobility models.
+ *
+ * Each mobility model has an epoch that advances on every CourseChange; a
+ * cached answer is only used while both ends are still in the epoch it was
+ * computed in.  Within an epoch a node moves at most (speed) x (elapsed
+ * time), with the speed taken at the course change, so the answer is also
+ * dropped once the two nodes together may have moved more than Tolerance
+ * metres since it was computed.  Static nodes such as the sinks never
+ * invalidate their entries.  With the default Tolerance=0 only pairs of
+ * nodes that stand still are cached and the results are the same as
+ * without the cache; a non-zero Tolerance trades accuracy for speed and
+ * changes the results, so compare runs only at the same setting.
+ *
+ * Only models whose answer depends on the distance alone may be wrapped;
+ * random fading would be frozen.
+ *
+ * Members are defined inline; the program registers the three TypeIds in
+ * its .cc file.
+ */
+
+#ifndef PROPAGATION_CACHE_H
+#define PROPAGATION_CACHE_H
+
+#include <ostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "ns3/double.h"
+#include "ns3/mobility-model.h"
+#include "ns3/nstime.h"
+#include "ns3/object.h"
+#include "ns3/propagation-delay-model.h"
+#include "ns3/propagation-loss-model.h"
+#include "ns3/simulator.h"
+#include "ns3/uinteger.h"
+
+namespace ns3 {
+
+class PropagationCache : public Object
+{
+public:
+  static TypeId GetTypeId (void);
+  PropagationCache ();
+
+  /// A loss model answering from this cache, computing misses with \p loss
+  Ptr<PropagationLossModel> CacheLoss (Ptr<PropagationLossModel> loss);
+  /// A delay model answering from this cache, computing misses with \p delay
+  Ptr<PropagationDelayModel> CacheDelay (Ptr<PropagationDelayModel> delay);
+
+  /// Print hit, miss and invalidation counts
+  void PrintStats (std::ostream &os) const;
+
+  struct Entry
+  {
+    Entry () : valid (false), epochA (0), epochB (0), time (0), value (0) {}
+    bool valid;
+    uint32_t epochA;    ///< of the model with the lower index
+    uint32_t epochB;
+    double time;        ///< when the value was computed, s
+    double value;       ///< loss in dB or delay in time steps
+  };
+  typedef std::unordered_map<uint64_t, Entry> Table;
+
+  struct Counters
+  {
+    Counters () : hits (0), misses (0), invalidated (0) {}
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t invalidated;  ///< misses on an entry made stale by mobility
+  };
+
+  /**
+   * Find the entry of the pair (\p a, \p b) in \p table.  Return true if
+   * it holds a value that is still good, false if the caller has to compute
+   * the value and store it in \p entry.
+   */
+  bool Lookup (Table &table, Counters &counters, Ptr<MobilityModel> a, Ptr<MobilityModel> b, Entry *&entry);
+
+  Table m_loss;
+  Table m_delay;
+  Counters m_lossCounters;
+  Counters m_delayCounters;
+
+private:
+  virtual void DoDispose (void);
+
+  struct ModelState
+  {
+    uint32_t epoch;
+    double speed;       ///< m/s since the last course change
+  };
+
+  uint32_t IndexOf (Ptr<MobilityModel> model);
+  void CourseChanged (Ptr<const MobilityModel> model);
+
+  double m_tolerance;
+  uint32_t m_maxEntries;
+  std::unordered_map<const MobilityModel *, uint32_t> m_index;
+  std::vector<ModelState> m_states;
+};
+
+/// Loss model answering from a PropagationCache
+class CachedPropagationLossModel : public PropagationLossModel
+{
+public:
+  static TypeId GetTypeId (void);
+  CachedPropagationLossModel () {}
+  void Setup (Ptr<PropagationCache> cache, Ptr<PropagationLossModel> model)
+  {
+    m_cache = cache;
+    m_model = model;
+  }
+
+private:
+  virtual double DoCalcRxPower (double txPowerDbm, Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+  {
+    PropagationCache::Entry *entry;
+    if (!m_cache->Lookup (m_cache->m_loss, m_cache->m_lossCounters, a, b, entry))
+      {
+        entry->value = txPowerDbm - m_model->CalcRxPower (txPowerDbm, a, b);
+      }
+    return txPowerDbm - entry->value;
+  }
+  virtual int64_t DoAssignStreams (int64_t stream)
+  {
+    return m_model->AssignStreams (stream);
+  }
+  virtual void DoDispose (void)
+  {
+    m_cache = 0;
+    m_model = 0;
+    PropagationLossModel::DoDispose ();
+  }
+
+  Ptr<PropagationCache> m_cache;
+  Ptr<PropagationLossModel> m_model;
+};
+
+/// Delay model answering from a PropagationCache
+class CachedPropagationDelayModel : public PropagationDelayModel
+{
+public:
+  static TypeId GetTypeId (void);
+  CachedPropagationDelayModel () {}
+  void Setup (Ptr<PropagationCache> cache, Ptr<PropagationDelayModel> model)
+  {
+    m_cache = cache;
+    m_model = model;
+  }
+  virtual Time GetDelay (Ptr<MobilityModel> a, Ptr<MobilityModel> b) const
+  {
+    PropagationCache::Entry *entry;
+    if (!m_cache->Lookup (m_cache->m_delay, m_cache->m_delayCounters, a, b, entry))
+      {
+        entry->value = m_model->GetDelay (a, b).GetTimeStep ();
+      }
+    return TimeStep (static_cast<uint64_t> (entry->value));
+  }
+
+private:
+  virtual int64_t DoAssignStreams (int64_t stream)
+  {
+    return m_model->AssignStreams (stream);
+  }
+  virtual void DoDispose (void)
+  {
+    m_cache = 0;
+    m_model = 0;
+    PropagationDelayModel::DoDispose ();
+  }
+
+  Ptr<PropagationCache> m_cache;
+  Ptr<PropagationDelayModel> m_model;
+};
+
+inline TypeId
+PropagationCache::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::PropagationCache")
+    .SetParent<Object> ()
+    .AddConstructor<PropagationCache> ()
+    .AddAttribute ("Tolerance",
+                   "Drop a cached value once the two nodes together may have moved this far (m) since it was computed.",
+                   DoubleValue (0),
+                   MakeDoubleAccessor (&PropagationCache::m_tolerance),
+                   MakeDoubleChecker<double> (0))
+    .AddAttribute ("MaxEntries",
+                   "Entries per table; a table that grows beyond this is emptied.",
+                   UintegerValue (1 << 22),
+                   MakeUintegerAccessor (&PropagationCache::m_maxEntries),
+                   MakeUintegerChecker<uint32_t> (1))
+  ;
+  return tid;
+}
+
+inline TypeId
+CachedPropagationLossModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CachedPropagationLossModel")
+    .SetParent<PropagationLossModel> ()
+    .AddConstructor<CachedPropagationLossModel> ()
+  ;
+  return tid;
+}
+
+inline TypeId
+CachedPropagationDelayModel::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::CachedPropagationDelayModel")
+    .SetParent<PropagationDelayModel> ()
+    .AddConstructor<CachedPropagationDelayModel> ()
+  ;
+  return tid;
+}
+
+inline
+PropagationCache::PropagationCache ()
+  : m_tolerance (0),
+    m_maxEntries (1 << 22)
+{
+}
+
+inline void
+PropagationCache::DoDispose (void)
+{
+  m_loss.clear ();
+  m_delay.clear ();
+  m_index.clear ();
+  m_states.clear ();
+  Object::DoDispose ();
+}
+
+inline Ptr<PropagationLossModel>
+PropagationCache::CacheLoss (Ptr<PropagationLossModel> loss)
+{
+  Ptr<CachedPropagationLossModel> cached = CreateObject<CachedPropagationLossModel> ();
+  cached->Setup (this, loss);
+  return cached;
+}
+
+inline Ptr<PropagationDelayModel>
+PropagationCache::CacheDelay (Ptr<PropagationDelayModel> delay)
+{
+  Ptr<CachedPropagationDelayModel> cached = CreateObject<CachedPropagationDelayModel> ();
+  cached->Setup (this, delay);
+  return cached;
+}
+
+inline uint32_t
+PropagationCache::IndexOf (Ptr<MobilityModel> model)
+{
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator it = m_index.find (PeekPointer (model));
+  if (it != m_index.end ())
+    {
+      return it->second;
+    }
+  uint32_t index = m_states.size ();
+  m_index[PeekPointer (model)] = index;
+  ModelState state;
+  state.epoch = 0;
+  state.speed = CalculateDistance (model->GetVelocity (), Vector (0, 0, 0));
+  m_states.push_back (state);
+  model->TraceConnectWithoutContext ("CourseChange", MakeCallback (&PropagationCache::CourseChanged, this));
+  return index;
+}
+
+inline void
+PropagationCache::CourseChanged (Ptr<const MobilityModel> model)
+{
+  std::unordered_map<const MobilityModel *, uint32_t>::const_iterator it = m_index.find (PeekPointer (model));
+  if (it == m_index.end ())
+    {
+      return;
+    }
+  ModelState &state = m_states[it->second];
+  state.epoch++;
+  state.speed = CalculateDistance (model->GetVelocity (), Vector (0, 0, 0));
+}
+
+inline bool
+PropagationCache::Lookup (Table &table, Counters &counters, Ptr<MobilityModel> a, Ptr<MobilityModel> b, Entry *&entry)
+{
+  uint32_t i = IndexOf (a);
+  uint32_t j = IndexOf (b);
+  if (i > j)
+    {
+      std::swap (i, j);
+    }
+  const ModelState &first = m_states[i];
+  const ModelState &second = m_states[j];
+  double now = Simulator::Now ().GetSeconds ();
+  if (table.size () >= m_maxEntries)
+    {
+      table.clear ();
+    }
+  Entry &e = table[(static_cast<uint64_t> (i) << 32) | j];
+  entry = &e;
+  if (e.valid && e.epochA == first.epoch && e.epochB == second.epoch
+      && (first.speed + second.speed) * (now - e.time) <= m_tolerance)
+    {
+      counters.hits++;
+      return true;
+    }
+  if (e.valid)
+    {
+      counters.invalidated++;
+    }
+  counters.misses++;
+  e.valid = true;
+  e.epochA = first.epoch;
+  e.epochB = second.epoch;
+  e.time = now;
+  return false;
+}
+
+inline void
+PropagationCache::PrintStats (std::ostream &os) const
+{
+  os << "Propagation cache: loss " << m_lossCounters.hits << " hits, " << m_lossCounters.misses << " misses ("
+     << m_lossCounters.invalidated << " stale); delay " << m_delayCounters.hits << " hits, "
+     << m_delayCounters.misses << " misses (" << m_delayCounters.invalidated << " stale); "
+     << m_states.size () << " nodes, tolerance " << m_tolerance << " m\n";
+}
+
+} // namespace ns3
+
+#endif /* PROPAGATION_CACHE_H */
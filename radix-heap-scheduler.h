@@ -0,0 +1,212 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Radix heap event scheduler, and selection of the simulator scheduler by
+ * name for adhoc_routing.cc and aodv.cc.
+ *
+ * Events are never scheduled in the past, so the timestamps leaving the
+ * queue only grow.  A radix heap exploits that: an event goes into bucket
+ * b = (index of the highest bit in which its timestamp differs from the
+ * last one removed) + 1, or bucket 0 if it is due at that very time.  When
+ * bucket 0 runs dry the lowest non-empty bucket is emptied into the lower
+ * ones around its smallest timestamp.  Every event moves down at most 64
+ * times, inserts are an append to a vector, and there are no pointers to
+ * chase.
+ *
+ * Events due at the same time leave in insertion (uid) order as with the
+ * other schedulers: uids grow with every Schedule, so bucket 0 stays sorted
+ * if it is sorted once after each redistribution.
+ *
+ * Members are defined inline; the program registers the TypeId in its .cc
+ * file, which SelectScheduler () needs to find the scheduler by name.
+ */
+
+#ifndef RADIX_HEAP_SCHEDULER_H
+#define RADIX_HEAP_SCHEDULER_H
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "ns3/fatal-error.h"
+#include "ns3/object-factory.h"
+#include "ns3/scheduler.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+
+class RadixHeapScheduler : public Scheduler
+{
+public:
+  static TypeId GetTypeId (void);
+  RadixHeapScheduler ();
+
+  // inherited from Scheduler
+  virtual void Insert (const Event &ev);
+  virtual bool IsEmpty (void) const;
+  virtual Event PeekNext (void) const;
+  virtual Event RemoveNext (void);
+  virtual void Remove (const Event &ev);
+
+private:
+  static const int N_BUCKETS = 65;
+
+  static bool UidLess (const Event &a, const Event &b) { return a.key.m_uid < b.key.m_uid; }
+  int BucketOf (uint64_t ts) const;
+  /// Make bucket 0 hold the next events, if there are any
+  void Refill (void) const;
+
+  // Refill () runs from PeekNext (), which is const
+  mutable std::vector<Event> m_buckets[N_BUCKETS];
+  mutable size_t m_head;      ///< events before this in bucket 0 are gone
+  mutable uint64_t m_last;    ///< timestamp of bucket 0
+  uint64_t m_size;
+};
+
+inline TypeId
+RadixHeapScheduler::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::RadixHeapScheduler")
+    .SetParent<Scheduler> ()
+    .AddConstructor<RadixHeapScheduler> ()
+  ;
+  return tid;
+}
+
+inline
+RadixHeapScheduler::RadixHeapScheduler ()
+  : m_head (0),
+    m_last (0),
+    m_size (0)
+{
+}
+
+inline int
+RadixHeapScheduler::BucketOf (uint64_t ts) const
+{
+  uint64_t diff = ts ^ m_last;
+  return diff == 0 ? 0 : 64 - __builtin_clzll (diff);
+}
+
+inline void
+RadixHeapScheduler::Insert (const Event &ev)
+{
+  NS_ASSERT (ev.key.m_ts >= m_last);
+  m_buckets[BucketOf (ev.key.m_ts)].push_back (ev);
+  m_size++;
+}
+
+inline bool
+RadixHeapScheduler::IsEmpty (void) const
+{
+  return m_size == 0;
+}
+
+inline void
+RadixHeapScheduler::Refill (void) const
+{
+  std::vector<Event> &zero = m_buckets[0];
+  if (m_head < zero.size ())
+    {
+      return;
+    }
+  zero.clear ();
+  m_head = 0;
+  int b = 1;
+  while (b < N_BUCKETS && m_buckets[b].empty ())
+    {
+      b++;
+    }
+  if (b == N_BUCKETS)
+    {
+      return;
+    }
+  std::vector<Event> &from = m_buckets[b];
+  uint64_t min = from[0].key.m_ts;
+  for (size_t i = 1; i < from.size (); i++)
+    {
+      min = std::min (min, from[i].key.m_ts);
+    }
+  m_last = min;
+  // every event of bucket b lands in a lower bucket
+  for (size_t i = 0; i < from.size (); i++)
+    {
+      m_buckets[BucketOf (from[i].key.m_ts)].push_back (from[i]);
+    }
+  from.clear ();
+  std::sort (zero.begin (), zero.end (), UidLess);
+}
+
+inline Scheduler::Event
+RadixHeapScheduler::PeekNext (void) const
+{
+  NS_ASSERT (m_size > 0);
+  Refill ();
+  return m_buckets[0][m_head];
+}
+
+inline Scheduler::Event
+RadixHeapScheduler::RemoveNext (void)
+{
+  NS_ASSERT (m_size > 0);
+  Refill ();
+  m_size--;
+  return m_buckets[0][m_head++];
+}
+
+inline void
+RadixHeapScheduler::Remove (const Event &ev)
+{
+  std::vector<Event> &bucket = m_buckets[BucketOf (ev.key.m_ts)];
+  size_t first = &bucket == &m_buckets[0] ? m_head : 0;
+  for (size_t i = first; i < bucket.size (); i++)
+    {
+      if (bucket[i].key.m_uid == ev.key.m_uid)
+        {
+          // keep bucket 0 in uid order
+          bucket.erase (bucket.begin () + i);
+          m_size--;
+          return;
+        }
+    }
+  NS_FATAL_ERROR ("Event " << ev.key.m_uid << " is not in the scheduler");
+}
+
+/// Scheduler TypeId for map, heap, list, calendar or radix
+inline std::string
+SchedulerTypeName (const std::string &name)
+{
+  if (name == "map")
+    {
+      return "ns3::MapScheduler";
+    }
+  if (name == "heap")
+    {
+      return "ns3::HeapScheduler";
+    }
+  if (name == "list")
+    {
+      return "ns3::ListScheduler";
+    }
+  if (name == "calendar")
+    {
+      return "ns3::CalendarScheduler";
+    }
+  if (name == "radix")
+    {
+      return "ns3::RadixHeapScheduler";
+    }
+  NS_FATAL_ERROR ("Unknown scheduler \"" << name << "\"; use map, heap, list, calendar or radix");
+  return "";
+}
+
+/// Make the simulator use the scheduler called \p name; pending events move over
+inline void
+SelectScheduler (const std::string &name)
+{
+  ObjectFactory factory;
+  factory.SetTypeId (SchedulerTypeName (name));
+  Simulator::SetScheduler (factory);
+}
+
+} // namespace ns3
+
+#endif /* RADIX_HEAP_SCHEDULER_H */
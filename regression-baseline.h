@@ -0,0 +1,332 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Determinism and performance regression checks against a stored baseline,
+ * shared by adhoc_routing.cc and aodv.cc.
+ *
+ * Both scripts seed the RNG and assign their streams by hand, so a fixed
+ * scenario has to give exactly the same results on every run of the same
+ * build.  A regression run executes a fixed set of scenarios, each in a
+ * forked child of the untouched parent, and compares every result metric
+ * (packets, bytes, delays, event count, ...) bit for bit with the baseline
+ * file.  An optimisation of the channel, the mobility or the tracing that
+ * is meant to be invisible must leave all of them unchanged.
+ *
+ * Wall-clock time and peak RSS differ from run to run, so they are only
+ * checked against a tolerance band: a scenario that got slower or bigger
+ * than the band allows fails, one that got faster or smaller is reported
+ * so the baseline can be recorded again.
+ *
+ * The baseline is a text file with one "<scenario> <metric> <value>" line
+ * per metric; result values are written as hex floats so they read back
+ * exactly.
+ */
+
+#ifndef REGRESSION_BASELINE_H
+#define REGRESSION_BASELINE_H
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "ns3/fatal-error.h"
+#include "trace-level.h"
+
+namespace ns3 {
+
+/// What one scenario produced
+struct RegressionSample
+{
+  RegressionSample () : wallSeconds (0), peakRssKb (0) {}
+
+  /// Add a result that must match the baseline exactly
+  void Add (const std::string &metric, double value)
+  {
+    results.push_back (std::make_pair (metric, value));
+  }
+
+  std::vector<std::pair<std::string, double> > results;
+  double wallSeconds;
+  double peakRssKb;
+};
+
+class RegressionBaseline
+{
+public:
+  RegressionBaseline ()
+    : m_record (false),
+      m_timeTolerance (0.25),
+      m_rssTolerance (0.10),
+      m_scenarios (0),
+      m_compared (0),
+      m_failures (0)
+  {
+  }
+
+  /**
+   * Check against \p fileName, or with \p record collect the samples and
+   * write them to \p fileName in Finish ().  \p timeTolerance and
+   * \p rssTolerance are the relative bands for wall time and peak RSS.
+   */
+  void Open (const std::string &fileName, bool record, double timeTolerance, double rssTolerance)
+  {
+    m_fileName = fileName;
+    m_record = record;
+    m_timeTolerance = timeTolerance;
+    m_rssTolerance = rssTolerance;
+    m_baseline.clear ();
+    m_recorded.clear ();
+    m_scenarios = 0;
+    m_compared = 0;
+    m_failures = 0;
+    if (m_record)
+      {
+        return;
+      }
+    std::FILE *file = std::fopen (fileName.c_str (), "r");
+    if (!file)
+      {
+        NS_FATAL_ERROR ("Cannot read baseline " << fileName << "; record one with --recordBaseline=1");
+      }
+    char line[1024];
+    char scenario[256];
+    char metric[256];
+    char value[64];
+    while (std::fgets (line, sizeof (line), file))
+      {
+        if (line[0] == '#' || std::sscanf (line, "%255s %255s %63s", scenario, metric, value) != 3)
+          {
+            continue;
+          }
+        m_baseline[scenario].push_back (std::make_pair (std::string (metric), std::strtod (value, 0)));
+      }
+    std::fclose (file);
+  }
+
+  /// Compare \p sample with the baseline of \p scenario, or store it
+  void Check (const std::string &scenario, const RegressionSample &sample)
+  {
+    m_scenarios++;
+    if (m_record)
+      {
+        m_recorded.push_back (std::make_pair (scenario, sample));
+        return;
+      }
+    std::map<std::string, Entries>::const_iterator base = m_baseline.find (scenario);
+    if (base == m_baseline.end ())
+      {
+        Fail (scenario, "not in the baseline");
+        return;
+      }
+    const Entries &expected = base->second;
+    for (size_t i = 0; i < sample.results.size (); i++)
+      {
+        const std::string &metric = sample.results[i].first;
+        double now = sample.results[i].second;
+        const double *was = Find (expected, metric);
+        m_compared++;
+        if (!was)
+          {
+            Fail (scenario, metric + " is not in the baseline");
+          }
+        else if (!SameBits (*was, now))
+          {
+            char line[256];
+            std::snprintf (line, sizeof (line), "%s changed from %.17g (%a) to %.17g (%a)",
+                           metric.c_str (), *was, *was, now, now);
+            Fail (scenario, line);
+          }
+      }
+    for (size_t i = 0; i < expected.size (); i++)
+      {
+        if (expected[i].first != "wallSeconds" && expected[i].first != "peakRssKb"
+            && !Find (sample.results, expected[i].first))
+          {
+            Fail (scenario, expected[i].first + " is no longer reported");
+          }
+      }
+    Band (scenario, "wallSeconds", Find (expected, "wallSeconds"), sample.wallSeconds, m_timeTolerance);
+    Band (scenario, "peakRssKb", Find (expected, "peakRssKb"), sample.peakRssKb, m_rssTolerance);
+  }
+
+  /**
+   * Write the baseline if recording and print a summary to \p os.
+   * \return true if every scenario matched
+   */
+  bool Finish (std::ostream &os)
+  {
+    if (m_record)
+      {
+        Write ();
+        os << "Baseline of " << m_scenarios << " scenarios written to " << m_fileName << "\n";
+        return true;
+      }
+    os << "Regression check against " << m_fileName << ": " << m_scenarios << " scenarios, "
+       << m_compared << " results compared, " << m_failures << " failures\n";
+    if (m_failures > 0)
+      {
+        os << "REGRESSION CHECK FAILED\n";
+      }
+    return m_failures == 0;
+  }
+
+private:
+  typedef std::vector<std::pair<std::string, double> > Entries;
+
+  static const double *Find (const Entries &entries, const std::string &metric)
+  {
+    for (size_t i = 0; i < entries.size (); i++)
+      {
+        if (entries[i].first == metric)
+          {
+            return &entries[i].second;
+          }
+      }
+    return 0;
+  }
+
+  static bool SameBits (double a, double b)
+  {
+    return std::memcmp (&a, &b, sizeof (double)) == 0;
+  }
+
+  void Fail (const std::string &scenario, const std::string &what)
+  {
+    std::cerr << "REGRESSION " << scenario << ": " << what << "\n";
+    m_failures++;
+  }
+
+  void Band (const std::string &scenario, const std::string &metric, const double *was, double now,
+             double tolerance)
+  {
+    if (!was)
+      {
+        Fail (scenario, metric + " is not in the baseline");
+        return;
+      }
+    char line[256];
+    if (now > *was * (1 + tolerance))
+      {
+        std::snprintf (line, sizeof (line), "%s grew from %.3f to %.3f, more than %.0f%%",
+                       metric.c_str (), *was, now, tolerance * 100);
+        Fail (scenario, line);
+      }
+    else if (now < *was * (1 - tolerance))
+      {
+        std::snprintf (line, sizeof (line), "%s fell from %.3f to %.3f; record the baseline again to keep the gain",
+                       metric.c_str (), *was, now);
+        std::cerr << "note: " << scenario << ": " << line << "\n";
+      }
+  }
+
+  void Write () const
+  {
+    std::FILE *file = std::fopen (m_fileName.c_str (), "w");
+    if (!file)
+      {
+        NS_FATAL_ERROR ("Cannot write baseline " << m_fileName);
+      }
+    std::fprintf (file, "# scenario metric value; results must match exactly, wallSeconds and peakRssKb within a band\n");
+    for (size_t s = 0; s < m_recorded.size (); s++)
+      {
+        const char *scenario = m_recorded[s].first.c_str ();
+        const RegressionSample &sample = m_recorded[s].second;
+        for (size_t i = 0; i < sample.results.size (); i++)
+          {
+            std::fprintf (file, "%s %s %a\n", scenario, sample.results[i].first.c_str (), sample.results[i].second);
+          }
+        std::fprintf (file, "%s wallSeconds %.3f\n", scenario, sample.wallSeconds);
+        std::fprintf (file, "%s peakRssKb %.0f\n", scenario, sample.peakRssKb);
+      }
+    std::fclose (file);
+  }
+
+  std::string m_fileName;
+  bool m_record;
+  double m_timeTolerance;
+  double m_rssTolerance;
+  std::map<std::string, Entries> m_baseline;
+  std::vector<std::pair<std::string, RegressionSample> > m_recorded;
+  uint32_t m_scenarios;
+  uint32_t m_compared;
+  uint32_t m_failures;
+};
+
+/**
+ * Run \p run in a forked child and return the results it adds to its
+ * sample, with the wall-clock time and peak RSS of the child.  Every call
+ * starts from the same parent state, so the process-wide RNG stream
+ * counter and the node ids do not depend on the scenarios run before.
+ */
+inline RegressionSample
+RunIsolated (std::function<void (RegressionSample &)> run)
+{
+  int fds[2];
+  if (pipe (fds) != 0)
+    {
+      NS_FATAL_ERROR ("pipe() failed: " << strerror (errno));
+    }
+  std::cout.flush ();
+  double start = WallClockSeconds ();
+  pid_t pid = fork ();
+  if (pid < 0)
+    {
+      NS_FATAL_ERROR ("fork() failed: " << strerror (errno));
+    }
+  if (pid == 0)
+    {
+      close (fds[0]);
+      RegressionSample sample;
+      run (sample);
+      std::FILE *out = fdopen (fds[1], "w");
+      for (size_t i = 0; out && i < sample.results.size (); i++)
+        {
+          std::fprintf (out, "%s %a\n", sample.results[i].first.c_str (), sample.results[i].second);
+        }
+      std::cout.flush ();
+      _exit (out && std::fclose (out) == 0 ? 0 : 1);
+    }
+  close (fds[1]);
+
+  // read everything before waiting, so a child with many results cannot block on a full pipe
+  RegressionSample sample;
+  std::FILE *in = fdopen (fds[0], "r");
+  char metric[256];
+  char value[64];
+  while (in && std::fscanf (in, "%255s %63s", metric, value) == 2)
+    {
+      sample.Add (metric, std::strtod (value, 0));
+    }
+  if (in)
+    {
+      std::fclose (in);
+    }
+  int status;
+  struct rusage usage;
+  while (wait4 (pid, &status, 0, &usage) < 0)
+    {
+      if (errno != EINTR)
+        {
+          NS_FATAL_ERROR ("wait4() failed");
+        }
+    }
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    {
+      NS_FATAL_ERROR ("Regression scenario failed in child " << pid);
+    }
+  sample.wallSeconds = WallClockSeconds () - start;
+  sample.peakRssKb = usage.ru_maxrss;
+  return sample;
+}
+
+} // namespace ns3
+
+#endif /* REGRESSION_BASELINE_H */
@@ -0,0 +1,524 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Periodic routing table snapshots stored as binary deltas.
+ *
+ * Every interval the routing table of each node is read and compared with
+ * the previous snapshot; only routes that appeared, disappeared or changed
+ * next hop or hop count are written, as fixed-size RouteDeltaRecords.  The
+ * same comparison feeds the analytics: route and next-hop lifetimes, churn
+ * rate and next-hop flapping (a route going back to the next hop it had
+ * before the current one).
+ *
+ * Tables are read as they are, with no text in between:
+ * GetRoutingTableEntries () for OLSR, and for AODV and DSDV the
+ * GetRoutingTable ().GetEntries () accessors that
+ * ns-3-routing-table-access.sh adds to ns-3.  Their own lookups purge
+ * expired routes and would change the simulation.  Without the accessors
+ * CanSnapshot () is false for AODV and DSDV, and the scripts refuse
+ * --routeSnapshots for them.  DSR is never supported: its route cache can
+ * only be read through LookupRoute (), which purges and reorders it.
+ * Only usable routes count: AODV routes that are DOWN or IN_SEARCH or
+ * whose lifetime ran out, and invalid DSDV routes, are skipped, and so are
+ * routes to the node itself, loopback and broadcast.
+ *
+ * File layout: RouteSnapshotHeader followed by RouteDeltaRecords in time
+ * order.
+ */
+
+#ifndef ROUTE_SNAPSHOTS_H
+#define ROUTE_SNAPSHOTS_H
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ns3/aodv-routing-protocol.h"
+#include "ns3/dsdv-routing-protocol.h"
+#include "ns3/fatal-error.h"
+#include "ns3/ipv4-list-routing.h"
+#include "ns3/ipv4.h"
+#include "ns3/node-container.h"
+#include "ns3/olsr-routing-protocol.h"
+#include "ns3/simulator.h"
+#include "flow-stats.h"
+
+namespace ns3 {
+
+struct RouteSnapshotHeader
+{
+  char magic[8];         ///< "NS3ROUT1"
+  uint32_t recordSize;   ///< sizeof (RouteDeltaRecord)
+  uint32_t nNodes;
+  double interval;       ///< s
+};
+
+struct RouteDeltaRecord
+{
+  enum Type
+  {
+    ADDED = 0,
+    REMOVED = 1,
+    CHANGED = 2          ///< new next hop or hop count
+  };
+  double time;           ///< s
+  uint32_t node;         ///< node id
+  uint32_t destination;  ///< IPv4 address, host byte order
+  uint32_t nextHop;      ///< 0 for REMOVED
+  uint16_t hops;
+  uint8_t type;
+  uint8_t reserved;
+};
+
+/// True if T has the GetRoutingTable ().GetEntries () accessors of ns-3-routing-table-access.sh
+template <class T, class = void>
+struct HasRouteAccessors : std::false_type
+{
+};
+template <class T>
+struct HasRouteAccessors<T, decltype (void (std::declval<const T &> ().GetRoutingTable ().GetEntries ()))>
+  : std::true_type
+{
+};
+
+/// Find a routing protocol of type T on \p node, also inside an Ipv4ListRouting
+template <class T>
+Ptr<T>
+FindRoutingProtocol (Ptr<Node> node)
+{
+  Ptr<Ipv4> ipv4 = node->GetObject<Ipv4> ();
+  if (!ipv4 || !ipv4->GetRoutingProtocol ())
+    {
+      return 0;
+    }
+  Ptr<Ipv4RoutingProtocol> routing = ipv4->GetRoutingProtocol ();
+  Ptr<T> found = DynamicCast<T> (routing);
+  Ptr<Ipv4ListRouting> list = DynamicCast<Ipv4ListRouting> (routing);
+  for (uint32_t i = 0; !found && list && i < list->GetNRoutingProtocols (); i++)
+    {
+      int16_t priority;
+      found = DynamicCast<T> (list->GetRoutingProtocol (i, priority));
+    }
+  return found;
+}
+
+class RouteSnapshotter
+{
+public:
+  RouteSnapshotter ()
+    : m_file (0),
+      m_running (false)
+  {
+  }
+
+  ~RouteSnapshotter ()
+  {
+    if (m_file)
+      {
+        Flush ();
+        std::fclose (m_file);
+      }
+  }
+
+  /// True if the tables of \p protocol (OLSR, AODV, DSDV or DSR) can be read without changing them
+  static bool CanSnapshot (const std::string &protocol)
+  {
+    if (protocol == "OLSR")
+      {
+        return true;
+      }
+    if (protocol == "AODV")
+      {
+        return HasRouteAccessors<aodv::RoutingProtocol>::value;
+      }
+    if (protocol == "DSDV")
+      {
+        return HasRouteAccessors<dsdv::RoutingProtocol>::value;
+      }
+    return false;
+  }
+
+  /**
+   * Snapshot the routing tables of \p nodes now and every \p interval from
+   * then on.  Deltas go to \p fileName; with an empty name only the
+   * analytics are kept.
+   */
+  void Start (NodeContainer nodes, Time interval, const std::string &fileName)
+  {
+    if (m_file)
+      {
+        std::fclose (m_file);
+        m_file = 0;
+      }
+    m_buffer.clear ();
+    m_interval = interval;
+    m_nodes.clear ();
+    for (NodeContainer::Iterator i = nodes.Begin (); i != nodes.End (); ++i)
+      {
+        NodeRoutes n;
+        n.node = *i;
+        n.resolved = false;
+        Ptr<Ipv4> ipv4 = (*i)->GetObject<Ipv4> ();
+        for (uint32_t j = 0; ipv4 && j < ipv4->GetNInterfaces (); j++)
+          {
+            for (uint32_t k = 0; k < ipv4->GetNAddresses (j); k++)
+              {
+                Ipv4InterfaceAddress address = ipv4->GetAddress (j, k);
+                n.excluded.push_back (address.GetLocal ().Get ());
+                n.excluded.push_back (address.GetBroadcast ().Get ());
+              }
+          }
+        std::sort (n.excluded.begin (), n.excluded.end ());
+        m_nodes.push_back (n);
+      }
+
+    if (!fileName.empty ())
+      {
+        m_file = std::fopen (fileName.c_str (), "wb");
+        if (!m_file)
+          {
+            NS_FATAL_ERROR ("Cannot open route snapshot file " << fileName);
+          }
+        RouteSnapshotHeader header;
+        std::memcpy (header.magic, "NS3ROUT1", 8);
+        header.recordSize = sizeof (RouteDeltaRecord);
+        header.nNodes = m_nodes.size ();
+        header.interval = interval.GetSeconds ();
+        std::fwrite (&header, sizeof (header), 1, m_file);
+        m_buffer.reserve (BUFFER_RECORDS);
+      }
+    m_stats = Stats ();
+    m_running = true;
+    m_event = Simulator::ScheduleNow (&RouteSnapshotter::Snapshot, this);
+  }
+
+  /// Take a last snapshot, close out the routes still up and close the file
+  void Stop ()
+  {
+    if (!m_running)
+      {
+        return;
+      }
+    m_event.Cancel ();
+    if (m_stats.last < Simulator::Now ().GetSeconds ())
+      {
+        TakeSnapshot ();
+      }
+    for (size_t i = 0; i < m_nodes.size (); i++)
+      {
+        m_stats.upAtEnd += m_nodes[i].routes.size ();
+      }
+    if (m_file)
+      {
+        Flush ();
+        std::fclose (m_file);
+        m_file = 0;
+      }
+    m_running = false;
+  }
+
+  void PrintStats (std::ostream &os) const
+  {
+    double span = m_stats.last - m_stats.first;
+    uint64_t changes = m_stats.added + m_stats.removed + m_stats.nextHopChanges;
+    os << "Route snapshots: " << m_stats.snapshots << " x " << m_nodes.size () << " nodes every "
+       << m_interval.GetSeconds () << " s, " << m_stats.entries << " entries read, "
+       << m_stats.deltas << " deltas\n";
+    os << "  routes added " << m_stats.added << ", removed " << m_stats.removed
+       << ", next hop changed " << m_stats.nextHopChanges << ", hop count changed " << m_stats.hopChanges
+       << ", up at the end " << m_stats.upAtEnd << "\n";
+    os << "  churn: " << (span > 0 ? changes / span : 0) << " changes/s, "
+       << (span > 0 && !m_nodes.empty () ? changes / span / m_nodes.size () : 0) << " per node\n";
+    os << "  route lifetime: mean " << m_stats.routeLifetime.GetMean () << " s, std dev "
+       << m_stats.routeLifetime.GetStdDev () << ", min " << m_stats.routeLifetime.GetMin ()
+       << ", max " << m_stats.routeLifetime.GetMax () << " (" << m_stats.routeLifetime.GetCount () << " routes ended)\n";
+    os << "  next hop lifetime: mean " << m_stats.nextHopLifetime.GetMean () << " s, std dev "
+       << m_stats.nextHopLifetime.GetStdDev () << " (" << m_stats.nextHopLifetime.GetCount () << " next hops ended)\n";
+    os << "  next hop flaps: " << m_stats.flaps << " on " << m_stats.flappingRoutes << " routes\n";
+  }
+
+private:
+  static const size_t BUFFER_RECORDS = 65536;
+
+  struct RouteEntry
+  {
+    uint32_t destination;
+    uint32_t nextHop;
+    uint16_t hops;
+    bool operator< (const RouteEntry &o) const { return destination < o.destination; }
+  };
+
+  struct RouteState
+  {
+    uint32_t destination;
+    uint32_t nextHop;
+    uint32_t previousNextHop;  ///< 0 until the next hop changed once
+    uint16_t hops;
+    bool flapped;
+    double since;              ///< route up since, s
+    double nextHopSince;       ///< current next hop used since, s
+  };
+
+  struct NodeRoutes
+  {
+    Ptr<Node> node;
+    bool resolved;
+    Ptr<aodv::RoutingProtocol> aodv;
+    Ptr<dsdv::RoutingProtocol> dsdv;
+    Ptr<olsr::RoutingProtocol> olsr;
+    std::vector<uint32_t> excluded;   ///< own and broadcast addresses, sorted
+    std::vector<RouteState> routes;   ///< sorted by destination
+  };
+
+  struct Stats
+  {
+    Stats ()
+      : snapshots (0), entries (0), deltas (0), added (0), removed (0),
+        nextHopChanges (0), hopChanges (0), flaps (0), flappingRoutes (0), upAtEnd (0),
+        first (-1), last (-1)
+    {
+    }
+    uint64_t snapshots;
+    uint64_t entries;
+    uint64_t deltas;
+    uint64_t added;
+    uint64_t removed;
+    uint64_t nextHopChanges;
+    uint64_t hopChanges;
+    uint64_t flaps;
+    uint64_t flappingRoutes;
+    uint64_t upAtEnd;
+    double first;
+    double last;
+    OnlineStats routeLifetime;
+    OnlineStats nextHopLifetime;
+  };
+
+  void Snapshot ()
+  {
+    TakeSnapshot ();
+    m_event = Simulator::Schedule (m_interval, &RouteSnapshotter::Snapshot, this);
+  }
+
+  void TakeSnapshot ()
+  {
+    double now = Simulator::Now ().GetSeconds ();
+    if (m_stats.first < 0)
+      {
+        m_stats.first = now;
+      }
+    m_stats.last = now;
+    m_stats.snapshots++;
+    for (size_t i = 0; i < m_nodes.size (); i++)
+      {
+        NodeRoutes &n = m_nodes[i];
+        m_current.clear ();
+        ReadTable (n, m_current);
+        std::sort (m_current.begin (), m_current.end ());
+        m_stats.entries += m_current.size ();
+        Compare (n, now);
+      }
+  }
+
+  /// Put the usable routes of \p n into \p table
+  void ReadTable (NodeRoutes &n, std::vector<RouteEntry> &table)
+  {
+    if (!n.resolved)
+      {
+        // routing protocols finish their setup when the simulation starts
+        n.aodv = FindRoutingProtocol<aodv::RoutingProtocol> (n.node);
+        n.dsdv = FindRoutingProtocol<dsdv::RoutingProtocol> (n.node);
+        n.olsr = FindRoutingProtocol<olsr::RoutingProtocol> (n.node);
+        n.resolved = true;
+      }
+
+    if (n.olsr)
+      {
+        std::vector<olsr::RoutingTableEntry> entries = n.olsr->GetRoutingTableEntries ();
+        for (size_t j = 0; j < entries.size (); j++)
+          {
+            Add (n, table, entries[j].destAddr.Get (), entries[j].nextAddr.Get (), entries[j].distance);
+          }
+      }
+    else if (n.aodv)
+      {
+        ReadAodv (*n.aodv, n, table, HasRouteAccessors<aodv::RoutingProtocol> ());
+      }
+    else if (n.dsdv)
+      {
+        ReadDsdv (*n.dsdv, n, table, HasRouteAccessors<dsdv::RoutingProtocol> ());
+      }
+  }
+
+  // Templates, so the accessors are only named where they exist
+  template <class Protocol>
+  void ReadAodv (const Protocol &protocol, const NodeRoutes &n, std::vector<RouteEntry> &table, std::true_type)
+  {
+    // a VALID route whose lifetime ran out is DOWN once purged
+    for (const auto &it : protocol.GetRoutingTable ().GetEntries ())
+      {
+        if (it.second.GetFlag () == aodv::VALID && it.second.GetLifeTime () >= Seconds (0))
+          {
+            Add (n, table, it.first.Get (), it.second.GetNextHop ().Get (), it.second.GetHop ());
+          }
+      }
+  }
+
+  template <class Protocol>
+  void ReadDsdv (const Protocol &protocol, const NodeRoutes &n, std::vector<RouteEntry> &table, std::true_type)
+  {
+    for (const auto &it : protocol.GetRoutingTable ().GetEntries ())
+      {
+        if (it.second.GetFlag () == dsdv::VALID)
+          {
+            Add (n, table, it.first.Get (), it.second.GetNextHop ().Get (), it.second.GetHop ());
+          }
+      }
+  }
+
+  template <class Protocol>
+  void ReadAodv (const Protocol &, const NodeRoutes &, std::vector<RouteEntry> &, std::false_type)
+  {
+    NS_FATAL_ERROR ("AODV route snapshots need the accessors of ns-3-routing-table-access.sh");
+  }
+
+  template <class Protocol>
+  void ReadDsdv (const Protocol &, const NodeRoutes &, std::vector<RouteEntry> &, std::false_type)
+  {
+    NS_FATAL_ERROR ("DSDV route snapshots need the accessors of ns-3-routing-table-access.sh");
+  }
+
+  void Add (const NodeRoutes &n, std::vector<RouteEntry> &table, uint32_t destination, uint32_t nextHop, int hops)
+  {
+    if ((destination >> 24) == 127 || Ipv4Address (destination).IsBroadcast ()
+        || std::binary_search (n.excluded.begin (), n.excluded.end (), destination))
+      {
+        return;
+      }
+    RouteEntry e;
+    e.destination = destination;
+    e.nextHop = nextHop;
+    e.hops = hops;
+    table.push_back (e);
+  }
+
+  /// Merge the sorted m_current into the routes of \p n, recording every difference
+  void Compare (NodeRoutes &n, double now)
+  {
+    std::vector<RouteState> &old = n.routes;
+    m_next.clear ();
+    size_t i = 0;
+    size_t j = 0;
+    while (i < old.size () || j < m_current.size ())
+      {
+        if (j == m_current.size () || (i < old.size () && old[i].destination < m_current[j].destination))
+          {
+            // route gone
+            m_stats.removed++;
+            m_stats.routeLifetime.Add (now - old[i].since);
+            m_stats.nextHopLifetime.Add (now - old[i].nextHopSince);
+            Write (now, n, old[i].destination, 0, 0, RouteDeltaRecord::REMOVED);
+            i++;
+          }
+        else if (i == old.size () || m_current[j].destination < old[i].destination)
+          {
+            // new route
+            const RouteEntry &e = m_current[j];
+            RouteState s;
+            s.destination = e.destination;
+            s.nextHop = e.nextHop;
+            s.previousNextHop = 0;
+            s.hops = e.hops;
+            s.flapped = false;
+            s.since = now;
+            s.nextHopSince = now;
+            m_next.push_back (s);
+            m_stats.added++;
+            Write (now, n, e.destination, e.nextHop, e.hops, RouteDeltaRecord::ADDED);
+            j++;
+          }
+        else
+          {
+            RouteState s = old[i];
+            const RouteEntry &e = m_current[j];
+            if (e.nextHop != s.nextHop || e.hops != s.hops)
+              {
+                Write (now, n, e.destination, e.nextHop, e.hops, RouteDeltaRecord::CHANGED);
+              }
+            if (e.nextHop != s.nextHop)
+              {
+                m_stats.nextHopChanges++;
+                m_stats.nextHopLifetime.Add (now - s.nextHopSince);
+                if (e.nextHop == s.previousNextHop)
+                  {
+                    m_stats.flaps++;
+                    if (!s.flapped)
+                      {
+                        m_stats.flappingRoutes++;
+                        s.flapped = true;
+                      }
+                  }
+                s.previousNextHop = s.nextHop;
+                s.nextHop = e.nextHop;
+                s.nextHopSince = now;
+              }
+            else if (e.hops != s.hops)
+              {
+                m_stats.hopChanges++;
+              }
+            s.hops = e.hops;
+            m_next.push_back (s);
+            i++;
+            j++;
+          }
+      }
+    old.swap (m_next);
+  }
+
+  void Write (double now, const NodeRoutes &n, uint32_t destination, uint32_t nextHop, uint16_t hops, uint8_t type)
+  {
+    m_stats.deltas++;
+    if (!m_file)
+      {
+        return;
+      }
+    RouteDeltaRecord r;
+    r.time = now;
+    r.node = n.node->GetId ();
+    r.destination = destination;
+    r.nextHop = nextHop;
+    r.hops = hops;
+    r.type = type;
+    r.reserved = 0;
+    m_buffer.push_back (r);
+    if (m_buffer.size () == BUFFER_RECORDS)
+      {
+        Flush ();
+      }
+  }
+
+  void Flush ()
+  {
+    std::fwrite (m_buffer.data (), sizeof (RouteDeltaRecord), m_buffer.size (), m_file);
+    m_buffer.clear ();
+  }
+
+  std::vector<NodeRoutes> m_nodes;
+  Time m_interval;
+  std::FILE *m_file;
+  std::vector<RouteDeltaRecord> m_buffer;
+  bool m_running;
+  EventId m_event;
+  Stats m_stats;
+  // scratch space reused by every snapshot
+  std::vector<RouteEntry> m_current;
+  std::vector<RouteState> m_next;
+};
+
+} // namespace ns3
+
+#endif /* ROUTE_SNAPSHOTS_H */
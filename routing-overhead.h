@@ -0,0 +1,318 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Routing control overhead accounting.
+ *
+ * Every frame a Wi-Fi PHY transmits is classified from its headers, so MAC
+ * retransmissions and every hop of a flooded message count, and the airtime
+ * is that of the frame actually sent.  Frames carrying AODV (UDP 654), OLSR
+ * (UDP 698), DSDV (UDP 269) or DSR control messages (DSR message type 1)
+ * are counted per message type, per node and per simulated second; data,
+ * ARP and MAC control frames are ignored.  Only header deserialization is
+ * involved, no packet printing or pcap files.
+ */
+
+#ifndef ROUTING_OVERHEAD_H
+#define ROUTING_OVERHEAD_H
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ns3/aodv-packet.h"
+#include "ns3/dsr-fs-header.h"
+#include "ns3/ipv4-header.h"
+#include "ns3/llc-snap-header.h"
+#include "ns3/net-device-container.h"
+#include "ns3/olsr-header.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+#include "ns3/udp-header.h"
+#include "ns3/wifi-mac-header.h"
+#include "ns3/wifi-net-device.h"
+#include "ns3/wifi-phy.h"
+
+namespace ns3 {
+
+class RoutingOverheadMonitor
+{
+public:
+  enum Category
+  {
+    AODV_RREQ,
+    AODV_RREP,
+    AODV_HELLO,      ///< broadcast RREP with TTL 1
+    AODV_RERR,
+    AODV_OTHER,
+    OLSR_HELLO,
+    OLSR_TC,
+    OLSR_OTHER,
+    DSDV_UPDATE,
+    DSR_RREQ,
+    DSR_RREP,
+    DSR_RERR,
+    DSR_OTHER,
+    N_CATEGORIES
+  };
+
+  static const char *CategoryName (Category c)
+  {
+    static const char *names[N_CATEGORIES] = {
+      "AODV RREQ", "AODV RREP", "AODV HELLO", "AODV RERR", "AODV other",
+      "OLSR HELLO", "OLSR TC", "OLSR other", "DSDV update",
+      "DSR RREQ", "DSR RREP", "DSR RERR", "DSR other"
+    };
+    return names[c];
+  }
+
+  struct Counter
+  {
+    Counter () : packets (0), bytes (0), airtime (0) {}
+    void Add (uint32_t size, double duration)
+    {
+      packets++;
+      bytes += size;
+      airtime += duration;
+    }
+    void Merge (const Counter &o)
+    {
+      packets += o.packets;
+      bytes += o.bytes;
+      airtime += o.airtime;
+    }
+    uint64_t packets;
+    uint64_t bytes;    ///< whole frames, MAC header included
+    double airtime;    ///< s
+  };
+
+  RoutingOverheadMonitor () {}
+
+  /// Forget all counts and devices
+  void Reset ()
+  {
+    ClearCounts ();
+    m_probes.clear ();
+  }
+
+  /// Forget all counts but keep counting on the installed devices
+  void ClearCounts ()
+  {
+    for (int c = 0; c < N_CATEGORIES; c++)
+      {
+        m_categories[c] = Counter ();
+      }
+    m_nodes.clear ();
+    m_seconds.clear ();
+  }
+
+  /// Count the control frames sent by the Wi-Fi devices in \p devices
+  void Install (NetDeviceContainer devices)
+  {
+    for (NetDeviceContainer::Iterator i = devices.Begin (); i != devices.End (); ++i)
+      {
+        Ptr<WifiNetDevice> device = DynamicCast<WifiNetDevice> (*i);
+        if (!device)
+          {
+            continue;
+          }
+        Ptr<TxProbe> probe = Create<TxProbe> (this, device->GetNode ()->GetId (), device->GetPhy ());
+        m_probes.push_back (probe);
+        device->GetPhy ()->TraceConnectWithoutContext ("MonitorSnifferTx", MakeCallback (&TxProbe::Tx, PeekPointer (probe)));
+      }
+  }
+
+  Counter GetTotal () const
+  {
+    Counter total;
+    for (int c = 0; c < N_CATEGORIES; c++)
+      {
+        total.Merge (m_categories[c]);
+      }
+    return total;
+  }
+
+  /**
+   * Print the counts per message type and the normalized routing load,
+   * control bytes sent per data byte delivered (\p deliveredBytes).
+   */
+  void PrintSummary (std::ostream &os, uint64_t deliveredBytes, uint32_t nNodes, double seconds) const
+  {
+    Counter total = GetTotal ();
+    os << "Routing overhead   Packets       Bytes  Airtime(s)\n";
+    for (int c = 0; c < N_CATEGORIES; c++)
+      {
+        const Counter &k = m_categories[c];
+        if (k.packets > 0)
+          {
+            os << std::left << std::setw (14) << CategoryName (static_cast<Category> (c)) << std::right
+               << std::setw (12) << k.packets << std::setw (12) << k.bytes << std::setw (12) << k.airtime << "\n";
+          }
+      }
+    os << std::left << std::setw (14) << "total" << std::right
+       << std::setw (12) << total.packets << std::setw (12) << total.bytes << std::setw (12) << total.airtime << "\n";
+    if (nNodes > 0 && seconds > 0)
+      {
+        os << "  per node and second: " << total.packets / nNodes / seconds << " packets, "
+           << total.bytes / nNodes / seconds << " bytes, "
+           << total.airtime / nNodes / seconds * 100 << "% airtime\n";
+      }
+    os << "  normalized routing load: " << (deliveredBytes ? double (total.bytes) / deliveredBytes : 0)
+       << " control bytes per delivered data byte\n";
+  }
+
+  /// Write "<prefix>-nodes.csv" (per node) and "<prefix>-time.csv" (per second)
+  void WriteCsv (const std::string &prefix) const
+  {
+    std::ofstream nodes ((prefix + "-nodes.csv").c_str ());
+    nodes << "Node,Packets,Bytes,Airtime\n";
+    for (size_t i = 0; i < m_nodes.size (); i++)
+      {
+        nodes << i << "," << m_nodes[i].packets << "," << m_nodes[i].bytes << "," << m_nodes[i].airtime << "\n";
+      }
+    std::ofstream time ((prefix + "-time.csv").c_str ());
+    time << "Second,Packets,Bytes,Airtime\n";
+    for (size_t i = 0; i < m_seconds.size (); i++)
+      {
+        time << i << "," << m_seconds[i].packets << "," << m_seconds[i].bytes << "," << m_seconds[i].airtime << "\n";
+      }
+  }
+
+private:
+  class TxProbe : public SimpleRefCount<TxProbe>
+  {
+  public:
+    TxProbe (RoutingOverheadMonitor *monitor, uint32_t node, Ptr<WifiPhy> phy)
+      : m_monitor (monitor), m_node (node), m_phy (phy) {}
+    void Tx (Ptr<const Packet> packet, uint16_t channelFreqMhz, WifiTxVector txVector, MpduInfo)
+    {
+      int c = Classify (packet);
+      if (c >= 0)
+        {
+          double airtime = m_phy->CalculateTxDuration (packet->GetSize (), txVector, channelFreqMhz).GetSeconds ();
+          m_monitor->Count (static_cast<Category> (c), m_node, packet->GetSize (), airtime);
+        }
+    }
+  private:
+    RoutingOverheadMonitor *m_monitor;
+    uint32_t m_node;
+    Ptr<WifiPhy> m_phy;
+  };
+
+  /// Category of a transmitted frame, or -1 if it is no routing control frame
+  static int Classify (Ptr<const Packet> frame)
+  {
+    Ptr<Packet> p = frame->Copy ();
+    WifiMacHeader mac;
+    p->RemoveHeader (mac);
+    if (!mac.IsData ())
+      {
+        return -1;
+      }
+    LlcSnapHeader llc;
+    p->RemoveHeader (llc);
+    if (llc.GetType () != 0x0800)
+      {
+        return -1;
+      }
+    Ipv4Header ip;
+    p->RemoveHeader (ip);
+    if (ip.GetProtocol () == 17)
+      {
+        UdpHeader udp;
+        p->RemoveHeader (udp);
+        switch (udp.GetDestinationPort ())
+          {
+          case 654:
+            {
+              aodv::TypeHeader type;
+              p->RemoveHeader (type);
+              switch (type.Get ())
+                {
+                case aodv::AODVTYPE_RREQ:
+                  return AODV_RREQ;
+                case aodv::AODVTYPE_RREP:
+                  // hellos are the only broadcast RREPs
+                  return mac.GetAddr1 ().IsBroadcast () ? AODV_HELLO : AODV_RREP;
+                case aodv::AODVTYPE_RERR:
+                  return AODV_RERR;
+                default:
+                  return AODV_OTHER;
+                }
+            }
+          case 698:
+            {
+              olsr::PacketHeader packetHeader;
+              olsr::MessageHeader message;
+              p->RemoveHeader (packetHeader);
+              if (p->GetSize () == 0)
+                {
+                  return OLSR_OTHER;
+                }
+              // a packet bundling several messages counts as its first one
+              p->RemoveHeader (message);
+              switch (message.GetMessageType ())
+                {
+                case olsr::MessageHeader::HELLO_MESSAGE:
+                  return OLSR_HELLO;
+                case olsr::MessageHeader::TC_MESSAGE:
+                  return OLSR_TC;
+                default:
+                  return OLSR_OTHER;
+                }
+            }
+          case 269:
+            return DSDV_UPDATE;
+          default:
+            return -1;
+          }
+      }
+    if (ip.GetProtocol () == 48)
+      {
+        dsr::DsrFixedSizeHeader dsrHeader;
+        p->RemoveHeader (dsrHeader);
+        if (dsrHeader.GetMessageType () != 1)
+          {
+            return -1; // data carrying a source route
+          }
+        uint8_t option = 0;
+        p->CopyData (&option, 1);
+        switch (option)
+          {
+          case 1:
+            return DSR_RREQ;
+          case 2:
+            return DSR_RREP;
+          case 3:
+            return DSR_RERR;
+          default:
+            return DSR_OTHER;
+          }
+      }
+    return -1;
+  }
+
+  void Count (Category c, uint32_t node, uint32_t size, double airtime)
+  {
+    m_categories[c].Add (size, airtime);
+    if (node >= m_nodes.size ())
+      {
+        m_nodes.resize (node + 1);
+      }
+    m_nodes[node].Add (size, airtime);
+    size_t second = Simulator::Now ().GetSeconds ();
+    if (second >= m_seconds.size ())
+      {
+        m_seconds.resize (second + 1);
+      }
+    m_seconds[second].Add (size, airtime);
+  }
+
+  Counter m_categories[N_CATEGORIES];
+  std::vector<Counter> m_nodes;    ///< indexed by node id
+  std::vector<Counter> m_seconds;  ///< indexed by simulated second
+  std::vector<Ptr<TxProbe> > m_probes;
+};
+
+} // namespace ns3
+
+#endif /* ROUTING_OVERHEAD_H */
@@ -0,0 +1,132 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Trace levels shared by adhoc_routing.cc and aodv.cc.
+ *
+ * none    - no trace files at all, results are only printed
+ * metrics - CSV time series, flow statistics and routing overhead
+ * debug   - adds packet printing, mobility traces, FlowMonitor XML and
+ *           routing table dumps
+ * full    - adds pcap, NetAnim and verbose mobility logging
+ */
+
+#ifndef TRACE_LEVEL_H
+#define TRACE_LEVEL_H
+
+#include <cerrno>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "ns3/fatal-error.h"
+
+enum TraceLevel
+{
+  TRACE_NONE = 0,
+  TRACE_METRICS = 1,
+  TRACE_DEBUG = 2,
+  TRACE_FULL = 3
+};
+
+inline const char *
+TraceLevelName (TraceLevel level)
+{
+  switch (level)
+    {
+    case TRACE_NONE:
+      return "none";
+    case TRACE_METRICS:
+      return "metrics";
+    case TRACE_DEBUG:
+      return "debug";
+    case TRACE_FULL:
+      return "full";
+    }
+  return "unknown";
+}
+
+/// Parse "none", "metrics", "debug" or "full"; aborts on anything else
+inline TraceLevel
+ParseTraceLevel (const std::string &name)
+{
+  for (int level = TRACE_NONE; level <= TRACE_FULL; level++)
+    {
+      if (name == TraceLevelName (static_cast<TraceLevel> (level)))
+        {
+          return static_cast<TraceLevel> (level);
+        }
+    }
+  NS_FATAL_ERROR ("No such trace level: " << name << " (none|metrics|debug|full)");
+  return TRACE_NONE;
+}
+
+inline double
+WallClockSeconds ()
+{
+  struct timeval tv;
+  gettimeofday (&tv, 0);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * Run the same scenario once per trace level, each in a forked child so the
+ * peak RSS of one level does not leak into the next, and print the
+ * wall-clock time and peak RSS saved relative to the full level.
+ */
+inline void
+ReportTraceLevelCost (std::ostream &os, std::function<void (TraceLevel)> run)
+{
+  double wall[TRACE_FULL + 1];
+  long rss[TRACE_FULL + 1];
+  for (int level = TRACE_FULL; level >= TRACE_NONE; level--)
+    {
+      std::cout.flush ();
+      double start = WallClockSeconds ();
+      pid_t pid = fork ();
+      if (pid < 0)
+        {
+          NS_FATAL_ERROR ("fork() failed");
+        }
+      if (pid == 0)
+        {
+          run (static_cast<TraceLevel> (level));
+          std::cout.flush ();
+          _exit (0);
+        }
+      int status;
+      struct rusage usage;
+      while (wait4 (pid, &status, 0, &usage) < 0)
+        {
+          if (errno != EINTR)
+            {
+              NS_FATAL_ERROR ("wait4() failed");
+            }
+        }
+      if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        {
+          NS_FATAL_ERROR ("Trace level " << TraceLevelName (static_cast<TraceLevel> (level)) << " run failed");
+        }
+      wall[level] = WallClockSeconds () - start;
+      rss[level] = usage.ru_maxrss;
+    }
+
+  std::ios::fmtflags flags = os.flags ();
+  std::streamsize precision = os.precision ();
+  os << "\nTraceLevel  WallClock(s)  Saved(s)  PeakRSS(kB)  Saved(kB)\n";
+  for (int level = TRACE_FULL; level >= TRACE_NONE; level--)
+    {
+      os << std::left << std::setw (12) << TraceLevelName (static_cast<TraceLevel> (level)) << std::right
+         << std::setw (12) << std::fixed << std::setprecision (3) << wall[level]
+         << std::setw (10) << wall[TRACE_FULL] - wall[level]
+         << std::setw (13) << rss[level]
+         << std::setw (11) << rss[TRACE_FULL] - rss[level] << "\n";
+    }
+  os.flags (flags);
+  os.precision (precision);
+}
+
+#endif /* TRACE_LEVEL_H */
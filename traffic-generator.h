@@ -0,0 +1,367 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * One traffic generator for many UDP flows.
+ *
+ * An OnOffApplication per source keeps one packet timer per flow in the
+ * scheduler.  TrafficGenerator drives all flows of a run from a single
+ * pending event: the due times of the flows sit in a heap, and the event
+ * fires at the earliest one and sends every packet due by then.  With
+ * Tick > 0 due times are rounded up to a multiple of Tick, so all flows due
+ * within one tick share an event and the scheduler sees at most one event
+ * per tick however many flows there are.  With Tick = 0 every packet leaves
+ * at its exact time.
+ *
+ * Flows are CBR (as an OnOffApplication that is always on: the first packet
+ * one packet interval after the start, then one per interval), Poisson
+ * (exponential gaps with the same mean) or on/off (CBR while on, with the
+ * OnTime and OffTime random variables of OnOffApplication).  A flow stops at
+ * its stop time or once MaxBytes have been sent.
+ *
+ * Members are defined inline; adhoc_routing.cc registers the TypeId.
+ */
+
+#ifndef TRAFFIC_GENERATOR_H
+#define TRAFFIC_GENERATOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <ostream>
+#include <queue>
+#include <string>
+#include <vector>
+#include "ns3/address.h"
+#include "ns3/data-rate.h"
+#include "ns3/nstime.h"
+#include "ns3/node.h"
+#include "ns3/object.h"
+#include "ns3/packet.h"
+#include "ns3/pointer.h"
+#include "ns3/random-variable-stream.h"
+#include "ns3/simulator.h"
+#include "ns3/socket.h"
+#include "ns3/string.h"
+#include "ns3/traced-callback.h"
+#include "ns3/udp-socket-factory.h"
+
+namespace ns3 {
+
+class TrafficGenerator : public Object
+{
+public:
+  enum Pattern
+  {
+    CBR,
+    POISSON,
+    ONOFF
+  };
+
+  static TypeId GetTypeId (void);
+  TrafficGenerator ();
+
+  /// "cbr", "poisson" or "onoff"
+  static Pattern ParsePattern (const std::string &name);
+
+  /**
+   * Send \p packetSize byte UDP packets at \p rate from \p node to
+   * \p remote, from \p start until \p stop (both from now) or until
+   * \p maxBytes have been sent (0: no limit).  Returns the flow index, as
+   * passed to the Tx trace.
+   */
+  uint32_t AddFlow (Ptr<Node> node, const Address &remote, Pattern pattern, DataRate rate,
+                    uint32_t packetSize, uint64_t maxBytes, Time start, Time stop);
+  int64_t AssignStreams (int64_t stream);
+
+  uint32_t GetNFlows (void) const { return m_flows.size (); }
+  uint64_t GetSent (uint32_t flow) const { return m_flows[flow].sentPackets; }
+  /// Timer events executed so far
+  uint64_t GetEvents (void) const { return m_events; }
+
+  /// Print the packets sent per flow and the number of timer events
+  void PrintStats (std::ostream &os) const;
+
+private:
+  virtual void DoDispose (void);
+
+  struct Flow
+  {
+    Ptr<Socket> socket;
+    Pattern pattern;
+    double interval;      ///< mean gap between packets, s
+    uint32_t packetSize;
+    uint64_t maxBytes;
+    Time stop;            ///< absolute
+    Time onUntil;         ///< on/off flows: end of the current on period
+    Time next;            ///< nominal time of the next packet, before rounding to the tick
+    uint64_t sentPackets;
+    uint64_t sentBytes;
+  };
+
+  /// (due time step, flow), earliest first
+  typedef std::pair<int64_t, uint32_t> Due;
+
+  void Start (uint32_t flow);
+  /// Queue the next packet of \p flow after one gap from \p from
+  void ScheduleNext (uint32_t flow, Time from);
+  void Push (uint32_t flow, Time due);
+  /// Have the pending event fire at the earliest due time
+  void Reschedule (void);
+  void Fire (void);
+  void Send (uint32_t flow);
+
+  Time m_tick;
+  Ptr<RandomVariableStream> m_onTime;
+  Ptr<RandomVariableStream> m_offTime;
+  Ptr<ExponentialRandomVariable> m_gap;
+
+  std::vector<Flow> m_flows;
+  std::priority_queue<Due, std::vector<Due>, std::greater<Due> > m_due;
+  EventId m_event;
+  int64_t m_eventTime;
+  uint64_t m_events;
+  uint64_t m_sent;
+
+  TracedCallback<uint32_t, Ptr<const Packet> > m_txTrace;
+};
+
+inline TypeId
+TrafficGenerator::GetTypeId (void)
+{
+  static TypeId tid = TypeId ("ns3::TrafficGenerator")
+    .SetParent<Object> ()
+    .AddConstructor<TrafficGenerator> ()
+    .AddAttribute ("Tick",
+                   "Round due times up to a multiple of this, so flows due within one tick share an event (0: exact).",
+                   TimeValue (Seconds (0)),
+                   MakeTimeAccessor (&TrafficGenerator::m_tick),
+                   MakeTimeChecker ())
+    .AddAttribute ("OnTime", "On/off flows: length of the on periods, s.",
+                   StringValue ("ns3::ConstantRandomVariable[Constant=1.0]"),
+                   MakePointerAccessor (&TrafficGenerator::m_onTime),
+                   MakePointerChecker <RandomVariableStream> ())
+    .AddAttribute ("OffTime", "On/off flows: length of the off periods, s.",
+                   StringValue ("ns3::ConstantRandomVariable[Constant=1.0]"),
+                   MakePointerAccessor (&TrafficGenerator::m_offTime),
+                   MakePointerChecker <RandomVariableStream> ())
+    .AddTraceSource ("Tx", "A packet of a flow is sent.",
+                     MakeTraceSourceAccessor (&TrafficGenerator::m_txTrace),
+                     "ns3::TrafficGenerator::TxTracedCallback")
+  ;
+  return tid;
+}
+
+inline
+TrafficGenerator::TrafficGenerator ()
+  : m_eventTime (0),
+    m_events (0),
+    m_sent (0)
+{
+  m_gap = CreateObject<ExponentialRandomVariable> ();
+}
+
+inline TrafficGenerator::Pattern
+TrafficGenerator::ParsePattern (const std::string &name)
+{
+  if (name == "cbr")
+    {
+      return CBR;
+    }
+  if (name == "poisson")
+    {
+      return POISSON;
+    }
+  if (name == "onoff")
+    {
+      return ONOFF;
+    }
+  NS_FATAL_ERROR ("Unknown traffic pattern \"" << name << "\"; use cbr, poisson or onoff");
+  return CBR;
+}
+
+inline void
+TrafficGenerator::DoDispose (void)
+{
+  m_event.Cancel ();
+  for (size_t i = 0; i < m_flows.size (); i++)
+    {
+      if (m_flows[i].socket)
+        {
+          m_flows[i].socket->Close ();
+        }
+    }
+  m_flows.clear ();
+  m_onTime = 0;
+  m_offTime = 0;
+  m_gap = 0;
+  Object::DoDispose ();
+}
+
+inline int64_t
+TrafficGenerator::AssignStreams (int64_t stream)
+{
+  m_onTime->SetStream (stream);
+  m_offTime->SetStream (stream + 1);
+  m_gap->SetStream (stream + 2);
+  return 3;
+}
+
+inline uint32_t
+TrafficGenerator::AddFlow (Ptr<Node> node, const Address &remote, Pattern pattern, DataRate rate,
+                           uint32_t packetSize, uint64_t maxBytes, Time start, Time stop)
+{
+  Flow f;
+  f.socket = Socket::CreateSocket (node, UdpSocketFactory::GetTypeId ());
+  f.socket->Bind ();
+  f.socket->Connect (remote);
+  f.socket->SetAllowBroadcast (true);
+  f.socket->ShutdownRecv ();
+  f.pattern = pattern;
+  f.interval = packetSize * 8.0 / rate.GetBitRate ();
+  f.packetSize = packetSize;
+  f.maxBytes = maxBytes;
+  f.stop = Simulator::Now () + stop;
+  f.sentPackets = 0;
+  f.sentBytes = 0;
+  uint32_t flow = m_flows.size ();
+  m_flows.push_back (f);
+  if (start < stop)
+    {
+      Simulator::Schedule (start, &TrafficGenerator::Start, this, flow);
+    }
+  return flow;
+}
+
+inline void
+TrafficGenerator::Start (uint32_t flow)
+{
+  Flow &f = m_flows[flow];
+  if (f.pattern == ONOFF)
+    {
+      f.onUntil = Simulator::Now () + Seconds (m_onTime->GetValue ());
+    }
+  ScheduleNext (flow, Simulator::Now ());
+  Reschedule ();
+}
+
+inline void
+TrafficGenerator::ScheduleNext (uint32_t flow, Time from)
+{
+  Flow &f = m_flows[flow];
+  if (f.maxBytes > 0 && f.sentBytes >= f.maxBytes)
+    {
+      return;
+    }
+  Time due;
+  switch (f.pattern)
+    {
+    case POISSON:
+      due = from + Seconds (m_gap->GetValue (f.interval, 0));
+      break;
+    case ONOFF:
+      due = from + Seconds (f.interval);
+      // skip the off periods the next packet would fall into
+      while (due > f.onUntil && due < f.stop)
+        {
+          Time on = f.onUntil + Seconds (m_offTime->GetValue ());
+          Time until = on + Seconds (m_onTime->GetValue ());
+          if (until <= f.onUntil)
+            {
+              return; // on and off periods of zero length never end
+            }
+          f.onUntil = until;
+          due = on + Seconds (f.interval);
+        }
+      break;
+    default:
+      due = from + Seconds (f.interval);
+      break;
+    }
+  if (due >= f.stop)
+    {
+      return;
+    }
+  f.next = due;
+  Push (flow, due);
+}
+
+inline void
+TrafficGenerator::Push (uint32_t flow, Time due)
+{
+  int64_t t = due.GetTimeStep ();
+  if (m_tick.IsStrictlyPositive ())
+    {
+      int64_t tick = m_tick.GetTimeStep ();
+      t = (t + tick - 1) / tick * tick;
+    }
+  m_due.push (Due (t, flow));
+}
+
+inline void
+TrafficGenerator::Reschedule (void)
+{
+  if (m_due.empty ())
+    {
+      m_event.Cancel ();
+      return;
+    }
+  int64_t t = m_due.top ().first;
+  if (m_event.IsRunning () && m_eventTime == t)
+    {
+      return;
+    }
+  m_event.Cancel ();
+  m_eventTime = t;
+  m_event = Simulator::Schedule (TimeStep (t) - Simulator::Now (), &TrafficGenerator::Fire, this);
+}
+
+inline void
+TrafficGenerator::Fire (void)
+{
+  m_events++;
+  int64_t now = Simulator::Now ().GetTimeStep ();
+  while (!m_due.empty () && m_due.top ().first <= now)
+    {
+      uint32_t flow = m_due.top ().second;
+      m_due.pop ();
+      Send (flow);
+      // the next gap counts from the nominal due time, so rounding to the
+      // tick does not stretch the stream
+      ScheduleNext (flow, m_flows[flow].next);
+    }
+  // only now: a flow pushed in the loop may be due later than one that
+  // was already waiting
+  Reschedule ();
+}
+
+inline void
+TrafficGenerator::Send (uint32_t flow)
+{
+  Flow &f = m_flows[flow];
+  Ptr<Packet> packet = Create<Packet> (f.packetSize);
+  m_txTrace (flow, packet);
+  f.socket->Send (packet);
+  f.sentPackets++;
+  f.sentBytes += f.packetSize;
+  m_sent++;
+}
+
+inline void
+TrafficGenerator::PrintStats (std::ostream &os) const
+{
+  os << "Traffic generator: " << m_flows.size () << " flows, " << m_sent << " packets in "
+     << m_events << " timer events";
+  if (m_events > 0)
+    {
+      os << " (" << double (m_sent) / m_events << " packets per event)";
+    }
+  os << "\n  packets sent per flow:";
+  for (size_t i = 0; i < m_flows.size (); i++)
+    {
+      os << " " << m_flows[i].sentPackets;
+    }
+  os << "\n";
+}
+
+} // namespace ns3
+
+#endif /* TRAFFIC_GENERATOR_H */
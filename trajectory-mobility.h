@@ -0,0 +1,330 @@
+/* -*- Mode:C++; c-file-style:"gnu"; indent-tabs-mode:nil; -*- */
+/*
+ * Precomputed node trajectories, replayed from a memory-mapped file.
+ *
+ * A trajectory file holds, for every node, the piecewise linear path a
+ * waypoint model produced: one record per course change with the time,
+ * position and velocity from then on.  The file is written once per seed
+ * and stream index and mapped read-only by every run that replays it, so
+ * all protocols see exactly the same motion and the page cache is shared
+ * between concurrent workers.
+ *
+ * Positions and velocities are stored as doubles, as the waypoint model
+ * computes them.  Replays of one file are identical to each other.  A
+ * replay follows the live RandomWaypointMobilityModel run it was recorded
+ * from up to the rounding of the interpolation: the live model moves on
+ * from its last position update, the replay from the waypoint.
+ *
+ * Layout: TrajectoryFileHeader, nNodes x TrajectoryIndexEntry, then the
+ * TrajectoryWaypoint records of node 0, node 1, ...
+ */
+
+#ifndef TRAJECTORY_MOBILITY_H
+#define TRAJECTORY_MOBILITY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ns3/event-id.h"
+#include "ns3/mobility-model.h"
+#include "ns3/simple-ref-count.h"
+#include "ns3/simulator.h"
+
+namespace ns3 {
+
+struct TrajectoryFileHeader
+{
+  char magic[8];        ///< "NS3TRAJ2"
+  uint32_t nNodes;
+  uint32_t reserved;
+  double duration;      ///< seconds covered by the trajectories
+  double posMax;        ///< side of the square the nodes move in, m
+  double maxSpeed;      ///< m/s
+  double pause;         ///< s
+  int64_t streamIndex;  ///< first RNG stream used to generate them
+};
+
+struct TrajectoryIndexEntry
+{
+  uint64_t first;       ///< index of the node's first waypoint
+  uint64_t count;
+};
+
+/// Position and velocity of a node from \c time until its next waypoint
+struct TrajectoryWaypoint
+{
+  double time;
+  double x, y, z;
+  double vx, vy, vz;
+};
+
+/// Read-only memory mapping of a trajectory file
+class TrajectoryFile : public SimpleRefCount<TrajectoryFile>
+{
+public:
+  /**
+   * Map \p fileName; returns 0 if it does not exist, is not a trajectory
+   * file or is shorter than its index says, so no waypoint lies beyond the
+   * mapping.
+   */
+  static Ptr<TrajectoryFile> Open (const std::string &fileName)
+  {
+    int fd = open (fileName.c_str (), O_RDONLY);
+    if (fd < 0)
+      {
+        return 0;
+      }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || static_cast<size_t> (st.st_size) < sizeof (TrajectoryFileHeader))
+      {
+        close (fd);
+        return 0;
+      }
+    void *base = mmap (0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (base == MAP_FAILED)
+      {
+        return 0;
+      }
+    if (!IsComplete (base, st.st_size))
+      {
+        munmap (base, st.st_size);
+        return 0;
+      }
+    return Ptr<TrajectoryFile> (new TrajectoryFile (base, st.st_size), false);
+  }
+
+  /// Write \p paths (one waypoint list per node) under \p header
+  static void Write (const std::string &fileName, TrajectoryFileHeader header,
+                     const std::vector<std::vector<TrajectoryWaypoint> > &paths)
+  {
+    std::memcpy (header.magic, "NS3TRAJ2", 8);
+    header.nNodes = paths.size ();
+    header.reserved = 0;
+    // write to a unique temporary file first so a concurrent reader never
+    // maps a half-written file and two writers of the same file never
+    // write into each other's; the last rename wins with a whole file
+    std::vector<char> tmpName (fileName.begin (), fileName.end ());
+    const char suffix[] = ".XXXXXX";
+    tmpName.insert (tmpName.end (), suffix, suffix + sizeof (suffix));
+    int fd = mkstemp (tmpName.data ());
+    if (fd < 0)
+      {
+        NS_FATAL_ERROR ("Cannot create a temporary file for " << fileName << ": " << std::strerror (errno));
+      }
+    fchmod (fd, 0644);
+    std::FILE *out = fdopen (fd, "wb");
+    bool ok = out && std::fwrite (&header, sizeof (header), 1, out) == 1;
+    uint64_t first = 0;
+    for (size_t i = 0; ok && i < paths.size (); i++)
+      {
+        TrajectoryIndexEntry entry;
+        entry.first = first;
+        entry.count = paths[i].size ();
+        ok = std::fwrite (&entry, sizeof (entry), 1, out) == 1;
+        first += entry.count;
+      }
+    for (size_t i = 0; ok && i < paths.size (); i++)
+      {
+        ok = std::fwrite (paths[i].data (), sizeof (TrajectoryWaypoint), paths[i].size (), out) == paths[i].size ();
+      }
+    if (out ? std::fclose (out) != 0 : close (fd) != 0)
+      {
+        ok = false;
+      }
+    if (!ok || rename (tmpName.data (), fileName.c_str ()) != 0)
+      {
+        unlink (tmpName.data ());
+        NS_FATAL_ERROR ("Cannot write trajectory file " << fileName);
+      }
+  }
+
+  ~TrajectoryFile ()
+  {
+    munmap (m_base, m_size);
+  }
+
+  const TrajectoryFileHeader &GetHeader (void) const
+  {
+    return *static_cast<const TrajectoryFileHeader *> (m_base);
+  }
+
+  uint64_t GetNWaypoints (uint32_t node) const
+  {
+    return Index ()[node].count;
+  }
+
+  const TrajectoryWaypoint *GetWaypoints (uint32_t node) const
+  {
+    const TrajectoryWaypoint *all = reinterpret_cast<const TrajectoryWaypoint *> (Index () + GetHeader ().nNodes);
+    return all + Index ()[node].first;
+  }
+
+private:
+  TrajectoryFile (void *base, size_t size) : m_base (base), m_size (size) {}
+
+  /// The magic matches and the index and every node's waypoints lie within \p size bytes
+  static bool IsComplete (const void *base, size_t size)
+  {
+    const TrajectoryFileHeader *header = static_cast<const TrajectoryFileHeader *> (base);
+    if (std::memcmp (header->magic, "NS3TRAJ2", 8) != 0
+        || (size - sizeof (TrajectoryFileHeader)) / sizeof (TrajectoryIndexEntry) < header->nNodes)
+      {
+        return false;
+      }
+    size_t indexEnd = sizeof (TrajectoryFileHeader) + header->nNodes * sizeof (TrajectoryIndexEntry);
+    uint64_t maxWaypoints = (size - indexEnd) / sizeof (TrajectoryWaypoint);
+    const TrajectoryIndexEntry *index = reinterpret_cast<const TrajectoryIndexEntry *> (static_cast<const char *> (base) + sizeof (TrajectoryFileHeader));
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < header->nNodes; i++)
+      {
+        // nodes are stored one after the other, so each starts where the
+        // previous one ended
+        if (index[i].first != total || index[i].count > maxWaypoints - total)
+          {
+            return false;
+          }
+        total += index[i].count;
+      }
+    return indexEnd + total * sizeof (TrajectoryWaypoint) == size;
+  }
+
+  const TrajectoryIndexEntry *Index (void) const
+  {
+    return reinterpret_cast<const TrajectoryIndexEntry *> (static_cast<const char *> (m_base) + sizeof (TrajectoryFileHeader));
+  }
+
+  void *m_base;
+  size_t m_size;
+};
+
+/**
+ * Mobility model that follows one node's path of a TrajectoryFile.
+ *
+ * It needs no random variables; CourseChange fires at every waypoint, as
+ * it did for the model the trajectory was recorded from.  SetPosition ()
+ * moves the node there and stops the replay.
+ */
+class TrajectoryMobilityModel : public MobilityModel
+{
+public:
+  static TypeId GetTypeId (void)
+  {
+    static TypeId tid = TypeId ("ns3::TrajectoryMobilityModel")
+      .SetParent<MobilityModel> ()
+      .AddConstructor<TrajectoryMobilityModel> ()
+    ;
+    return tid;
+  }
+
+  TrajectoryMobilityModel ()
+    : m_waypoints (0),
+      m_count (0),
+      m_cursor (0),
+      m_stopped (false)
+  {
+  }
+
+  void SetTrajectory (Ptr<const TrajectoryFile> file, uint32_t node)
+  {
+    NS_ASSERT_MSG (node < file->GetHeader ().nNodes, "Trajectory file has no node " << node);
+    m_file = file;
+    m_waypoints = file->GetWaypoints (node);
+    m_count = file->GetNWaypoints (node);
+    m_cursor = 0;
+  }
+
+private:
+  virtual void DoInitialize (void)
+  {
+    ScheduleNext ();
+    MobilityModel::DoInitialize ();
+  }
+
+  virtual void DoDispose (void)
+  {
+    m_event.Cancel ();
+    m_file = 0;
+    m_waypoints = 0;
+    MobilityModel::DoDispose ();
+  }
+
+  /// Advance the cursor to the last waypoint at or before now
+  void Seek (void) const
+  {
+    // compare as Time so an event scheduled at Seconds (time) always moves past it
+    Time now = Simulator::Now ();
+    while (m_cursor + 1 < m_count && Seconds (m_waypoints[m_cursor + 1].time) <= now)
+      {
+        m_cursor++;
+      }
+  }
+
+  void ScheduleNext (void)
+  {
+    Seek ();
+    if (m_stopped || m_cursor + 1 >= m_count)
+      {
+        return;
+      }
+    Time next = Seconds (m_waypoints[m_cursor + 1].time) - Simulator::Now ();
+    m_event = Simulator::Schedule (next, &TrajectoryMobilityModel::Waypoint, this);
+  }
+
+  void Waypoint (void)
+  {
+    NotifyCourseChange ();
+    ScheduleNext ();
+  }
+
+  virtual Vector DoGetPosition (void) const
+  {
+    if (m_stopped || m_count == 0)
+      {
+        return m_position;
+      }
+    Seek ();
+    const TrajectoryWaypoint &w = m_waypoints[m_cursor];
+    double dt = std::max (0.0, Simulator::Now ().GetSeconds () - w.time);
+    return Vector (w.x + w.vx * dt, w.y + w.vy * dt, w.z + w.vz * dt);
+  }
+
+  virtual void DoSetPosition (const Vector &position)
+  {
+    m_stopped = true;
+    m_position = position;
+    m_event.Cancel ();
+    NotifyCourseChange ();
+  }
+
+  virtual Vector DoGetVelocity (void) const
+  {
+    if (m_stopped || m_count == 0)
+      {
+        return Vector (0, 0, 0);
+      }
+    Seek ();
+    const TrajectoryWaypoint &w = m_waypoints[m_cursor];
+    return Vector (w.vx, w.vy, w.vz);
+  }
+
+  Ptr<const TrajectoryFile> m_file;
+  const TrajectoryWaypoint *m_waypoints;
+  uint64_t m_count;
+  mutable uint64_t m_cursor;
+  bool m_stopped;
+  Vector m_position;
+  EventId m_event;
+};
+
+} // namespace ns3
+
+#endif /* TRAJECTORY_MOBILITY_H */